@@ -0,0 +1,108 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+/*
+ * file layout:
+ *  header: magic(8 bytes) | version(4 bytes) | reserved(4 bytes) | num_compute(8 bytes) | num_memory(8 bytes)
+ *          | num_shards(8 bytes) | key_lb(8 bytes) | key_ub(8 bytes) | round(8 bytes)
+ *  shards: Checkpoint_Shard[num_shards] by shard id
+ * the shards are fixed size records, so a restore reads them in place from the mapped file.
+ */
+struct Checkpoint_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_compute;
+    uint64_t num_memory;
+    uint64_t num_shards;
+    uint64_t key_lb;
+    uint64_t key_ub;
+    uint64_t round;
+};
+
+struct Checkpoint_Shard {
+    uint64_t lb, ub; // key range [lb, ub)
+    uint64_t last_load, last_remote_reads; // decayed loads
+    uint32_t next, prev; // neighbours in key order, num_shards if there is none
+    uint32_t owner, memory;
+};
+
+inline static constexpr char checkpoint_magic[8] = {'T', 'S', 'C', 'K', 'P', 'T', '\0', '\0'};
+inline static constexpr uint32_t checkpoint_version = 1;
+
+/*
+ * writes checkpoints on its own thread. the load balancer thread only fills a buffer and swaps it in, so a
+ * checkpoint pauses a round for one pass over the shards. a checkpoint is written to <path>.tmp and then
+ * renamed, so the file at path is always a complete checkpoint.
+ */
+class Checkpoint_Writer {
+public:
+    explicit Checkpoint_Writer(const std::string& path);
+    ~Checkpoint_Writer(); // writes the pending checkpoint before returning
+
+    Checkpoint_Writer(const Checkpoint_Writer&) = delete;
+    Checkpoint_Writer& operator=(const Checkpoint_Writer&) = delete;
+
+    // swaps shards with the buffer of the writer thread. returns false and keeps shards if the previous
+    // checkpoint is still being written
+    bool submit(const Checkpoint_Header& header, std::vector<Checkpoint_Shard>& shards);
+
+    void report(char* buffer);
+
+private:
+    void run();
+    bool write();
+
+    std::string path, tmp_path;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool pending = false;
+    bool stopped = false;
+    Checkpoint_Header header;
+    std::vector<Checkpoint_Shard> shards;
+    std::atomic<size_t> num_written;
+    std::atomic<size_t> num_skipped;
+    std::atomic<size_t> num_failed;
+    std::atomic<uint64_t> last_write_us;
+    std::thread thread;
+};
+
+// maps a checkpoint into memory. the shards are read in place
+class Checkpoint_Reader {
+public:
+    explicit Checkpoint_Reader(const std::string& path);
+    ~Checkpoint_Reader();
+
+    Checkpoint_Reader(const Checkpoint_Reader&) = delete;
+    Checkpoint_Reader& operator=(const Checkpoint_Reader&) = delete;
+
+    inline const Checkpoint_Header& header() const {
+        return *reinterpret_cast<const Checkpoint_Header*>(data);
+    }
+
+    inline const Checkpoint_Shard* shards() const {
+        return reinterpret_cast<const Checkpoint_Shard*>(data + sizeof(Checkpoint_Header));
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+}
+
+#endif
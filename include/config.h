@@ -1,14 +1,8 @@
 #ifndef CONFIG_H_H
 #define CONFIG_H_H
 #define PRINTER_LOCK // if defined, pauses the system for printing
-#define PRINT_NODE_INFO // if defined, prints node info
-#define PRINT_SHARD_INFO // if defined, prints shard info
-#define PRINT_INPUT // if defined, prints input arguments
-#define PRINT_SHARD_PER_NODE // if defined, prints shards owned by nodes
-#define PRINT_UPDATE_INFO // if defined, prints update info whenever there is an update
-#define DEBUG // if defined, does additional assetions and prints
-#define ANALYZE // if defined, prints analysis info
 #define PRINT_COLORED // if defined, prints colored output
+// #define PROFILE_LOCKS // if defined, records wait and hold times of the load vector lock per call site and thread. off by default, as it reads the TSC on every increment and flush
 
 #include "testlog.h"
 
@@ -0,0 +1,112 @@
+#ifndef LATENCY_MODEL_H_
+#define LATENCY_MODEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+/*
+ * log-linear histogram: values below 2^sub_bucket_bits are exact and every power of two range
+ * above it is split into 2^sub_bucket_bits buckets(<= 6.25% relative error).
+ * recording and draining can happen on different threads.
+ */
+class Latency_Histogram {
+public:
+    inline static constexpr size_t sub_bucket_bits = 4;
+    inline static constexpr size_t sub_buckets = 1ull << sub_bucket_bits;
+    inline static constexpr size_t num_buckets = sub_buckets * (64 - sub_bucket_bits + 1);
+
+    Latency_Histogram() : counts(new std::atomic<uint64_t>[num_buckets]) {
+        for (size_t i = 0; i < num_buckets; ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline void record(uint64_t value) {
+        counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // moves the counts into snapshot(which is accumulated, not overwritten) and resets the histogram
+    void drain(std::vector<uint64_t>& snapshot);
+
+    static uint64_t percentile(const std::vector<uint64_t>& snapshot, double p);
+    static uint64_t total(const std::vector<uint64_t>& snapshot);
+
+    static inline size_t bucket(uint64_t value) {
+        if (value < sub_buckets) {
+            return value;
+        }
+        size_t msb = 63 - __builtin_clzll(value);
+        size_t shift = msb - sub_bucket_bits;
+        return ((shift + 1) << sub_bucket_bits) + ((value >> shift) & (sub_buckets - 1));
+    }
+
+    // upper bound of the values falling into bucket idx
+    static inline uint64_t bucket_value(size_t idx) {
+        if (idx < sub_buckets) {
+            return idx;
+        }
+        size_t shift = (idx >> sub_bucket_bits) - 1;
+        uint64_t base = (sub_buckets | (idx & (sub_buckets - 1))) << shift;
+        return base + ((1ull << shift) - 1);
+    }
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+};
+
+// a compute node modeled as a queue in front of num_servers identical servers
+class Queue_Node {
+public:
+    explicit Queue_Node(size_t num_servers) : free_at(num_servers, 0) {}
+
+    // returns the time the request spends in the node(waiting + service)
+    uint64_t serve(uint64_t arrival, uint64_t service_time);
+
+    inline uint64_t backlog(uint64_t now) const {
+        return free_at.front() > now ? free_at.front() - now : 0;
+    }
+
+private:
+    std::vector<uint64_t> free_at; // min-heap of the time each server becomes free
+};
+
+/*
+ * Simulated request latency. Ops arrive every op_interval units of simulated time and are queued at
+ * the compute node owning their shard at arrival time. Service times are in the same units as
+ * the per-op times used for the load(local_read_time, remote_read_time, ...).
+ * on_op is called by the load generator and report by the printer.
+ */
+class Latency_Model {
+public:
+    Latency_Model(size_t num_compute, size_t num_servers_per_node, size_t op_interval);
+
+    // returns the arrival time of the op. delay is the time the op is held before reaching the node
+    uint64_t on_op(size_t node, uint64_t service_time, uint64_t delay = 0);
+
+    // the arrival time of the next op
+    inline uint64_t now() const {
+        return clock.load(std::memory_order_relaxed);
+    }
+
+    // writes the p50/p99/p999 of each node and of all ops since the last report into buffer
+    void report(char* buffer, size_t num_nodes_to_print);
+
+private:
+    std::vector<Queue_Node> nodes;
+    std::unique_ptr<Latency_Histogram[]> nodes_hist;
+    Latency_Histogram global_hist;
+    std::vector<uint64_t> snapshot;
+    std::atomic<uint64_t> clock;
+    size_t op_interval;
+};
+
+}
+
+#endif
@@ -6,12 +6,23 @@
 #define TimberSaw_LOAD_BALANCER_H
 
 #include "load_info_container.h"
+#include "round_metrics.h"
+#include "ring_buffer.h"
+#include "phase_timer.h"
+#include "lock_profiler.h"
+#include "routing_table.h"
+#include "period_controller.h"
+#include "random.h"
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 #include <memory>
+#include <functional>
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <stdexcept>
 
 #include "config.h"
 
@@ -19,16 +30,20 @@ struct load_vector;
 
 namespace TimberSaw {
 
-class Load_Balancer {
+class Key_Load_Histogram;
+
+class Load_Balancer : protected Plan_Sink {
 public:
-    virtual void start() = 0; // runs a thread which periodically does load balancing and then sleeps
+    void start(); // runs a thread which periodically does load balancing and then sleeps
+    virtual void balance_round() = 0; // plans and applies one round. called by start or directly by a driver like a benchmark
+    void run_round(); // balance_round, then hands the round and its time to the period controller if there is one
     // void new_bindings(); // returns a new ownership map -> will replace compute_node_info when ready
     void shut_down();
     virtual void set_up_new_plan() = 0; // gets a new optimal plan and executes a protocol to make sure things are running. -> run by load_balancer or main thread?
 
     // void rewrite_load_info(size_t shard, size_t num_reads, size_t num_writes, size_t num_remote_reads, size_t num_flushes);
     // void increment_load_info(size_t shard, size_t num_reads, size_t num_writes, size_t num_remote_reads, size_t num_flushes);
-    void increment_load_info(size_t shard, size_t added_load);
+    void increment_load_info(size_t shard, size_t added_load, size_t remote_reads = 0);
 
     #ifdef PRINTER_LOCK
     void pause() {
@@ -48,45 +63,153 @@ public:
         return container->num_compute();
     }
 
+    size_t shard_owner(size_t shard) {
+        return container->shard_id(shard).owner();
+    }
+
+    // memory used by the load info of the shards
+    size_t shard_metadata_bytes() {
+        return container->metadata_bytes();
+    }
+
     void set_vector(load_vector& _lv) {
         lv = &_lv;
     }
 
+    // sink gets every new plan after it is applied. should be called before start
+    void add_plan_sink(Plan_Sink* sink) {
+        assert(sink != nullptr);
+        plan_sinks.push_back(sink);
+    }
+
+    // publishes the current ownership to table and then a new snapshot after every round changing it.
+    // should be called after set_vector and before start
+    void set_routing_table(Routing_Table* table);
+
+    // spreads the shards over num_memory memory nodes. if capacity is not 0, every round moves the data of shards
+    // off the memory nodes serving more than capacity(decayed remote reads) to the least loaded ones.
+    // should be called before start
+    void set_memory_nodes(size_t num_memory, size_t capacity);
+
+    // returns false if there is no new round metrics. should only be called by one thread
+    bool pop_round_metrics(Round_Metrics& metrics) {
+        return round_metrics_queue.try_pop(metrics);
+    }
+
+    size_t num_dropped_round_metrics() {
+        return dropped_round_metrics.load();
+    }
+
+    // if enabled, a round dividing shards ends by renumbering the shards in key order. on by default
+    void set_renumbering(bool enabled) {
+        renumbering = enabled;
+    }
+
+    // every period_rounds rounds end by handing a checkpoint of the shards to writer. should be called before start
+    void set_checkpoint(Checkpoint_Writer* writer, size_t period_rounds) {
+        assert(period_rounds > 0 && !started.load());
+        checkpoint_writer = writer;
+        checkpoint_period = period_rounds;
+    }
+
+    // start waits controller->period_ms() between two rounds instead of rebalance_period_seconds.
+    // should be called before start
+    void set_period_controller(Period_Controller* controller) {
+        assert(!started.load());
+        period_controller = controller;
+    }
+
+    // a shard moved in the last cooldown_rounds rounds is only moved again if the move cuts the load gap of the two
+    // nodes by more than its load plus hysteresis_percent of it, so a noisy load does not bounce shards between nodes.
+    // a move cuts the gap by at most twice the load, so a hysteresis of 100 or more pins the shard for the cooldown.
+    // a cooldown of 0 turns it off, as by default. only the greedy(fixed and dynamic) balancers hold shards back
+    void set_migration_damping(size_t _cooldown_rounds, size_t _hysteresis_percent) {
+        cooldown_rounds = _cooldown_rounds;
+        hysteresis_percent = _hysteresis_percent;
+    }
+
+    // if enabled, the greedy(fixed and dynamic) balancers move a shard to the owner of a key neighbour of it instead of
+    // the least loaded node, as long as that owner stays within the threshold of the mean. nodes then keep fewer and
+    // longer key ranges(see Round_Metrics::num_runs) so scans visit fewer nodes. off by default
+    void set_locality_aware(bool enabled) {
+        locality_aware = enabled;
+    }
+
+    // replaces the shards with their key ranges, owners and decayed loads of a checkpoint. should be called after
+    // set_vector and set_memory_nodes and before set_routing_table and the first increment.
+    // throws std::runtime_error if the checkpoint does not fit the load balancer and the load vector
+    void restore(const Checkpoint_Reader& checkpoint);
+
+    // replaces the uniform shards with num_shards() ones of about the same load in histogram and gives every node
+    // consecutive shards of about the same load. should be called like restore
+    void warm_start(const Key_Load_Histogram& histogram);
+
+    // per-round cycles of each phase over all rounds so far
+    void print_phase_stats(char* buffer) {
+        sprintf(buffer + strlen(buffer), "phase cycles per round over %lu rounds(mean, p50, p99):\n", phase_stats.rounds());
+        for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+            sprintf(buffer + strlen(buffer), "%s: %lu, %lu, %lu\n", phase_name(phase), phase_stats.mean(phase)
+                , phase_stats.percentile(phase, 0.5), phase_stats.percentile(phase, 0.99));
+        }
+    }
+
+    // number of ownership transfers and shard divisions since the last call
+    void take_plan_stats(size_t& changes, size_t& divides) {
+        changes = num_changes.exchange(0);
+        divides = num_divides.exchange(0);
+    }
+
+    // load of each node since the last print(or current load if round loads are not analyzed)
+    void round_loads(std::vector<size_t>& node_loads) {
+        node_loads.assign(container->num_compute(), 0);
+        for (size_t shard = 0; shard < container->num_shards(); ++shard) {
+            node_loads[container->shard_id(shard).owner()] += container->shard_id(shard).round_load();
+        }
+    }
+
     void print(char* buffer, size_t num_nodes_to_print, size_t num_shards_to_print, size_t num_shards_to_print_per_compute_node) {
         #ifdef PRINT_COLORED
         sprintf(buffer + strlen(buffer), COLOR_CYAN "num total shards: %lu" COLOR_RESET "\n", container->num_shards());
         #else
         sprintf(buffer + strlen(buffer), "num total shards: %lu\n", container->num_shards());
         #endif
-        #ifdef PRINT_NODE_INFO
-        #ifdef PRINT_COLORED
-        sprintf(buffer + strlen(buffer), COLOR_YELLOW "node info:" COLOR_RESET"\n");
-        #else
-        sprintf(buffer + strlen(buffer), "node info:\n");
-        #endif
-        for(size_t node = 0; node < container->num_compute() && (num_nodes_to_print == 0 || node < num_nodes_to_print); ++node) {
-            (*container)[node].print(buffer, num_shards_to_print_per_compute_node);
+        if (observing(OBSERVE_NODE_INFO)) {
+            #ifdef PRINT_COLORED
+            sprintf(buffer + strlen(buffer), COLOR_YELLOW "node info:" COLOR_RESET"\n");
+            #else
+            sprintf(buffer + strlen(buffer), "node info:\n");
+            #endif
+            for(size_t node = 0; node < container->num_compute() && (num_nodes_to_print == 0 || node < num_nodes_to_print); ++node) {
+                (*container)[node].print(buffer, num_shards_to_print_per_compute_node);
+            }
+            sprintf(buffer + strlen(buffer), "\n");
         }
-        sprintf(buffer + strlen(buffer), "\n");
-        #endif
 
-        #ifdef PRINT_SHARD_INFO
-        #ifdef PRINT_NODE_INFO
-        sprintf(buffer + strlen(buffer), "\n");
-        #endif
-        sprintf(buffer + strlen(buffer), "shard info:\n");
-        for(size_t shard = 0, counter = 0; shard < container->num_shards() && (num_shards_to_print == 0 || counter < num_shards_to_print); shard = container->shard_id(shard).next_id(), ++counter) {
-            container->shard_id(shard).print(buffer);
+        if (observing(OBSERVE_SHARD_INFO)) {
+            if (observing(OBSERVE_NODE_INFO)) {
+                sprintf(buffer + strlen(buffer), "\n");
+            }
+            sprintf(buffer + strlen(buffer), "shard info:\n");
+            for(size_t shard = 0, counter = 0; shard < container->num_shards() && (num_shards_to_print == 0 || counter < num_shards_to_print); shard = container->shard_id(shard).next_id(), ++counter) {
+                container->shard_id(shard).print(buffer);
+            }
         }
-        #endif
 
-        #ifdef ANALYZE
-        container->new_round();
-        #endif
+        if (num_memory > 1) {
+            print_memory_traffic(buffer);
+        }
 
-        #if defined(PRINT_NODE_INFO) || defined(PRINT_SHARD_INFO)
-        sprintf(buffer + strlen(buffer), "_____________________________________________________\n");
-        #endif
+        if (observing(OBSERVE_ROUND_LOAD)) {
+            container->new_round();
+        }
+
+        if (phase_stats.enabled()) {
+            print_phase_stats(buffer);
+        }
+
+        if (observing(OBSERVE_NODE_INFO | OBSERVE_SHARD_INFO)) {
+            sprintf(buffer + strlen(buffer), "_____________________________________________________\n");
+        }
     }
 
     // void set_num_shards_to_print_per_compute_node(size_t num_shards_to_print_per_compute_node) {
@@ -102,6 +225,45 @@ protected:
 
     ~Load_Balancer();
 
+    // should be called right after compute_load_and_pass of the container
+    void begin_round();
+    // should be called after the plan of the round is set up or when the round is skipped
+    void end_round();
+    // moves shards between memory nodes until none serves more than memory_capacity. called by end_round
+    void balance_memory_nodes();
+    // renumbers the shards of the container, the load vector and the plan sinks in key order. called by end_round
+    void renumber_shards();
+    // fills the checkpoint records and hands them to the checkpoint writer. called by end_round
+    void write_checkpoint();
+    void print_memory_traffic(char* buffer);
+    // the balancer is the sink of its container. it records the plan stats and forwards the plan to plan_sinks
+    void begin_plan(size_t num_transfers) override;
+    void transfer(const Owner_Ship_Transfer& transfer) override;
+    void end_plan() override;
+
+    // the container as the type the balancer created it with. the containers are final, so calls through it
+    // are resolved at compile time
+    template<class Container>
+    inline Container& typed_container() {
+        return static_cast<Container&>(*container);
+    }
+
+    // if moving shard from a node of from_load to a node of to_load should wait for the cooldown of the shard.
+    // see set_migration_damping
+    inline bool held_back(const Shard_Info& shard, size_t from_load, size_t to_load) const {
+        if (cooldown_rounds == 0 || !shard.moved_within(round_metrics.round, cooldown_rounds)) {
+            return false;
+        }
+        int64_t gap = static_cast<int64_t>(from_load) - static_cast<int64_t>(to_load);
+        int64_t load = shard.load();
+        int64_t gain = gap - std::abs(gap - 2 * load);
+        return gain * 100 <= load * static_cast<int64_t>(100 + hysteresis_percent);
+    }
+
+    // the node shard of the max node should move to: to, the least loaded node, unless locality_aware and an ordered
+    // owner of a key neighbour of shard owns more of its neighbours than to and stays within the threshold of the mean
+    size_t placement(const Shard_Info& shard, size_t to, size_t mean_load);
+
     inline int check_load(size_t load, size_t mean_load) {
         if (load > mean_load && load - mean_load > load_imbalance_threshold_half) {
             return 2;
@@ -121,6 +283,32 @@ protected:
     }
     load_vector* lv = nullptr;
     Load_Info_Container_Base* container;
+    std::vector<Plan_Sink*> plan_sinks;
+    Routing_Table* routing_table = nullptr;
+    size_t num_memory = 1;
+    size_t memory_capacity = 0; // 0 means unlimited
+    std::vector<size_t> memory_traffic; // by memory node, of the last round
+    std::vector<std::vector<size_t>> memory_shards; // shards of each memory node, reused by every round
+    Plan_Printer plan_printer; // a plan sink if observing OBSERVE_UPDATES
+    std::atomic<size_t> num_changes;
+    std::atomic<size_t> num_divides;
+
+    size_t round = 0;
+    Round_Metrics round_metrics;
+    SPSC_Ring_Buffer<Round_Metrics, 1024> round_metrics_queue;
+    std::atomic<size_t> dropped_round_metrics;
+    std::vector<size_t> node_loads_buffer, shard_loads_buffer;
+    bool renumbering = true;
+    std::vector<uint32_t> old_to_new; // reused by every renumbering
+    Checkpoint_Writer* checkpoint_writer = nullptr;
+    size_t checkpoint_period = 0;
+    std::vector<Checkpoint_Shard> checkpoint_records; // swapped with the buffer of the writer
+    Period_Controller* period_controller = nullptr;
+    size_t cooldown_rounds = 0;
+    size_t hysteresis_percent = 0;
+    bool locality_aware = false;
+    std::vector<size_t> node_runs_buffer;
+    Phase_Stats phase_stats;
     std::atomic<bool> started;
     #ifdef PRINTER_LOCK
     std::mutex mtx;
@@ -133,24 +321,78 @@ protected:
 };
 
 
-class Fixed_Load_Balancer : public Load_Balancer {
+/*
+ * policies of Greedy_Load_Balancer. they are plain structs of static functions so the planner loops are
+ * specialized for every balancer at compile time instead of branching on the balancer type every shard.
+ */
+
+// the load gap between the max and min node that is tolerated
+struct Ratio_Threshold {
+    static inline size_t threshold(size_t mean_load, size_t load_imbalance_ratio) {
+        return mean_load / load_imbalance_ratio;
+    }
+};
+
+// shards are never divided
+struct No_Split {
+    inline static constexpr bool enabled = false;
+    static inline size_t num_pieces(size_t /* shard_load */, size_t /* threshold_half */) {
+        return 1;
+    }
+};
+
+// a heavy shard of the max node is divided into pieces of about a quarter of the half threshold
+struct Proportional_Split {
+    inline static constexpr bool enabled = true;
+    static inline size_t num_pieces(size_t shard_load, size_t threshold_half) {
+        return threshold_half == 0 ? 1 : (shard_load * 4) / threshold_half;
+    }
+};
+
+// the shards of the max node are visited heaviest first. a shard is skipped if moving it would leave the
+// max node too light or the min node too heavy, and the node is done once both are in the prefered range.
+// the arguments are check_load of the max and min node after the move
+struct Heaviest_First_Selection {
+    static inline bool skip(int hload_stat, int lload_stat) {
+        return hload_stat < -1 || lload_stat > 1;
+    }
+    static inline bool done(int hload_stat, int lload_stat) {
+        return hload_stat < 2 && lload_stat > -2;
+    }
+};
+
+/*
+ * moves shards from the max node to the min node until both are within the threshold of the mean.
+ * Fixed_Load_Balancer and Dynamic_Load_Balancer are instances of it, a new greedy balancer is a new set of
+ * policies and an explicit instantiation in load_balancer.cpp.
+ */
+template<class Container, class Threshold_Policy, class Split_Policy, class Selection_Policy>
+class Greedy_Load_Balancer : public Load_Balancer {
 public:
-    Fixed_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+    Greedy_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
         , size_t _rebalance_period_seconds, size_t _load_imbalance_threshold, size_t low_load_threshold);
 
-    ~Fixed_Load_Balancer();
-    void start(); // runs a thread which periodically does load balancing and then sleeps
+    ~Greedy_Load_Balancer();
+    void balance_round();
     void set_up_new_plan();
+
+private:
+    // divides the heaviest shards of max_node as long as moving them would overshoot
+    void split_heavy_shards(Container& container, Compute_Node_Info& max_node, size_t mean_load);
+
+    std::vector<char> was_max; // by node, if the node was the max node earlier in the round
 };
 
-class Dynamic_Load_Balancer : public Load_Balancer {
+class Fixed_Load_Balancer final
+    : public Greedy_Load_Balancer<Load_Info_Container, Ratio_Threshold, No_Split, Heaviest_First_Selection> {
 public:
-    Dynamic_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
-        , size_t _rebalance_period_seconds, size_t _load_imbalance_threshold, size_t low_load_threshold);
+    using Greedy_Load_Balancer::Greedy_Load_Balancer;
+};
 
-    ~Dynamic_Load_Balancer();
-    void start(); // runs a thread which periodically does load balancing and then sleeps
-    void set_up_new_plan();
+class Dynamic_Load_Balancer final
+    : public Greedy_Load_Balancer<Load_Info_Container, Ratio_Threshold, Proportional_Split, Heaviest_First_Selection> {
+public:
+    using Greedy_Load_Balancer::Greedy_Load_Balancer;
 };
 
 class Dynamic_Restricted_Load_Balancer : public Load_Balancer {
@@ -159,11 +401,14 @@ public:
         , size_t _rebalance_period_seconds, size_t _load_imbalance_threshold, size_t low_load_threshold);
 
     ~Dynamic_Restricted_Load_Balancer();
-    void start(); // runs a thread which periodically does load balancing and then sleeps
+    void balance_round();
     void set_up_new_plan();
 
     void push_load_left(size_t node_idx, size_t load, size_t mean_load);
     void push_load_right(size_t node_idx, size_t load, size_t mean_load);
+
+    // binary search over the key ranges of the nodes. should only be called by the load balancer thread
+    size_t node_of_key(size_t key);
     // void pull_load_left(size_t node_idx, size_t load, size_t mean_load);
     // void pull_load_right(size_t node_idx, size_t load, size_t mean_load);
 
@@ -175,6 +420,123 @@ private:
         , size_t& left_load_req, size_t& right_load_req);
 };
 
+/*
+ * two level balancer for large clusters. nodes are split into groups of group_size consecutive nodes.
+ * a coarse pass first moves shards between groups, from the max node of the most loaded group to the
+ * min node of the least loaded one, until the group loads are balanced. then every group is balanced
+ * independently on up to num_planner_threads threads. shards are not divided.
+ */
+class Hierarchical_Load_Balancer : public Load_Balancer {
+public:
+    Hierarchical_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+        , size_t _rebalance_period_seconds, size_t _load_imbalance_threshold, size_t low_load_threshold
+        , size_t group_size, size_t num_planner_threads);
+
+    ~Hierarchical_Load_Balancer();
+    void balance_round();
+    void set_up_new_plan();
+
+    inline size_t group_of(size_t node) const {
+        return node / group_size;
+    }
+
+private:
+    size_t group_size;
+    size_t num_groups;
+    size_t num_planner_threads;
+    std::vector<size_t> planned_loads; // node loads after the transfers planned so far in the round
+    std::vector<size_t> group_loads;
+    std::vector<char> moved; // by shard id, if the shard already has a transfer in the round
+    // transfers planned by the inter group pass and by each group. shard is the index in the shards of from
+    std::vector<Owner_Ship_Transfer> inter_group_transfers;
+    std::vector<std::vector<Owner_Ship_Transfer>> group_transfers;
+
+    void plan_between_groups(Load_Info_Container& container);
+    void plan_group(Load_Info_Container& container, size_t group);
+    // index of the largest shard of node without a transfer and a load of at most max_load
+    bool pick_shard(Load_Info_Container& container, size_t node, size_t max_load, size_t& index);
+    void move_planned(std::vector<Owner_Ship_Transfer>& transfers, Load_Info_Container& container, size_t from, size_t index, size_t to);
+};
+
+/*
+ * consistent hashing with bounded loads. every node has num_virtual_nodes points on a hash ring and a shard belongs to
+ * the first node clockwise from its own point whose load stays under mean_load * (100 + load_bound_percent) / 100.
+ * a round only moves the shards of the nodes above the bound to the next node on the ring with room, and the shards
+ * whose first node has room again back to it. there is no global planning and shards are not divided.
+ */
+class Consistent_Hashing_Load_Balancer : public Load_Balancer {
+public:
+    Consistent_Hashing_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+        , size_t _rebalance_period_seconds, size_t _load_imbalance_threshold, size_t low_load_threshold
+        , size_t num_virtual_nodes, size_t load_bound_percent);
+
+    ~Consistent_Hashing_Load_Balancer();
+    void balance_round();
+    void set_up_new_plan();
+
+    // node of the first point clockwise from the point of shard
+    inline size_t home(size_t shard) const {
+        return ring[ring_position(shard)].second;
+    }
+
+private:
+    size_t load_bound_percent;
+    std::vector<std::pair<uint64_t, size_t>> ring; // (point, node) sorted by point
+    std::vector<size_t> planned_loads;
+    std::vector<char> moved; // by shard id, if the shard already has a transfer in the round
+    std::vector<uint64_t> visited; // by node, the last call of next_with_room that visited it
+    uint64_t visit = 0;
+    size_t num_planned = 0;
+
+    static inline uint64_t hash(uint64_t x) { // splitmix64 finalizer
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    inline size_t ring_position(size_t shard) const {
+        size_t pos = std::lower_bound(ring.begin(), ring.end(), std::make_pair(hash(shard), size_t(0))) - ring.begin();
+        return pos == ring.size() ? 0 : pos;
+    }
+
+    // first node clockwise from the point of shard, other than owner, that can take load without exceeding bound.
+    // returns owner if there is none
+    size_t next_with_room(size_t shard, size_t owner, size_t load, size_t bound);
+};
+
+/*
+ * decentralized balancing. every round pairs up num_pairs disjoint nodes and each pair only evens out its own loads:
+ * the heavier node walks its shards with the shard iterator and gives the ones fitting in half of the gap to the lighter.
+ * a pair costs O(shards of the two nodes) and the pairs are planned on up to num_planner_threads threads.
+ * with weighted_choice(power of two choices) the heavier of two random nodes is paired with the lighter of two others,
+ * otherwise the pairs are uniformly random.
+ */
+class Pairwise_Load_Balancer : public Load_Balancer {
+public:
+    Pairwise_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+        , size_t _rebalance_period_seconds, size_t _load_imbalance_threshold, size_t low_load_threshold
+        , size_t num_pairs, bool weighted_choice, size_t num_planner_threads, uint64_t seed);
+
+    ~Pairwise_Load_Balancer();
+    void balance_round();
+    void set_up_new_plan();
+
+private:
+    size_t num_pairs;
+    bool weighted_choice;
+    size_t num_planner_threads;
+    Random64 rng;
+    std::vector<size_t> pool; // nodes not paired yet in the round
+    std::vector<std::pair<size_t, size_t>> pairs; // (heavier, lighter)
+    std::vector<std::vector<Owner_Ship_Transfer>> pair_transfers; // shard is the index in the shards of from
+
+    // removes the heaviest(or lightest) of num_choices random nodes of the pool and returns it
+    size_t draw(Load_Info_Container& container, size_t num_choices, bool heavier);
+    void choose_pairs(Load_Info_Container& container);
+    void balance_pair(Load_Info_Container& container, size_t pair);
+};
+
 }
 
 struct load_batch {
@@ -223,11 +585,7 @@ public:
         , size_t lr_time, size_t rr_time, size_t lw_time, size_t fl_time
         , size_t minimum_shard_size) 
         : lb(_lb), local_read_time(lr_time), remote_read_time(rr_time), local_write_time(lw_time), flush_time(fl_time)
-            , last(lb.num_shards()-1), min_shard_size(minimum_shard_size)
-            #ifdef DEBUG
-            , lower_bound(lbound), upper_bound(ubound)
-            #endif
-             {
+            , last(lb.num_shards()-1), min_shard_size(minimum_shard_size), lower_bound(lbound), upper_bound(ubound) {
         assert(lbound < ubound);
         size_t remainder = (ubound - lbound) % lb.num_shards(); // 3936
         size_t shard_size = (ubound - lbound) / lb.num_shards() + (remainder != 0); // 11 + 1 = 12
@@ -248,18 +606,20 @@ public:
 
         assert(lbound == ubound && hload == ubound + shard_size);
 
-        #ifdef DEBUG
-        for (size_t i = 0; i < loads.size(); i = loads[i].next) {
-            assert(i == last || loads[i].ub == loads[loads[i].next].lb);
-            assert(ub_to_index[loads[i].ub] == i);
-            LOGF(stdout, "shard %lu: %lu ~ %lu :: %lu\n", i, loads[i].lb, loads[i].ub, loads[i].ub - loads[i].lb);
+        if (TimberSaw::observing(TimberSaw::OBSERVE_CHECKS)) {
+            for (size_t i = 0; i < loads.size(); i = loads[i].next) {
+                assert(i == last || loads[i].ub == loads[loads[i].next].lb);
+                assert(ub_to_index[loads[i].ub] == i);
+                LOGF(stdout, "shard %lu: %lu ~ %lu :: %lu\n", i, loads[i].lb, loads[i].ub, loads[i].ub - loads[i].lb);
+            }
+            assert(loads[0].lb == lower_bound && loads[last].ub == upper_bound);
         }
-        assert(loads[0].lb == lower_bound && loads[last].ub == upper_bound);
-        #endif
     }
 
-    void increment_load(size_t key, size_t lr, size_t rr, size_t lw, size_t fl) {
-        std::shared_lock<std::shared_mutex> lock(mtx);
+    // returns the shard holding the key at the time of the increment. the owner of the shard is only safe to read
+    // by the load balancer thread, other threads should look it up in the routing table
+    size_t increment_load(size_t key, size_t lr, size_t rr, size_t lw, size_t fl) {
+        TimberSaw::Site_Shared_Lock<TimberSaw::Site_Shared_Mutex> lock(mtx, TimberSaw::LOCK_INCREMENT);
         auto itr = ub_to_index.upper_bound(key);
         assert(itr != ub_to_index.end());
 
@@ -267,38 +627,129 @@ public:
         loads[itr->second].num_r_reads->fetch_add(rr);
         loads[itr->second].num_writes->fetch_add(lw);
         loads[itr->second].num_flushes->fetch_add(fl);
+        return itr->second;
+    }
+
+    // adds the ranges in key order with their current owners. should only be called by the load balancer thread
+    void fill_routes(TimberSaw::Routing_Snapshot& snapshot) {
+        for (size_t i = 0;; i = loads[i].next) {
+            snapshot.add_range(loads[i].ub, i, lb.shard_owner(i));
+            if (i == last) {
+                break;
+            }
+        }
+    }
+
+    inline size_t key_lb() const {
+        return lower_bound;
+    }
+
+    inline size_t key_ub() const {
+        return upper_bound;
+    }
+
+    inline size_t minimum_shard_size() const {
+        return min_shard_size;
+    }
+
+    // fills the key ranges of the records by shard id. should only be called by the load balancer thread.
+    // the lock is shared, so increments and flushes go on meanwhile
+    void checkpoint_ranges(std::vector<TimberSaw::Checkpoint_Shard>& records) {
+        TimberSaw::Site_Shared_Lock<TimberSaw::Site_Shared_Mutex> lock(mtx, TimberSaw::LOCK_CHECKPOINT);
+        assert(records.size() == loads.size());
+        for (size_t i = 0; i < loads.size(); ++i) {
+            records[i].lb = loads[i].lb;
+            records[i].ub = loads[i].ub;
+        }
+    }
+
+    // throws std::runtime_error if the ranges of the num records do not cover the keys in order. leaves the ranges as is
+    void check_restore(const TimberSaw::Checkpoint_Shard* records, size_t num) const {
+        size_t key = lower_bound, count = 0;
+        for (size_t i = 0; i < num && count < num; i = records[i].next, ++count) {
+            if (records[i].lb != key || records[i].ub <= records[i].lb || records[i].ub - records[i].lb < min_shard_size) {
+                throw std::runtime_error("the key ranges of the checkpoint do not cover the keys of the load vector");
+            }
+            key = records[i].ub;
+        }
+        if (count != num || key != upper_bound) {
+            throw std::runtime_error("the key ranges of the checkpoint do not cover the keys of the load vector");
+        }
+    }
+
+    // replaces the ranges with the num ones of a checkpoint whose shards are already restored by the load balancer.
+    // throws std::runtime_error before changing anything if they do not cover the keys in order. should be called
+    // before the first increment
+    void restore(const TimberSaw::Checkpoint_Shard* records, size_t num) {
+        assert(num == lb.num_shards() && num >= loads.size());
+        check_restore(records, num);
+
+        mtx.lock(TimberSaw::LOCK_CHECKPOINT);
+        // the batches of the first shards are reused, so only the shards added by divides allocate counters
+        for (size_t i = 0; i < loads.size(); ++i) {
+            loads[i].lb = records[i].lb;
+            loads[i].ub = records[i].ub;
+            loads[i].next = records[i].next;
+        }
+        loads.reserve(num);
+        for (size_t i = loads.size(); i < num; ++i) {
+            loads.emplace_back(records[i].lb, records[i].ub, records[i].next);
+        }
+        ub_to_index.clear();
+        for (size_t i = 0; i < num; i = loads[i].next) { // key order, so every insertion is at the end
+            ub_to_index.emplace_hint(ub_to_index.end(), loads[i].ub, i);
+            last = i;
+        }
+        mtx.unlock();
+    }
+
+    // should only be called by the load balancer thread as it is the only one changing the ranges
+    inline size_t shard_num_keys(size_t id) const {
+        assert(id < loads.size());
+        return loads[id].ub - loads[id].lb;
+    }
+
+    // should only be called by the load balancer thread as it is the only one changing the ranges
+    inline size_t shard_upper_bound(size_t id) const {
+        assert(id < loads.size());
+        return loads[id].ub;
+    }
+
+    inline size_t service_time(size_t lr, size_t rr, size_t lw, size_t fl) const {
+        return lr * local_read_time + rr * remote_read_time + lw * local_write_time + fl * flush_time;
     }
 
     void flush() {
-        std::shared_lock<std::shared_mutex> lock(mtx);
+        TimberSaw::Site_Shared_Lock<TimberSaw::Site_Shared_Mutex> lock(mtx, TimberSaw::LOCK_FLUSH);
         flush_wo_lock();
     }
 
     void flush(size_t id) {
-        std::shared_lock<std::shared_mutex> lock(mtx);
+        TimberSaw::Site_Shared_Lock<TimberSaw::Site_Shared_Mutex> lock(mtx, TimberSaw::LOCK_FLUSH);
         flush_wo_lock(id);
     }
 
-    // must be followed by a finish_signal
-    size_t divide_signal(size_t id, size_t num) {
+    // the most shards id can be divided into. should only be called by the load balancer thread
+    inline size_t max_divide(size_t id) const {
+        assert(id < loads.size());
+        assert(loads[id].ub - loads[id].lb >= min_shard_size);
+        return (loads[id].ub - loads[id].lb) / min_shard_size;
+    }
+
+    // splits the keys of id to id and the num - 1 shards appended last to the load balancer.
+    // the load balancer should append the shards before, so the lock only covers the key ranges.
+    // num should be at most max_divide(id). must be followed by a finish_signal
+    void divide_signal(size_t id, size_t num) {
         assert(num > 1);
         assert(id < loads.size());
+        assert(num <= max_divide(id));
+        assert(loads.size() + num - 1 <= lb.num_shards());
 
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_DIVIDE);
         flush_wo_lock(id);
-        
 
         size_t lbound = loads[id].lb;
         size_t ubound = loads[id].ub;
-        assert(ubound - lbound >= min_shard_size);
-        size_t max_divide = (ubound - lbound) / min_shard_size;
-
-        if (max_divide == 1) {
-            return 1;
-        }
-        else if (max_divide < num) {
-            num = max_divide;
-        }
 
         #ifdef PRINT_COLORED
         LOGFC(COLOR_RED,stdout, "divide signal: node %lu to %lu shards\n", id, num);
@@ -341,36 +792,34 @@ public:
             last = n + num - 1;
         }
 
-        #ifdef DEBUG
-        for (size_t i = 0; i < loads.size(); i = loads[i].next) {
-            assert(i == last || loads[i].ub == loads[loads[i].next].lb);
-            assert(ub_to_index[loads[i].ub] == i);
-            assert(loads[i].ub - loads[i].lb >= min_shard_size);
-            LOGF(stdout, "shard %lu: %lu ~ %lu :: %lu\n", i, loads[i].lb, loads[i].ub, loads[i].ub - loads[i].lb);
+        if (TimberSaw::observing(TimberSaw::OBSERVE_CHECKS)) {
+            for (size_t i = 0; i < loads.size(); i = loads[i].next) {
+                assert(i == last || loads[i].ub == loads[loads[i].next].lb);
+                assert(ub_to_index[loads[i].ub] == i);
+                assert(loads[i].ub - loads[i].lb >= min_shard_size);
+                LOGF(stdout, "shard %lu: %lu ~ %lu :: %lu\n", i, loads[i].lb, loads[i].ub, loads[i].ub - loads[i].lb);
+            }
+            assert(loads[0].lb == lower_bound && loads[last].ub == upper_bound);
         }
-        assert(loads[0].lb == lower_bound && loads[last].ub == upper_bound);
-        #endif
-
-        return num;
     }
 
     // must be followed by a finish_signal
     template<std::convertible_to<std::pair<size_t, size_t>>... Args>
     void merge_range_signal(const std::pair<size_t, size_t>& ids, const Args&... id_pairs) {
 
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_MERGE);
         merge_range_wo_lock(id_pairs...);
     }
 
     // must be followed by a finish_signal
     void merge_range_signal(const std::pair<size_t, size_t>& id_pair) {
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_MERGE);
         merge_range_wo_lock(id_pair.first, id_pair.second);
     }
 
     // must be followed by a finish_signal
     void merge_range_signal(size_t from, size_t to) { // to is included
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_MERGE);
         merge_range_wo_lock(from, to);
     }
 
@@ -378,40 +827,75 @@ public:
     template<std::convertible_to<std::pair<size_t, size_t>>... Args>
     void merge_pair_signal(const std::pair<size_t, size_t>& ids, const Args&... id_pairs) {
 
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_MERGE);
         merge_pair_wo_lock(ids.first, ids.second);
         merge_pair_wo_lock(id_pairs...);
     }
 
     // must be followed by a finish_signal
     void merge_pair_signal(const std::pair<size_t, size_t>& id_pair) {
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_MERGE);
         merge_pair_wo_lock(id_pair.first, id_pair.second);
     }
 
     // must be followed by a finish_signal
     void merge_pair_signal(size_t first, size_t second) {
-        mtx.lock();
+        mtx.lock(TimberSaw::LOCK_MERGE);
         merge_pair_wo_lock(first, second);
     }
 
-    // must only be used after a merge or divide signal
+    // moves shard i to old_to_new[i], where old_to_new is the key order of the shards.
+    // the load balancer should renumber its shards before the finish_signal. must be followed by a finish_signal
+    void renumber_signal(const std::vector<uint32_t>& old_to_new) {
+        assert(old_to_new.size() == loads.size());
+        mtx.lock(TimberSaw::LOCK_RENUMBER);
+
+        std::vector<load_batch> renumbered;
+        renumbered.reserve(loads.size());
+        std::vector<uint32_t> new_to_old(loads.size());
+        for (size_t i = 0; i < loads.size(); ++i) {
+            new_to_old[old_to_new[i]] = i;
+        }
+        for (size_t i = 0; i < loads.size(); ++i) {
+            renumbered.push_back(std::move(loads[new_to_old[i]]));
+            renumbered.back().next = i + 1;
+        }
+        loads.swap(renumbered);
+        for (auto& ub_index : ub_to_index) {
+            ub_index.second = old_to_new[ub_index.second];
+        }
+        last = loads.size() - 1;
+
+        if (TimberSaw::observing(TimberSaw::OBSERVE_CHECKS)) {
+            for (size_t i = 0; i < loads.size(); ++i) {
+                assert(i == last || loads[i].ub == loads[i + 1].lb);
+                assert(ub_to_index[loads[i].ub] == i);
+            }
+            assert(loads[0].lb == lower_bound && loads[last].ub == upper_bound);
+        }
+    }
+
+    // must only be used after a merge, divide or renumber signal
     void finish_signal() {
         mtx.unlock();
     }
 
+    #ifdef PROFILE_LOCKS
+    void report_locks(char* buffer) {
+        mtx.report(buffer);
+    }
+    #endif
+
 
 private:
     std::map<size_t, size_t> ub_to_index;
     std::vector<load_batch> loads;
-    std::shared_mutex mtx;
+    TimberSaw::Site_Shared_Mutex mtx;
     TimberSaw::Load_Balancer& lb;
     size_t local_read_time, remote_read_time, local_write_time, flush_time;
     size_t last;
     size_t min_shard_size;
-    #ifdef DEBUG
-    size_t lower_bound, upper_bound;
-    #endif
+    size_t lower_bound, upper_bound; // of the keys, for the checks
 
     void flush_wo_lock() {
         for (size_t i = 0; i < loads.size(); ++i) {
@@ -421,11 +905,12 @@ private:
                                 + *(loads[i].num_flushes) * flush_time;
 
             if (added_load > 0) {
+                size_t remote_reads = *(loads[i].num_r_reads);
                 *(loads[i].num_reads) = 0;
                 *(loads[i].num_r_reads) = 0;
                 *(loads[i].num_writes)= 0;
                 *(loads[i].num_flushes) = 0;
-                lb.increment_load_info(i, added_load);
+                lb.increment_load_info(i, added_load, remote_reads);
             }
         }
     }
@@ -440,11 +925,12 @@ private:
                             + *(load.num_flushes) * flush_time;
 
         if (added_load > 0) {
+            size_t remote_reads = *(load.num_r_reads);
             *(load.num_reads)= 0;
             *(load.num_r_reads) = 0;
             *(load.num_writes) = 0;
             *(load.num_flushes) = 0;
-            lb.increment_load_info(id, added_load);
+            lb.increment_load_info(id, added_load, remote_reads);
         }
     }
 
@@ -458,11 +944,12 @@ private:
                                 + *(loads[i].num_flushes) * flush_time;
 
             if (added_load > 0) {
+                size_t remote_reads = *(loads[i].num_r_reads);
                 *(loads[i].num_reads) = 0;
                 *(loads[i].num_r_reads) = 0;
                 *(loads[i].num_writes)= 0;
                 *(loads[i].num_flushes) = 0;
-                lb.increment_load_info(i, added_load);
+                lb.increment_load_info(i, added_load, remote_reads);
             }
         }
     }
@@ -16,7 +16,11 @@
 #include <assert.h>
 #include <cstring>
 
+#include "checkpoint.h"
 #include "config.h"
+#include "observability.h"
+#include "plan_sink.h"
+#include "stable_vector.h"
 
 #include "testlog.h"
 
@@ -24,51 +28,75 @@
 
 namespace TimberSaw {
 
-struct Load_Info {
-    std::unique_ptr<std::atomic<size_t>> current_load; // accessed by other threads incrementing load
-    size_t last_load; // accessed only by lb thread so no concurrent access
-    #ifdef ANALYZE
-    std::unique_ptr<std::atomic<size_t>> round_load;
-    #endif
-    
-    Load_Info() : last_load(0), current_load(new std::atomic<size_t>(0))
-    #ifdef ANALYZE
-    , round_load(new std::atomic<size_t>(0)) 
-    #endif
-    {}
-
-    // Move constructor
-    Load_Info(Load_Info&& other) noexcept
-        : current_load(std::move(other.current_load)), last_load(other.last_load)
-        #ifdef ANALYZE
-        , round_load(std::move(other.round_load))
-        #endif
-         {}
-
-    // Move assignment operator
-    Load_Info& operator=(Load_Info&& other) noexcept {
-        if (this != &other) {
-            current_load = std::move(other.current_load);
-            #ifdef ANALYZE
-            round_load = std::move(other.round_load);
-            #endif
-            last_load = other.last_load;
+// counters of a shard incremented by other threads. they are pooled in a Shard_Counter_Arena and never move
+struct Shard_Counters {
+    std::atomic<size_t> current_load{0};
+    std::atomic<size_t> current_remote_reads{0}; // remote reads served by the memory node of the shard
+    std::atomic<size_t> round_load{0}; // only incremented when observing OBSERVE_ROUND_LOAD
+
+    // the variants of an increment. the container picks one once, so an unobserved round load costs nothing
+    template<bool count_round_load>
+    static void increment(Shard_Counters& counters, size_t added_load, size_t remote_reads) {
+        counters.current_load.fetch_add(added_load);
+        if (remote_reads > 0) {
+            counters.current_remote_reads.fetch_add(remote_reads);
         }
-        return *this;
+        if constexpr (count_round_load) {
+            counters.round_load.fetch_add(added_load);
+        }
+    }
+};
+
+// hands out counters from fixed size chunks, so growing never moves the counters handed out before
+class Shard_Counter_Arena {
+public:
+    inline static constexpr size_t chunk_size = 4096;
+
+    Shard_Counters* allocate() {
+        if (used == chunk_size) {
+            chunks.emplace_back(new Shard_Counters[chunk_size]);
+            used = 0;
+        }
+        return &chunks.back()[used++];
+    }
+
+    inline size_t bytes() const {
+        return chunks.size() * chunk_size * sizeof(Shard_Counters);
     }
 
+private:
+    std::vector<std::unique_ptr<Shard_Counters[]>> chunks;
+    size_t used = chunk_size;
+};
 
-    void compute_load_and_pass() { //TODO memory order && do I need to make last_load atomic? -> it is accessed as write only in lb -> one writer + one reader
-        last_load = (*current_load).exchange(0) + last_load / 2;
+struct Load_Info {
+    Shard_Counters* counters = nullptr; // owned by the arena of the container
+    size_t last_load = 0; // accessed only by lb thread so no concurrent access
+    size_t last_remote_reads = 0; // decays like last_load
+
+    // the loads of a round are multiplied by scale / unit_scale. rounds of different periods scale them to
+    // the same period, so a short round is not outweighed by the decayed load of a long one
+    inline static constexpr size_t unit_scale_shift = 16;
+    inline static constexpr size_t unit_scale = size_t(1) << unit_scale_shift;
+
+    void compute_load_and_pass(size_t scale) { //TODO memory order && do I need to make last_load atomic? -> it is accessed as write only in lb -> one writer + one reader
+        size_t load = counters->current_load.exchange(0);
+        size_t remote_reads = counters->current_remote_reads.exchange(0);
+        if (scale != unit_scale) {
+            load = (load * scale) >> unit_scale_shift;
+            remote_reads = (remote_reads * scale) >> unit_scale_shift;
+        }
+        last_load = load + last_load / 2;
+        last_remote_reads = remote_reads + last_remote_reads / 2;
     }
 
     void print(char* buffer) const {
         // sprintf(buffer + strlen(buffer), "last_load: %lu, num_reads: %lu, num_writes: %lu, num_remote_reads: %lu, num_flushes: %lu\n"
         //     , last_load, num_reads.load(), num_writes.load(), num_remote_reads.load(), num_flushes.load());
-        sprintf(buffer + strlen(buffer), "last_load = %lu, current_load = %lu", last_load, (*current_load).load());
-        #ifdef ANALYZE
-        sprintf(buffer + strlen(buffer), ", round_load = %lu", (*round_load).load());
-        #endif
+        sprintf(buffer + strlen(buffer), "last_load = %lu, current_load = %lu", last_load, counters->current_load.load());
+        if (observing(OBSERVE_ROUND_LOAD)) {
+            sprintf(buffer + strlen(buffer), ", round_load = %lu", counters->round_load.load());
+        }
         sprintf(buffer + strlen(buffer), "\n");
     }
 
@@ -76,26 +104,10 @@ struct Load_Info {
 
 class Shard_Info {
 public:
-    Shard_Info() = default;
-
-    // Move constructor
-    Shard_Info(Shard_Info&& other) noexcept
-        : _owner(other._owner), _id(other._id), _next_shard_id(other._next_shard_id), _prev_shard_id(other._prev_shard_id)
-        , _load(std::move(other._load)) {
-        
-    }
+    // the largest number of shards. ids, owners and memory nodes are stored in 32 bits
+    inline static constexpr size_t max_shards = UINT32_MAX;
 
-    // Move assignment operator
-    Shard_Info& operator=(Shard_Info&& other) noexcept {
-        if (this != &other) {
-            _owner = other._owner;
-            _id = other._id;
-            _next_shard_id = other._next_shard_id;
-            _prev_shard_id = other._prev_shard_id;
-            _load = std::move(other._load);
-        }
-        return *this;
-    }
+    Shard_Info() = default;
 
     inline size_t load() const {
         return _load.last_load;
@@ -105,6 +117,22 @@ public:
         return _owner;
     }
 
+    // memory node storing the data of the shard
+    inline size_t memory() const {
+        return _memory;
+    }
+
+    inline size_t remote_reads() const {
+        return _load.last_remote_reads;
+    }
+
+    inline size_t round_load() const {
+        if (observing(OBSERVE_ROUND_LOAD)) {
+            return _load.counters->round_load.load();
+        }
+        return _load.counters->current_load.load();
+    }
+
     inline size_t id() const {
         return _id;
     }
@@ -121,17 +149,36 @@ public:
         _owner = new_owner;
     }
 
+    // a move back to the node the shard left at most this many rounds ago is a ping-pong
+    inline static constexpr size_t ping_pong_rounds = 8;
+
+    // records a transfer of round from node from to node to. returns true if it is a ping-pong
+    inline bool record_move(size_t from, size_t to, size_t round) {
+        bool ping_pong = _num_moves > 0 && to == _prev_owner && round - _last_move_round <= ping_pong_rounds;
+        _prev_owner = from;
+        _last_move_round = round;
+        ++_num_moves;
+        return ping_pong;
+    }
+
+    // true if the shard was moved in the rounds round - rounds + 1 to round
+    inline bool moved_within(size_t round, size_t rounds) const {
+        return _num_moves > 0 && round - _last_move_round < rounds;
+    }
+
+    inline size_t num_moves() const {
+        return _num_moves;
+    }
+
     inline void print(char* buffer) const {
-        sprintf(buffer + strlen(buffer), "shard %lu: owner=%lu, prev=%lu, next= %lu, load: "
-            , _id, _owner, _prev_shard_id, _next_shard_id);
+        sprintf(buffer + strlen(buffer), "shard %u: owner=%u, memory=%u, prev=%u, next= %u, moves=%u, load: "
+            , _id, _owner, _memory, _prev_shard_id, _next_shard_id, _num_moves);
         _load.print(buffer);
     }
 
-    #ifdef ANALYZE
     inline void new_round() {
-        _load.round_load->store(0);
+        _load.counters->round_load.store(0);
     }
-    #endif
 
     // #ifdef DEBUG
     // ~Shard_Info() {
@@ -145,10 +192,15 @@ public:
     friend class Compute_Node_Info;
     
 private:
-    size_t _owner;
-    size_t _id;
-    size_t _next_shard_id, _prev_shard_id;
     Load_Info _load;
+    uint32_t _owner;
+    uint32_t _id;
+    uint32_t _next_shard_id, _prev_shard_id;
+    uint32_t _memory = 0;
+    // migration history, kept by the load balancer and cleared by a restore. pieces of a divide start without one
+    uint32_t _num_moves = 0;
+    uint32_t _last_move_round = 0;
+    uint32_t _prev_owner = 0; // owner before the last move
 };
 
 class Compute_Node_Info;
@@ -213,62 +265,83 @@ public:
     }   
 
     inline Shard_Info& operator[](size_t shard_idx) { // should not be used by restricted
+        assert(!by_range);
         return (*all_shards)[_shards[shard_idx]];
     }
 
     inline Shard_Iterator& ordered_iterator() {
+        assert(!by_range);
         sort_shards_if_needed();
         return itr;
     }
 
+    // calls func with the id of every shard of the node, in key order if the node owns a key range
+    template<typename Func>
+    inline void for_each_shard(Func func) const {
+        if (by_range) {
+            for (size_t i = 0, shard = first_id; i < _num_shards; ++i, shard = (*all_shards)[shard].next_id()) {
+                assert((*all_shards)[shard].owner() == _id);
+                func(shard);
+            }
+        }
+        else {
+            assert(_num_shards == _shards.size());
+            for (auto shard : _shards) {
+                func(shard);
+            }
+        }
+    }
+
     inline void print(char* buffer, size_t num_shards_to_print_per_compute_node) const {
-        assert(_num_shards == _shards.size());
         size_t current_load = 0;
-        #ifdef ANALYZE
         size_t round_load = 0;
-        #endif
-        for (auto i : _shards) {
-            current_load += (*all_shards)[i]._load.current_load->load();
-            #ifdef ANALYZE
-            round_load += (*all_shards)[i]._load.round_load->load();
-            #endif
-        }
+        for_each_shard([&](size_t i) {
+            current_load += (*all_shards)[i]._load.counters->current_load.load();
+            round_load += (*all_shards)[i]._load.counters->round_load.load();
+        });
 
         #ifdef PRINT_COLORED
         sprintf(buffer + strlen(buffer), COLOR_PURPLE "cnode with id %lu has last load of %lu, current load of %lu", _id, _overal_load, current_load);
         #else
         sprintf(buffer + strlen(buffer), "cnode with id %lu has last load of %lu, current load of %lu", _id, _overal_load, current_load);
         #endif
-        #ifdef ANALYZE
-        sprintf(buffer + strlen(buffer), ", round load of %lu", round_load);
-        #endif
+        if (observing(OBSERVE_ROUND_LOAD)) {
+            sprintf(buffer + strlen(buffer), ", round load of %lu", round_load);
+        }
         #ifdef PRINT_COLORED
         sprintf(buffer + strlen(buffer), " and %lu shards" COLOR_RESET "\n", _num_shards);
         #else
         sprintf(buffer + strlen(buffer), " and %lu shards\n", _num_shards);
         #endif
-        #ifdef PRINT_SHARD_PER_NODE
-        sprintf(buffer + strlen(buffer), ":\n\n");
-
-        for (size_t i = 0; i < _num_shards && (num_shards_to_print_per_compute_node == 0 || i < num_shards_to_print_per_compute_node); ++i) {
-            assert((*all_shards)[_shards[i]].owner() == _id);
-            #if defined(DEBUG) && defined(ANALYZE)
-            sprintf(buffer + strlen(buffer), "%lu(cload: %lu, rload:%lu, lload:%lu, prev:%lu, next:%lu), "
-                , (*all_shards)[_shards[i]].id(), (*all_shards)[_shards[i]]._load.current_load->load(), (*all_shards)[_shards[i]]._load.round_load->load(), (*all_shards)[_shards[i]].load(), (*all_shards)[_shards[i]].prev_id(), (*all_shards)[_shards[i]].next_id());
-            #elif defined(DEBUG)
-            sprintf(buffer + strlen(buffer), "%lu(cload: %lu, lload:%lu, prev:%lu, next:%lu), "
-                , (*all_shards)[_shards[i]].id(), (*all_shards)[_shards[i]]._load.current_load->load(), (*all_shards)[_shards[i]].load(), (*all_shards)[_shards[i]].prev_id(), (*all_shards)[_shards[i]].next_id());
-            #elif defined(ANALYZE)
-            sprintf(buffer + strlen(buffer), "%lu(rload: %lu), "
-                , (*all_shards)[_shards[i]].id(), (*all_shards)[_shards[i]]._load.round_load->load());
-            #else
-            sprintf(buffer + strlen(buffer), "%lu, "
-                , (*all_shards)[_shards[i]].id());
-            #endif
+        if (observing(OBSERVE_SHARDS_PER_NODE)) {
+            sprintf(buffer + strlen(buffer), ":\n\n");
+
+            size_t num_printed = 0;
+            for_each_shard([&](size_t i) {
+                if (num_shards_to_print_per_compute_node != 0 && num_printed++ >= num_shards_to_print_per_compute_node) {
+                    return;
+                }
+                assert((*all_shards)[i].owner() == _id);
+                if (observing(OBSERVE_CHECKS) && observing(OBSERVE_ROUND_LOAD)) {
+                    sprintf(buffer + strlen(buffer), "%lu(cload: %lu, rload:%lu, lload:%lu, prev:%lu, next:%lu), "
+                        , (*all_shards)[i].id(), (*all_shards)[i]._load.counters->current_load.load(), (*all_shards)[i]._load.counters->round_load.load(), (*all_shards)[i].load(), (*all_shards)[i].prev_id(), (*all_shards)[i].next_id());
+                }
+                else if (observing(OBSERVE_CHECKS)) {
+                    sprintf(buffer + strlen(buffer), "%lu(cload: %lu, lload:%lu, prev:%lu, next:%lu), "
+                        , (*all_shards)[i].id(), (*all_shards)[i]._load.counters->current_load.load(), (*all_shards)[i].load(), (*all_shards)[i].prev_id(), (*all_shards)[i].next_id());
+                }
+                else if (observing(OBSERVE_ROUND_LOAD)) {
+                    sprintf(buffer + strlen(buffer), "%lu(rload: %lu), "
+                        , (*all_shards)[i].id(), (*all_shards)[i]._load.counters->round_load.load());
+                }
+                else {
+                    sprintf(buffer + strlen(buffer), "%lu, "
+                        , (*all_shards)[i].id());
+                }
+            });
+
+            sprintf(buffer + strlen(buffer), "\n");
         }
-
-        sprintf(buffer + strlen(buffer), "\n");
-        #endif
         sprintf(buffer + strlen(buffer), "\n");
         
     }
@@ -280,49 +353,45 @@ public:
 private:
     class Shard_Info_Pointer_Cmp {
     public:
-        inline bool operator()(const size_t& a, const size_t& b) const {
+        inline bool operator()(uint32_t a, uint32_t b) const {
             assert(all_shards != nullptr && a < all_shards->size() && b < all_shards->size());
             return (*all_shards)[a].load() < (*all_shards)[b].load();
         }
 
-        std::vector<Shard_Info>* all_shards;
+        Stable_Vector<Shard_Info>* all_shards;
     };
 
     void sort_shards_if_needed();
 
-    inline void compute_load_and_pass() {
+    inline void compute_load_and_pass(size_t scale) {
         _overal_load = 0;
         is_sorted = false;
         itr.reset();
-        assert(_shards.size() == _num_shards);
-        for (auto i : _shards) {
-            (*all_shards)[i]._load.compute_load_and_pass();
+        for_each_shard([&](size_t i) {
+            (*all_shards)[i]._load.compute_load_and_pass(scale);
             _overal_load += (*all_shards)[i].load();
-        }
+        });
     }
 
 private:
     size_t _overal_load;
     size_t _id;
-    std::vector<size_t> _shards; 
-    std::vector<Shard_Info>* all_shards;
+    std::vector<uint32_t> _shards; 
+    Stable_Vector<Shard_Info>* all_shards;
     Shard_Iterator itr;
     bool is_sorted = false;
     size_t first_id, last_id;
     size_t _num_shards;
-};
-
-struct Owner_Ship_Transfer {
-    size_t from;
-    size_t to;
-    size_t shard;
+    bool by_range = false; // the node owns the key range first_id..last_id and _shards is not kept(restricted)
 };
 
 class Load_Info_Container_Base {
 public:
     Load_Info_Container_Base(size_t num_compute, size_t num_shards_per_compute, size_t low_load_threshold)
         : cnodes(num_compute), shards(num_compute * num_shards_per_compute), low_load_thresh(low_load_threshold)
-          , last_shard_id((num_compute * num_shards_per_compute) - 1) {
+          , last_shard_id((num_compute * num_shards_per_compute) - 1)
+          , increment_counters(observing(OBSERVE_ROUND_LOAD) ? &Shard_Counters::increment<true> : &Shard_Counters::increment<false>) {
+        assert(shards.size() < Shard_Info::max_shards);
 
         size_t shard_id = 0;
         for (size_t i = 0; i < num_compute; ++i) {
@@ -334,6 +403,7 @@ public:
             for (size_t j = 0; j < num_shards_per_compute; ++j, ++shard_id) {
                 shards[shard_id]._id = shard_id;
                 shards[shard_id]._owner = i;
+                shards[shard_id]._load.counters = counter_arena.allocate();
                 shards[shard_id]._next_shard_id = shard_id + 1;
                 shards[shard_id]._prev_shard_id = shard_id - 1;
                 cnodes[i]._shards[j] = shard_id;
@@ -345,16 +415,33 @@ public:
 
     }
 
-    ~Load_Info_Container_Base() {}
+    virtual ~Load_Info_Container_Base() {}
 
     // void rewrite_load_info(size_t shard, size_t num_reads, size_t num_writes, size_t num_remote_reads, size_t num_flushes);
     // void increment_load_info(size_t shard, size_t num_reads, size_t num_writes, size_t num_remote_reads, size_t num_flushes);
-    void increment_load_info(size_t shard, size_t added_load);
+    void increment_load_info(size_t shard, size_t added_load, size_t remote_reads);
     void compute_load_and_pass(size_t& min_load, size_t& max_load, size_t& mean_load, size_t& sum_load);
+
+    // scale of the loads of the next compute_load_and_pass, see Load_Info
+    inline void set_load_scale(size_t scale) {
+        load_scale = scale;
+    }
     void update_max_load();
     void change_owner_from_max_to_min(size_t shard_idx);
+    // like change_owner_from_max_to_min, but to node to, which should still be ordered(see is_ordered)
+    void change_owner_from_max(size_t shard_idx, size_t to);
+
+    // if node was not ignored yet by the round as the max or min node
+    inline bool is_ordered(size_t node) {
+        return ordered_position(node) != ordered_nodes.end();
+    }
 
-    virtual std::vector<Owner_Ship_Transfer> apply() = 0;
+    // number of maximal runs of key adjacent shards with the same owner, of every node in runs and in total.
+    // a node owning a single key range has one
+    size_t count_runs(std::vector<size_t>& runs) const;
+
+    // applies the plan of the round and streams its transfers to sink
+    virtual void apply(Plan_Sink& sink) = 0;
     virtual void divide_shard(size_t owner, size_t index, size_t num) = 0;
 
     inline bool is_insignificant(Shard_Info& shard) {
@@ -405,42 +492,128 @@ public:
         return max_load_change;
     }
 
-    #ifdef ANALYZE
+    // bytes of the shard metadata(shards, their counters and the shard lists of the nodes) including unused capacity
+    size_t metadata_bytes() const {
+        size_t bytes = (shards.capacity() + renumber_buffer.capacity()) * sizeof(Shard_Info) + counter_arena.bytes();
+        for (const Compute_Node_Info& cnode : cnodes) {
+            bytes += cnode._shards.capacity() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    // places the shards on num_memory memory nodes as contiguous key ranges of about the same number of shards
+    void set_memory_nodes(size_t num_memory);
+
+    // sets old_to_new to the position of every shard in key order. returns false if the ids are already in key order
+    bool key_order(std::vector<uint32_t>& old_to_new);
+    // moves every shard i to old_to_new[i] and relinks them, so walking the keys is a linear scan.
+    // flushes should be blocked meanwhile as the counters move with the shards
+    void renumber(const std::vector<uint32_t>& old_to_new);
+
+    // decayed remote reads of the shards on each memory node
+    void memory_traffic(std::vector<size_t>& traffic);
+
+    // fills the owners, memory nodes, key order and decayed loads of the shards. the key ranges are left to the load vector
+    void checkpoint(std::vector<Checkpoint_Shard>& records);
+    // throws std::runtime_error if the num records of a checkpoint of num_memory memory nodes are not a valid layout for
+    // the nodes. leaves the container as is
+    void check_restore(const Checkpoint_Shard* records, size_t num, size_t num_memory) const;
+    // replaces the shards with the num ones of a checkpoint of num_memory memory nodes, with their counters cleared, and
+    // rebuilds the nodes. num should be at least num_shards(). checks the whole layout first, so a rejected checkpoint
+    // leaves the container as is. should be called before the first increment
+    void restore(const Checkpoint_Shard* records, size_t num, size_t num_memory);
+
+    inline void set_memory(size_t shard, size_t memory) {
+        assert(shard < shards.size());
+        shards[shard]._memory = memory;
+    }
+
+    void emit_updates(Plan_Sink& sink) {
+        sink.begin_plan(updates.size());
+        for (const Owner_Ship_Transfer& update : updates) {
+            sink.transfer(update);
+        }
+        sink.end_plan();
+    }
+
     void new_round() {
-        for (Shard_Info& shard : shards) {
-            shard.new_round();
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            shards[shard].new_round();
         }
     }
-    #endif
 
 protected:
     std::vector<Compute_Node_Info> cnodes;
-    std::vector<Shard_Info> shards;
-    std::vector<Owner_Ship_Transfer> updates;
+    // divides only append, so flushes can keep updating the shards while a divide is in progress
+    Stable_Vector<Shard_Info> shards;
+    Shard_Counter_Arena counter_arena;
+    std::vector<Shard_Info> renumber_buffer;
+    std::vector<Owner_Ship_Transfer> updates; // reused by every round
     std::multimap<size_t, size_t> ordered_nodes;
     size_t max_load_change = 0;
+
+    // entry of node in ordered_nodes or its end
+    inline std::multimap<size_t, size_t>::iterator ordered_position(size_t node) {
+        auto range = ordered_nodes.equal_range(cnodes[node]._overal_load);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == node) {
+                return it;
+            }
+        }
+        return ordered_nodes.end();
+    }
+
     size_t low_load_thresh;
     size_t last_shard_id;
+    size_t load_scale = Load_Info::unit_scale;
+    void (*increment_counters)(Shard_Counters& counters, size_t added_load, size_t remote_reads);
 };
 
-class Load_Info_Container : public Load_Info_Container_Base {
+class Load_Info_Container final : public Load_Info_Container_Base {
 public:
     Load_Info_Container(size_t num_compute, size_t num_shards_per_compute, size_t low_load_threshold);
     ~Load_Info_Container();
 
-    std::vector<Owner_Ship_Transfer> apply();
+    void apply(Plan_Sink& sink);
     void divide_shard(size_t owner, size_t index, size_t num);
+
+    // plans the transfer of the shard at index of the shards of from(as ordered now) to node to.
+    // unlike change_owner_from_max_to_min, node loads and the node order are left to the caller
+    inline void add_transfer(size_t from, size_t index, size_t to) {
+        assert(from < cnodes.size() && to < cnodes.size() && index < cnodes[from].num_shards());
+        updates.push_back({from, to, index});
+    }
+
+    // replaces the initial ownership, owners is by shard id. should only be called before the first round
+    void set_owners(const std::vector<size_t>& owners);
 };
 
-class Load_Info_Container_Restricted : public Load_Info_Container_Base {
+class Load_Info_Container_Restricted final : public Load_Info_Container_Base {
 public:
     Load_Info_Container_Restricted(size_t num_compute, size_t num_shards_per_compute, size_t low_load_threshold);
     ~Load_Info_Container_Restricted();
 
-    std::vector<Owner_Ship_Transfer> apply();
+    void apply(Plan_Sink& sink);
     void divide_shard(size_t owner, size_t shard_id, size_t num);
     void change_owner_and_update_load(size_t node_idx, bool left, size_t end_shard_id); // should update load of both cnodes as well
 
+    // node owning key. upper_bound(shard) is the exclusive upper bound key of shard.
+    // nodes own consecutive key ranges, so this is a binary search on the last shard of the nodes
+    template<typename Upper_Bound>
+    size_t node_of_key(size_t key, Upper_Bound upper_bound) const {
+        size_t lo = 0, hi = cnodes.size() - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (key < upper_bound(cnodes[mid].last_id)) {
+                hi = mid;
+            }
+            else {
+                lo = mid + 1;
+            }
+        }
+        return lo;
+    }
+
 private:
     // struct range_update {
     //     size_t from_cnode;
@@ -451,7 +624,8 @@ private:
     // };
 
     std::vector<std::pair<size_t, size_t>> new_first_last;
-    std::vector<Owner_Ship_Transfer> tmp_updates; 
+    std::vector<Owner_Ship_Transfer> tmp_updates; // every move of the round, a shard may move more than once
+    Transfer_Dedup_Table dedup_table;
 
 };
 
@@ -0,0 +1,222 @@
+#ifndef LOCK_PROFILER_H_
+#define LOCK_PROFILER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "config.h"
+#include "latency_model.h"
+#include "phase_timer.h"
+
+namespace TimberSaw {
+
+enum Lock_Site {
+    LOCK_INCREMENT, // load_vector::increment_load
+    LOCK_FLUSH, // load_vector::flush
+    LOCK_DIVIDE, // divide_signal ... finish_signal
+    LOCK_MERGE, // merge_*_signal ... finish_signal
+    LOCK_RENUMBER, // renumber_signal ... finish_signal
+    LOCK_CHECKPOINT, // checkpoint_ranges and restore
+    NUM_LOCK_SITES
+};
+
+inline const char* lock_site_name(size_t site) {
+    static const char* names[NUM_LOCK_SITES + 1] = {"increment", "flush", "divide", "merge", "renumber", "checkpoint", "readers"};
+    return names[site];
+}
+
+// lock statistics of one thread. histograms are in cycles of read_tsc
+struct Lock_Thread_Stats {
+    std::string name;
+    Latency_Histogram wait[NUM_LOCK_SITES];
+    Latency_Histogram hold[NUM_LOCK_SITES];
+    std::atomic<uint64_t> wait_cycles[NUM_LOCK_SITES] = {};
+    std::atomic<uint64_t> hold_cycles[NUM_LOCK_SITES] = {};
+    std::atomic<uint64_t> contended[NUM_LOCK_SITES] = {};
+    // wait cycles of contended acquisitions by the site of the exclusive holder seen when the wait started.
+    // the last column is for waits on shared holders
+    std::atomic<uint64_t> blocked_by[NUM_LOCK_SITES][NUM_LOCK_SITES + 1] = {};
+    uint64_t shared_since[NUM_LOCK_SITES] = {}; // only used by the owner thread
+    std::vector<uint64_t> wait_snapshot[NUM_LOCK_SITES], hold_snapshot[NUM_LOCK_SITES]; // only used by the reporter
+
+    explicit Lock_Thread_Stats(const char* name) : name(name) {}
+
+    // single writer, so the counters do not need atomic read-modify-writes
+    static inline void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+/*
+ * shared mutex recording, for every call site, how long each thread waited for the lock and held it.
+ * uncontended acquisitions are recorded with 0 wait.
+ * a thread registers itself on its first acquisition; set_thread_name should be called before that.
+ */
+class Profiled_Shared_Mutex {
+public:
+    Profiled_Shared_Mutex() : exclusive_site(NUM_LOCK_SITES), exclusive_since(0), start(read_tsc()), id(next_id().fetch_add(1) + 1) {}
+
+    Profiled_Shared_Mutex(const Profiled_Shared_Mutex&) = delete;
+    Profiled_Shared_Mutex& operator=(const Profiled_Shared_Mutex&) = delete;
+
+    static void set_thread_name(const char* name) {
+        thread_name() = name;
+    }
+
+    void lock(Lock_Site site) {
+        Lock_Thread_Stats& stats = thread_stats();
+        uint64_t begin = read_tsc(), acquired = begin;
+        if (!mtx.try_lock()) {
+            size_t holder = exclusive_site.load(std::memory_order_relaxed);
+            mtx.lock();
+            acquired = read_tsc();
+            contended(stats, site, holder, acquired - begin);
+        }
+        stats.wait[site].record(acquired - begin);
+        Lock_Thread_Stats::add(stats.wait_cycles[site], acquired - begin);
+        exclusive_site.store(site, std::memory_order_relaxed);
+        exclusive_since = acquired;
+        exclusive_stats = &stats;
+    }
+
+    void unlock() {
+        size_t site = exclusive_site.load(std::memory_order_relaxed);
+        uint64_t held = read_tsc() - exclusive_since;
+        exclusive_stats->hold[site].record(held);
+        Lock_Thread_Stats::add(exclusive_stats->hold_cycles[site], held);
+        exclusive_site.store(NUM_LOCK_SITES, std::memory_order_relaxed);
+        mtx.unlock();
+    }
+
+    void lock_shared(Lock_Site site) {
+        Lock_Thread_Stats& stats = thread_stats();
+        uint64_t begin = read_tsc(), acquired = begin;
+        if (!mtx.try_lock_shared()) {
+            size_t holder = exclusive_site.load(std::memory_order_relaxed);
+            mtx.lock_shared();
+            acquired = read_tsc();
+            contended(stats, site, holder, acquired - begin);
+        }
+        stats.wait[site].record(acquired - begin);
+        Lock_Thread_Stats::add(stats.wait_cycles[site], acquired - begin);
+        stats.shared_since[site] = acquired;
+    }
+
+    void unlock_shared(Lock_Site site) {
+        Lock_Thread_Stats& stats = thread_stats();
+        uint64_t held = read_tsc() - stats.shared_since[site];
+        stats.hold[site].record(held);
+        Lock_Thread_Stats::add(stats.hold_cycles[site], held);
+        mtx.unlock_shared();
+    }
+
+    // prints the statistics since the construction of the mutex
+    void report(char* buffer);
+
+private:
+    std::shared_mutex mtx;
+    std::atomic<size_t> exclusive_site; // NUM_LOCK_SITES if not held exclusively
+    uint64_t exclusive_since; // only read by the exclusive holder
+    Lock_Thread_Stats* exclusive_stats = nullptr;
+    uint64_t start;
+    uint64_t id; // a mutex may be constructed at the address of a destroyed one, so the thread caches are keyed by id
+
+    std::mutex registry_mtx;
+    std::vector<std::unique_ptr<Lock_Thread_Stats>> registry;
+
+    static inline void contended(Lock_Thread_Stats& stats, size_t site, size_t holder, uint64_t waited) {
+        Lock_Thread_Stats::add(stats.contended[site], 1);
+        Lock_Thread_Stats::add(stats.blocked_by[site][holder], waited);
+    }
+
+    static std::string& thread_name() {
+        static thread_local std::string name = "thread";
+        return name;
+    }
+
+    static std::atomic<uint64_t>& next_id() {
+        static std::atomic<uint64_t> id(0);
+        return id;
+    }
+
+    // the stats of the calling thread in this mutex. the last used mutex is cached, and the stats of every mutex the
+    // thread used are kept by id, so a thread switching between mutexes registers once in each
+    inline Lock_Thread_Stats& thread_stats() {
+        static thread_local uint64_t owner = 0;
+        static thread_local Lock_Thread_Stats* stats = nullptr;
+        static thread_local std::unordered_map<uint64_t, Lock_Thread_Stats*> by_id;
+        if (owner != id) {
+            Lock_Thread_Stats*& cached = by_id[id];
+            if (cached == nullptr) {
+                std::lock_guard<std::mutex> lock(registry_mtx);
+                registry.emplace_back(new Lock_Thread_Stats(thread_name().c_str()));
+                cached = registry.back().get();
+            }
+            stats = cached;
+            owner = id;
+        }
+        return *stats;
+    }
+};
+
+// std::shared_mutex with the interface of Profiled_Shared_Mutex. the call sites are ignored
+class Plain_Shared_Mutex {
+public:
+    static inline void set_thread_name(const char*) {}
+
+    inline void lock(Lock_Site) {
+        mtx.lock();
+    }
+
+    inline void unlock() {
+        mtx.unlock();
+    }
+
+    inline void lock_shared(Lock_Site) {
+        mtx.lock_shared();
+    }
+
+    inline void unlock_shared(Lock_Site) {
+        mtx.unlock_shared();
+    }
+
+private:
+    std::shared_mutex mtx;
+};
+
+#ifdef PROFILE_LOCKS
+using Site_Shared_Mutex = Profiled_Shared_Mutex;
+#else
+using Site_Shared_Mutex = Plain_Shared_Mutex;
+#endif
+
+// std::shared_lock for a call site
+template<class Mutex>
+class Site_Shared_Lock {
+public:
+    Site_Shared_Lock(Mutex& mtx, Lock_Site site) : mtx(mtx), site(site) {
+        mtx.lock_shared(site);
+    }
+
+    ~Site_Shared_Lock() {
+        mtx.unlock_shared(site);
+    }
+
+    Site_Shared_Lock(const Site_Shared_Lock&) = delete;
+    Site_Shared_Lock& operator=(const Site_Shared_Lock&) = delete;
+
+private:
+    Mutex& mtx;
+    Lock_Site site;
+};
+
+}
+
+#endif
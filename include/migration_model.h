@@ -0,0 +1,90 @@
+#ifndef MIGRATION_MODEL_H_
+#define MIGRATION_MODEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+
+#include "plan_sink.h"
+#include "config.h"
+
+namespace TimberSaw {
+
+enum Migration_Policy : char {
+    MIGRATION_STALL = 's', // ops to a moving shard wait until the move is finished
+    MIGRATION_REDIRECT = 'r' // ops to a moving shard are forwarded to the old owner at an extra cost
+};
+
+/*
+ * Models ownership transfers as in-flight data moves instead of instant changes.
+ * Every transfer goes from the old owner through the memory node to the new owner, so it reserves the
+ * send bandwidth of the old owner, the receive bandwidth of the new owner and the memory node bandwidth
+ * for size / min(bandwidths) units of simulated time. Transfers are served in the order of the plan and
+ * each one starts as soon as all of its resources are free.
+ * plans are received as a plan sink of the load balancer and route is called by the load generator.
+ * clock gives the current simulated time and shard_num_keys the size of a shard at the time of the plan.
+ */
+class Migration_Model : public Plan_Sink {
+public:
+    Migration_Model(size_t num_compute, size_t node_bandwidth, size_t memory_bandwidth, size_t bytes_per_key
+        , char policy, size_t redirect_time, std::function<uint64_t()> clock, std::function<size_t(size_t)> shard_num_keys);
+
+    // mtx is held from begin_plan to end_plan
+    void begin_plan(size_t num_transfers) override;
+    void transfer(const Owner_Ship_Transfer& transfer) override;
+    void end_plan() override;
+    void renumber(const std::vector<uint32_t>& old_to_new) override;
+
+    // updates node and delay of an op on shard arriving at now if the shard is being moved
+    inline void route(size_t shard, uint64_t now, size_t& node, uint64_t& service_time, uint64_t& delay) {
+        if (num_in_flight.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        route_slow(shard, now, node, service_time, delay);
+    }
+
+    void report(char* buffer, uint64_t now);
+
+private:
+    struct In_Flight {
+        size_t from;
+        size_t to;
+        uint64_t end;
+    };
+
+    void remove_finished(uint64_t now);
+    void route_slow(size_t shard, uint64_t now, size_t& node, uint64_t& service_time, uint64_t& delay);
+
+    std::function<uint64_t()> clock;
+    std::function<size_t(size_t)> shard_num_keys;
+    uint64_t plan_time = 0;
+    size_t plan_bandwidth = 0;
+
+    std::mutex mtx;
+    std::unordered_map<size_t, In_Flight> in_flight;
+    std::atomic<size_t> num_in_flight;
+    std::vector<uint64_t> send_free_at, receive_free_at;
+    uint64_t memory_free_at = 0;
+
+    size_t node_bandwidth;
+    size_t memory_bandwidth; // 0 means the memory node is never the bottleneck
+    size_t bytes_per_key;
+    char policy;
+    size_t redirect_time;
+
+    // statistics since the last report
+    size_t num_started = 0;
+    size_t bytes_started = 0;
+    uint64_t last_end = 0;
+    size_t num_stalled = 0;
+    uint64_t stall_time = 0;
+    size_t num_redirected = 0;
+};
+
+}
+
+#endif
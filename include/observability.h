@@ -0,0 +1,49 @@
+#ifndef OBSERVABILITY_H_
+#define OBSERVABILITY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+enum Observed_Feature : uint32_t {
+    OBSERVE_ROUND_LOAD = 1u << 0, // per shard load since the last print, one more atomic add per increment
+    OBSERVE_NODE_INFO = 1u << 1, // prints node info
+    OBSERVE_SHARD_INFO = 1u << 2, // prints shard info
+    OBSERVE_SHARDS_PER_NODE = 1u << 3, // prints the shards owned by every node with the node info
+    OBSERVE_UPDATES = 1u << 4, // prints every plan and memory move
+    OBSERVE_CHECKS = 1u << 5, // invariant checks(and prints) of the key ranges and shard lists after every change
+    OBSERVE_INPUT = 1u << 6, // prints the input arguments
+    OBSERVE_PHASES = 1u << 7, // times the phases of every load balancing round, only on the load balancer thread
+    NUM_OBSERVED_FEATURES = 8
+};
+
+inline static constexpr uint32_t observe_all = (1u << NUM_OBSERVED_FEATURES) - 1;
+
+inline const char* observed_feature_name(size_t feature) {
+    static const char* names[NUM_OBSERVED_FEATURES] = {"round_load", "node_info", "shard_info", "shards_per_node", "updates"
+        , "checks", "input", "phases"};
+    return names[feature];
+}
+
+// the features observed by the process. set once at startup, before any load balancer is created
+extern uint32_t observed_features;
+
+inline bool observing(uint32_t features) {
+    return (observed_features & features) != 0;
+}
+
+inline void set_observed_features(uint32_t features) {
+    observed_features = features;
+}
+
+// parses a comma separated list of feature names, all or none. throws std::invalid_argument for an unknown name
+uint32_t parse_observed_features(const char* list);
+// writes the names of features as a comma separated list, or none
+void print_observed_features(char* buffer, uint32_t features);
+
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PERIOD_CONTROLLER_H_
+#define PERIOD_CONTROLLER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "round_metrics.h"
+#include "load_info_container.h"
+
+namespace TimberSaw {
+
+/*
+ * picks the time between two rounds of Load_Balancer::start within [min_period_ms, max_period_ms], starting from
+ * min_period_ms as the first rounds usually move the most.
+ * a round that moves load or sees the imbalance shift drops the period to min_period_ms, and a stable round
+ * doubles it, so the balancer follows a shift with a few short rounds and then backs off while the load stays put.
+ * the period also stays at least 100 / max_busy_percent times the last round, so planning costs at most
+ * max_busy_percent of the time of the balancer thread.
+ */
+class Period_Controller {
+public:
+    Period_Controller(size_t min_period_ms, size_t max_period_ms, size_t max_busy_percent);
+
+    // sets the period after a round that ended with metrics and took round_us to plan and apply
+    void update(const Round_Metrics& metrics, uint64_t round_us);
+
+    inline size_t period_ms() const {
+        return current_ms;
+    }
+
+    // scale of the loads of a round of period_ms(see Load_Info), to the load of a round of max_period_ms
+    inline size_t load_scale() const {
+        return (max_ms << Load_Info::unit_scale_shift) / current_ms;
+    }
+
+    void report(char* buffer);
+
+    // a round moving at least this fraction of the load is not stable
+    inline static constexpr double significant_move = 0.01;
+    // a round whose max/mean load differs at least this much from the previous round is not stable
+    inline static constexpr double significant_shift = 0.05;
+
+private:
+    size_t min_ms, max_ms, current_ms;
+    size_t max_busy_percent;
+    double last_ratio = 0;
+    size_t num_rounds = 0;
+    size_t num_shorter = 0, num_longer = 0;
+    uint64_t sum_period_ms = 0;
+};
+
+}
+
+#endif
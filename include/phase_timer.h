@@ -0,0 +1,140 @@
+#ifndef PHASE_TIMER_H_
+#define PHASE_TIMER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "config.h"
+#include "observability.h"
+
+namespace TimberSaw {
+
+enum Balancer_Phase {
+    PHASE_AGGREGATION, // compute_load_and_pass
+    PHASE_SORT, // sorting the shards of a node by load
+    PHASE_SPLIT, // divide signal(including the wait for the lock), container update and finish signal
+    PHASE_SELECTION, // choosing the transfers(excluding the nested sort and split phases)
+    PHASE_APPLY, // applying the plan and handing it to the listener
+    PHASE_RENUMBER, // renumbering the shards in key order after a round with divides
+    PHASE_CHECKPOINT, // filling the checkpoint records handed to the writer thread
+    NUM_PHASES
+};
+
+inline const char* phase_name(size_t phase) {
+    static const char* names[NUM_PHASES] = {"aggregation", "sort", "split", "selection", "apply", "renumber", "checkpoint"};
+    return names[phase];
+}
+
+inline uint64_t read_tsc() {
+    #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+    #else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    #endif
+}
+
+class Scoped_Phase_Timer;
+
+/*
+ * cycles spent in each phase during the current round, and a log2 histogram of the per-round cycles
+ * of each phase over all rounds. only used by the load balancer thread.
+ * the timers only read the TSC if OBSERVE_PHASES was observed when the stats were created, all cycles are 0 otherwise
+ */
+class Phase_Stats {
+public:
+    inline static constexpr size_t num_buckets = 64;
+
+    inline bool enabled() const {
+        return _enabled;
+    }
+
+    inline uint64_t round_cycles(size_t phase) const {
+        return current_round[phase];
+    }
+
+    // moves the cycles of the current round into the histograms
+    void end_round() {
+        for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+            uint64_t cycles = current_round[phase];
+            ++hist[phase][cycles == 0 ? 0 : 64 - __builtin_clzll(cycles) - 1];
+            total[phase] += cycles;
+            current_round[phase] = 0;
+        }
+        ++num_rounds;
+    }
+
+    // upper bound of the per-round cycles of phase at percentile p over all rounds
+    uint64_t percentile(size_t phase, double p) const {
+        uint64_t rank = static_cast<uint64_t>(p * num_rounds), seen = 0;
+        for (size_t i = 0; i < num_buckets; ++i) {
+            seen += hist[phase][i];
+            if (seen > rank || seen == num_rounds) {
+                return (i == 63 ? UINT64_MAX : (2ull << i) - 1);
+            }
+        }
+        return 0;
+    }
+
+    inline uint64_t mean(size_t phase) const {
+        return num_rounds == 0 ? 0 : total[phase] / num_rounds;
+    }
+
+    inline uint64_t rounds() const {
+        return num_rounds;
+    }
+
+    friend class Scoped_Phase_Timer;
+
+private:
+    uint64_t current_round[NUM_PHASES] = {};
+    uint64_t hist[NUM_PHASES][num_buckets] = {};
+    uint64_t total[NUM_PHASES] = {};
+    uint64_t num_rounds = 0;
+    Scoped_Phase_Timer* active = nullptr;
+    bool _enabled = observing(OBSERVE_PHASES);
+};
+
+// adds the cycles of its scope to a phase. time of nested timers is only counted for the inner phase
+class Scoped_Phase_Timer {
+public:
+    Scoped_Phase_Timer(Phase_Stats& stats, Balancer_Phase phase)
+        : stats(stats), parent(stats.active), phase(phase), start(stats._enabled ? read_tsc() : 0) {
+        if (stats._enabled) {
+            stats.active = this;
+        }
+    }
+
+    ~Scoped_Phase_Timer() {
+        if (!stats._enabled) {
+            return;
+        }
+        uint64_t elapsed = read_tsc() - start;
+        stats.current_round[phase] += elapsed - nested;
+        if (parent != nullptr) {
+            parent->nested += elapsed;
+        }
+        stats.active = parent;
+    }
+
+    Scoped_Phase_Timer(const Scoped_Phase_Timer&) = delete;
+    Scoped_Phase_Timer& operator=(const Scoped_Phase_Timer&) = delete;
+
+private:
+    Phase_Stats& stats;
+    Scoped_Phase_Timer* parent;
+    Balancer_Phase phase;
+    uint64_t start;
+    uint64_t nested = 0;
+};
+
+}
+
+#define PHASE_TIMER_CONCAT_(a, b) a##b
+#define PHASE_TIMER_CONCAT(a, b) PHASE_TIMER_CONCAT_(a, b)
+#define PHASE_TIMER(stats, phase) TimberSaw::Scoped_Phase_Timer PHASE_TIMER_CONCAT(_phase_timer_, __LINE__)(stats, phase)
+
+#endif
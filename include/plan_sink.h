@@ -0,0 +1,156 @@
+#ifndef PLAN_SINK_H_
+#define PLAN_SINK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <cstring>
+#include <vector>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+struct Owner_Ship_Transfer {
+    size_t from;
+    size_t to;
+    size_t shard;
+};
+
+/*
+ * consumer of the applied plans of a load balancer. the transfers of a plan are coalesced:
+ * every shard appears at most once and from is never equal to to.
+ * all calls are made by the load balancer thread.
+ */
+class Plan_Sink {
+public:
+    virtual ~Plan_Sink() {}
+
+    virtual void begin_plan(size_t /* num_transfers */) {}
+    virtual void transfer(const Owner_Ship_Transfer& transfer) = 0;
+    virtual void end_plan() {}
+    // the shards were renumbered, shard i is now old_to_new[i]. called between plans
+    virtual void renumber(const std::vector<uint32_t>& /* old_to_new */) {}
+};
+
+/*
+ * open addressing(linear probing) map from shard id to the index of its transfer in a flat buffer.
+ * clear is O(1) as slots of older generations count as empty, so the table only allocates when it grows.
+ */
+class Transfer_Dedup_Table {
+public:
+    inline static constexpr size_t not_found = SIZE_MAX;
+
+    // should be called before the insertions of a plan
+    void clear(size_t expected_size) {
+        ++generation;
+        num = 0;
+        if (expected_size * 2 > slots.size()) {
+            grow(expected_size * 2);
+        }
+    }
+
+    // returns the index of the transfer of shard if there is one, otherwise inserts index and returns not_found
+    size_t find_or_insert(size_t shard, size_t index) {
+        if ((num + 1) * 2 > slots.size()) {
+            grow((num + 1) * 2);
+        }
+        for (size_t i = hash(shard) & mask;; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.generation != generation) {
+                slot = {shard, index, generation};
+                ++num;
+                return not_found;
+            }
+            if (slot.shard == shard) {
+                return slot.index;
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        size_t shard;
+        size_t index;
+        uint64_t generation;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t num = 0;
+    uint64_t generation = 1;
+
+    static inline size_t hash(size_t shard) {
+        return shard * 0x9E3779B97F4A7C15ull;
+    }
+
+    void grow(size_t min_size) {
+        size_t size = 16;
+        while (size < min_size) {
+            size <<= 1;
+        }
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(size, {0, 0, 0});
+        mask = size - 1;
+        for (const Slot& slot : old) {
+            if (slot.generation == generation) {
+                size_t i = hash(slot.shard) & mask;
+                while (slots[i].generation == generation) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+};
+
+// prints every plan to stdout through a buffer allocated once. large plans are printed in parts
+class Plan_Printer : public Plan_Sink {
+public:
+    Plan_Printer() : buffer(new char[write_buffer_size]), length(0) {
+        buffer[0] = '\0';
+    }
+
+    ~Plan_Printer() {
+        delete[] buffer;
+    }
+
+    Plan_Printer(const Plan_Printer&) = delete;
+    Plan_Printer& operator=(const Plan_Printer&) = delete;
+
+    void begin_plan(size_t num_transfers) override {
+        #ifdef PRINT_COLORED
+        length += sprintf(buffer + length, COLOR_RED "%lu new changes: " COLOR_RESET "\n", num_transfers);
+        #else
+        length += sprintf(buffer + length, "%lu new changes: \n", num_transfers);
+        #endif
+    }
+
+    void transfer(const Owner_Ship_Transfer& transfer) override {
+        if (length + max_line_size >= write_buffer_size) {
+            print();
+        }
+        length += sprintf(buffer + length, "Shard %lu from node %lu to node %lu\n", transfer.shard, transfer.from, transfer.to);
+    }
+
+    void end_plan() override {
+        print();
+    }
+
+private:
+    inline static constexpr size_t max_line_size = 128;
+
+    char* buffer;
+    size_t length;
+
+    void print() {
+        LOGF(stdout, "%s", buffer);
+        buffer[0] = '\0';
+        length = 0;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <stddef.h>
+#include <atomic>
+
+namespace TimberSaw {
+
+// single producer single consumer lock-free queue. push never blocks and fails when the queue is full
+template<class T, size_t Capacity>
+class SPSC_Ring_Buffer {
+    static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0, "capacity should be a power of two");
+
+public:
+    SPSC_Ring_Buffer() : head(0), tail(0) {}
+
+    SPSC_Ring_Buffer(const SPSC_Ring_Buffer&) = delete;
+    SPSC_Ring_Buffer& operator=(const SPSC_Ring_Buffer&) = delete;
+
+    // producer side
+    bool try_push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool try_pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) T items[Capacity];
+};
+
+}
+
+#endif
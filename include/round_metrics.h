@@ -0,0 +1,48 @@
+#ifndef ROUND_METRICS_H_
+#define ROUND_METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "config.h"
+#include "phase_timer.h"
+
+namespace TimberSaw {
+
+// imbalance of the loads seen by one load balancing round and the size of the plan it made
+struct Round_Metrics {
+    size_t round = 0;
+    size_t period_ms = 0; // time since the previous round, fixed or chosen by the period controller
+    size_t num_compute = 0;
+    size_t num_shards = 0;
+    size_t max_load = 0;
+    size_t mean_load = 0;
+    double max_mean_ratio = 0;
+    double cov = 0; // coefficient of variation of node loads
+    double gini = 0; // gini coefficient of node loads
+    size_t p99_shard_load = 0;
+    size_t moved_load = 0;
+    size_t num_transfers = 0;
+    size_t num_splits = 0;
+    size_t num_merges = 0;
+    size_t num_ping_pongs = 0; // transfers moving a shard back to the node it left at most Shard_Info::ping_pong_rounds ago
+    size_t num_held_back = 0; // moves the planner skipped as the shard is cooling down and the gain is within the hysteresis
+    size_t num_runs = 0; // runs of key adjacent shards with the same owner after the plan, over all nodes
+    size_t max_node_runs = 0; // most runs of a node, so the most nodes a scan of its keys can visit
+    size_t max_memory_traffic = 0; // decayed remote reads of the most loaded memory node before the memory moves
+    size_t num_memory_moves = 0;
+    uint64_t phase_cycles[NUM_PHASES] = {}; // all 0 if OBSERVE_PHASES is not observed
+
+    // fills the load statistics. node_loads is reordered and shard_loads is partially reordered
+    void compute_imbalance(std::vector<size_t>& node_loads, std::vector<size_t>& shard_loads);
+
+    static void write_csv_header(FILE* out);
+    void write_csv(FILE* out) const;
+    void write_json(FILE* out) const;
+};
+
+}
+
+#endif
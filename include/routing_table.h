@@ -0,0 +1,126 @@
+#ifndef ROUTING_TABLE_H_
+#define ROUTING_TABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+// key ranges and their owners at one version of the ownership. never changed after it is published
+struct Routing_Snapshot {
+    uint64_t version = 0;
+    std::vector<size_t> upper_bounds; // exclusive upper bound of each range in key order
+    std::vector<size_t> shards;
+    std::vector<size_t> owners;
+
+    void clear() {
+        upper_bounds.clear();
+        shards.clear();
+        owners.clear();
+    }
+
+    inline void add_range(size_t upper_bound, size_t shard, size_t owner) {
+        assert(upper_bounds.empty() || upper_bounds.back() < upper_bound);
+        upper_bounds.push_back(upper_bound);
+        shards.push_back(shard);
+        owners.push_back(owner);
+    }
+
+    inline size_t index(size_t key) const {
+        size_t idx = std::upper_bound(upper_bounds.begin(), upper_bounds.end(), key) - upper_bounds.begin();
+        assert(idx < upper_bounds.size());
+        return idx;
+    }
+};
+
+/*
+ * key to compute node map for the request path. a single writer(the load balancer thread) publishes
+ * a new immutable snapshot per plan and readers resolve keys without locks.
+ * retired snapshots are reclaimed with epochs: every reader announces the epoch it started in on its own
+ * cache line, and a snapshot retired at epoch e is reused once no reader is still in an epoch <= e.
+ */
+class Routing_Table {
+    inline static constexpr uint64_t idle = 0;
+
+    struct alignas(64) Reader_Slot {
+        std::atomic<uint64_t> epoch{idle};
+        std::atomic<bool> used{false};
+    };
+
+public:
+    inline static constexpr size_t max_readers = 64;
+
+    Routing_Table() : current(nullptr), epoch(1) {}
+
+    ~Routing_Table();
+
+    Routing_Table(const Routing_Table&) = delete;
+    Routing_Table& operator=(const Routing_Table&) = delete;
+
+    // a registered reader. should be used by one thread at a time
+    class Reader {
+    public:
+        explicit Reader(Routing_Table& table);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // returns the version of the snapshot used
+        inline uint64_t lookup(size_t key, size_t& owner, size_t& shard) {
+            slot->epoch.store(table.epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+            const Routing_Snapshot* snapshot = table.current.load(std::memory_order_seq_cst);
+            assert(snapshot != nullptr);
+            size_t idx = snapshot->index(key);
+            owner = snapshot->owners[idx];
+            shard = snapshot->shards[idx];
+            uint64_t version = snapshot->version;
+            slot->epoch.store(idle, std::memory_order_release);
+            return version;
+        }
+
+    private:
+        Routing_Table& table;
+        Reader_Slot* slot;
+    };
+
+    // writer side. returns an empty snapshot to be filled and published
+    Routing_Snapshot* begin_update();
+    // makes snapshot the current one and retires the previous one
+    void publish(Routing_Snapshot* snapshot);
+
+    // version of the current snapshot. 0 if nothing is published yet
+    inline uint64_t version() const {
+        return published_version.load(std::memory_order_acquire);
+    }
+
+    // can be called by any thread
+    void report(char* buffer);
+
+private:
+    Reader_Slot slots[max_readers];
+    alignas(64) std::atomic<Routing_Snapshot*> current;
+    alignas(64) std::atomic<uint64_t> epoch;
+
+    // only used by the writer
+    std::vector<std::pair<uint64_t, Routing_Snapshot*>> retired;
+    std::vector<Routing_Snapshot*> spare;
+    uint64_t next_version = 1;
+
+    std::atomic<uint64_t> published_version{0};
+    std::atomic<size_t> num_retired{0}; // retired but not reclaimed yet
+    std::atomic<size_t> num_reclaimed{0};
+
+    void reclaim();
+};
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef STABLE_VECTOR_H_
+#define STABLE_VECTOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <atomic>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+/*
+ * growing array whose elements never move. segment k holds base_size << k elements, so an index maps to its
+ * segment with one count of leading zeros and 32 segments are enough for any 32-bit index.
+ * a single writer grows it while other threads access the elements below the published size:
+ * new segments are filled before the size is published with a release store.
+ */
+template<class T>
+class Stable_Vector {
+public:
+    inline static constexpr size_t base_bits = 12;
+    inline static constexpr size_t base_size = 1ull << base_bits;
+    inline static constexpr size_t max_segments = 32;
+
+    Stable_Vector() : _size(0), num_segments(0) {
+        for (size_t k = 0; k < max_segments; ++k) {
+            segments[k].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    explicit Stable_Vector(size_t size) : Stable_Vector() {
+        resize(size);
+    }
+
+    ~Stable_Vector() {
+        for (size_t k = 0; k < num_segments; ++k) {
+            delete[] segments[k].load(std::memory_order_relaxed);
+        }
+    }
+
+    Stable_Vector(const Stable_Vector&) = delete;
+    Stable_Vector& operator=(const Stable_Vector&) = delete;
+
+    inline size_t size() const {
+        return _size.load(std::memory_order_acquire);
+    }
+
+    inline size_t capacity() const {
+        return base_size * ((1ull << num_segments) - 1);
+    }
+
+    // index should be below a size the caller has seen
+    inline T& operator[](size_t index) {
+        size_t k = segment_of(index);
+        return segments[k].load(std::memory_order_relaxed)[index - segment_start(k)];
+    }
+
+    inline const T& operator[](size_t index) const {
+        size_t k = segment_of(index);
+        return segments[k].load(std::memory_order_relaxed)[index - segment_start(k)];
+    }
+
+    inline T& back() {
+        assert(size() > 0);
+        return (*this)[size() - 1];
+    }
+
+    // makes room for size elements without publishing them, so the writer can fill them first.
+    // the new elements are default constructed. should only be called by the writer
+    void reserve(size_t size) {
+        while (capacity() < size) {
+            assert(num_segments < max_segments);
+            segments[num_segments].store(new T[base_size << num_segments], std::memory_order_relaxed);
+            ++num_segments;
+        }
+    }
+
+    // only grows. should only be called by the writer
+    void resize(size_t size) {
+        assert(size >= _size.load(std::memory_order_relaxed));
+        reserve(size);
+        _size.store(size, std::memory_order_release);
+    }
+
+private:
+    std::atomic<size_t> _size;
+    std::atomic<T*> segments[max_segments];
+    size_t num_segments; // only used by the writer
+
+    static inline size_t segment_of(size_t index) {
+        return 63 - __builtin_clzll((index >> base_bits) + 1);
+    }
+
+    static inline size_t segment_start(size_t k) {
+        return base_size * ((1ull << k) - 1);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "config.h"
+
+namespace TimberSaw {
+
+// op type bits of a trace record
+enum Trace_Op : uint8_t {
+    TRACE_LOCAL_READ = 1,
+    TRACE_REMOTE_READ = 2,
+    TRACE_LOCAL_WRITE = 4,
+    TRACE_FLUSH = 8
+};
+
+struct Trace_Record {
+    size_t key;
+    uint8_t op; // combination of Trace_Op bits
+    uint64_t timestamp; // nanoseconds since the start of the recording
+
+    inline size_t lr() const { return (op & TRACE_LOCAL_READ) != 0; }
+    inline size_t rr() const { return (op & TRACE_REMOTE_READ) != 0; }
+    inline size_t lw() const { return (op & TRACE_LOCAL_WRITE) != 0; }
+    inline size_t fl() const { return (op & TRACE_FLUSH) != 0; }
+};
+
+/*
+ * file layout:
+ *  header: magic(8 bytes) | version(4 bytes) | reserved(4 bytes) | key_lb(8 bytes) | key_ub(8 bytes)
+ *  records: varint(zigzag(key - prev_key)) | varint((timestamp - prev_timestamp) << 4 | op)
+ * a record is usually 3 to 5 bytes for skewed workloads.
+ */
+struct Trace_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t key_lb;
+    uint64_t key_ub;
+};
+
+inline static constexpr char trace_magic[8] = {'T', 'S', 'T', 'R', 'A', 'C', 'E', '\0'};
+inline static constexpr uint32_t trace_version = 1;
+inline static constexpr size_t trace_buffer_size = 1 << 20;
+inline static constexpr size_t trace_max_record_size = 20; // two 10-byte varints
+
+class Trace_Writer {
+public:
+    Trace_Writer(const std::string& path, size_t key_lb, size_t key_ub);
+    ~Trace_Writer();
+
+    Trace_Writer(const Trace_Writer&) = delete;
+    Trace_Writer& operator=(const Trace_Writer&) = delete;
+
+    void record(size_t key, uint8_t op, uint64_t timestamp);
+    void flush();
+    void close();
+
+    inline size_t num_records() const {
+        return _num_records;
+    }
+
+private:
+    inline void put_varint(uint64_t v) {
+        while (v >= 0x80) {
+            buffer[pos++] = static_cast<uint8_t>(v | 0x80);
+            v >>= 7;
+        }
+        buffer[pos++] = static_cast<uint8_t>(v);
+    }
+
+    FILE* file;
+    uint8_t* buffer;
+    size_t pos = 0;
+    size_t prev_key = 0;
+    uint64_t prev_timestamp = 0;
+    size_t _num_records = 0;
+};
+
+// maps the whole trace into memory and decodes it sequentially
+class Trace_Reader {
+public:
+    explicit Trace_Reader(const std::string& path);
+    ~Trace_Reader();
+
+    Trace_Reader(const Trace_Reader&) = delete;
+    Trace_Reader& operator=(const Trace_Reader&) = delete;
+
+    // returns false at the end of the trace(a truncated last record is ignored)
+    bool next(Trace_Record& rec);
+    void reset();
+
+    inline const Trace_Header& header() const {
+        return *reinterpret_cast<const Trace_Header*>(data);
+    }
+
+private:
+    inline bool get_varint(uint64_t& v) {
+        v = 0;
+        for (size_t shift = 0; pos < size && shift < 64; shift += 7) {
+            uint8_t byte = data[pos++];
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t prev_key = 0;
+    uint64_t prev_timestamp = 0;
+};
+
+}
+
+#endif
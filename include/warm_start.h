@@ -0,0 +1,61 @@
+#ifndef WARM_START_H_
+#define WARM_START_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "checkpoint.h"
+#include "trace.h"
+
+namespace TimberSaw {
+
+struct Key_Load_Bucket {
+    size_t lb, ub; // key range [lb, ub)
+    size_t load;
+};
+
+/*
+ * load of the keys seen by a previous run, as buckets sorted by key that do not overlap. keys out of every bucket
+ * had no load. the load inside a bucket is taken as uniform.
+ */
+class Key_Load_Histogram {
+public:
+    Key_Load_Histogram() = default;
+    // buckets should be sorted by key and should not overlap
+    explicit Key_Load_Histogram(std::vector<Key_Load_Bucket> buckets);
+
+    // splits [key_lb, key_ub) into num_buckets equal ranges and adds the service time of every op of the trace.
+    // ops out of [key_lb, key_ub) are ignored
+    static Key_Load_Histogram from_trace(Trace_Reader& trace, size_t key_lb, size_t key_ub, size_t num_buckets
+        , size_t lr_time, size_t rr_time, size_t lw_time, size_t fl_time);
+    // the shard ranges and decayed loads of a checkpoint, whatever its number of nodes and shards
+    static Key_Load_Histogram from_checkpoint(const Checkpoint_Reader& checkpoint);
+    // reads a trace or a checkpoint file, by its magic. throws std::runtime_error if it is neither
+    static Key_Load_Histogram read(const std::string& path, size_t key_lb, size_t key_ub, size_t num_buckets
+        , size_t lr_time, size_t rr_time, size_t lw_time, size_t fl_time);
+
+    // divides [key_lb, key_ub) into num_shards ranges of about the same load and at least min_shard_size keys, and
+    // gives every node consecutive shards of about the same load, so the layout also fits the restricted balancer.
+    // fills the records by shard id in key order with no decayed load. memory nodes are left to the caller
+    void layout(size_t key_lb, size_t key_ub, size_t num_compute, size_t num_shards, size_t min_shard_size
+        , std::vector<Checkpoint_Shard>& records) const;
+
+    inline const std::vector<Key_Load_Bucket>& buckets() const {
+        return _buckets;
+    }
+
+    inline size_t total_load() const {
+        return _total_load;
+    }
+
+private:
+    std::vector<Key_Load_Bucket> _buckets;
+    size_t _total_load = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+
+#include "random.h"
+#include "config.h"
+
+namespace TimberSaw {
+
+enum Workload_Op_Type : uint8_t {
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN, // reads scan_length consecutive keys starting from key
+    OP_READ_MODIFY_WRITE
+};
+
+struct Workload_Op {
+    Workload_Op_Type type;
+    size_t key;
+    size_t scan_length;
+};
+
+enum Key_Distribution : char {
+    KEY_ZIPF = 'z',
+    KEY_UNIFORM = 'u',
+    KEY_LATEST = 'l',
+    KEY_HOTSPOT = 'h'
+};
+
+struct Workload_Options {
+    char workload = 'x'; // x: read_percent reads and the rest updates, [a-f]: ycsb core workloads
+    char key_dist = 0; // one of Key_Distribution, 0 means the default distribution of the workload
+    size_t key_lb = 0;
+    size_t key_ub = 0;
+    size_t seed = 0;
+    size_t read_percent = 25; // only used by workload x
+    size_t max_scan_length = 100;
+    size_t hotspot_key_percent = 10; // size of the hot set as a percentage of the key range
+    size_t hotspot_op_percent = 90; // percentage of ops which go to the hot set
+    size_t drift_period = 0; // number of ops for the hot region to travel the whole key range. 0 means no drift
+    size_t flash_start = 0; // op index at which the flash crowd starts
+    size_t flash_duration = 0; // number of ops the flash crowd lasts. 0 means no flash crowd
+    size_t flash_percent = 50; // percentage of ops which go to the flash crowd keys
+    size_t flash_keys = 16; // number of keys targeted by the flash crowd
+    size_t diurnal_period = 0; // number of ops in one cycle of the request rate. 0 means a constant rate
+    size_t diurnal_amplitude = 50; // percentage by which the request rate swings around its mean [0, 100)
+};
+
+// picks a rank in [0, key_ub - key_lb) where smaller ranks are not necessarily hotter
+class Key_Generator {
+public:
+    virtual ~Key_Generator() {}
+    virtual size_t next() = 0;
+};
+
+class Zipf_Key_Generator : public Key_Generator {
+public:
+    Zipf_Key_Generator(uint64_t seed, size_t num_keys) : gen(seed, num_keys, 1.0) {}
+    size_t next() { return gen() - 1; }
+
+private:
+    zipf_distribution<size_t> gen;
+};
+
+class Uniform_Key_Generator : public Key_Generator {
+public:
+    Uniform_Key_Generator(uint64_t seed, size_t num_keys) : gen(seed), num_keys(num_keys) {}
+    size_t next() { return gen.Uniform(num_keys); }
+
+private:
+    Random64 gen;
+    size_t num_keys;
+};
+
+// zipf over recency: the most recently inserted key is the hottest
+class Latest_Key_Generator : public Key_Generator {
+public:
+    Latest_Key_Generator(uint64_t seed, size_t num_keys, const size_t& insert_head)
+        : gen(seed, num_keys, 1.0), num_keys(num_keys), head(insert_head) {}
+    size_t next() { return (head + num_keys - gen()) % num_keys; }
+
+private:
+    zipf_distribution<size_t> gen;
+    size_t num_keys;
+    const size_t& head;
+};
+
+class Hotspot_Key_Generator : public Key_Generator {
+public:
+    Hotspot_Key_Generator(uint64_t seed, size_t num_keys, size_t key_percent, size_t op_percent)
+        : gen(seed), num_keys(num_keys), hot_keys(std::max<size_t>(num_keys * key_percent / 100, 1)), op_percent(op_percent) {}
+    size_t next() {
+        if (gen.Uniform(100) < op_percent || hot_keys == num_keys) {
+            return gen.Uniform(hot_keys);
+        }
+        return hot_keys + gen.Uniform(num_keys - hot_keys);
+    }
+
+private:
+    Random64 gen;
+    size_t num_keys;
+    size_t hot_keys;
+    size_t op_percent;
+};
+
+/*
+ * Produces a reproducible(by seed) stream of ops made of:
+ *  - an op mix(ycsb A-F or a plain read/update mix)
+ *  - a key distribution(zipf, uniform, latest or hotspot)
+ *  - a drift which rotates the hot region over the key range
+ *  - an optional flash crowd which sends a share of the ops to a few keys for a while
+ *  - a diurnal curve which only changes the rate of ops and not the ops themselves(the caller paces by rate_factor)
+ */
+class Workload {
+public:
+    explicit Workload(const Workload_Options& options);
+
+    // the latest key generator refers to insert_head, so a workload must stay where it was built
+    Workload(const Workload&) = delete;
+    Workload& operator=(const Workload&) = delete;
+    Workload(Workload&&) = delete;
+    Workload& operator=(Workload&&) = delete;
+
+    void next(Workload_Op& op);
+
+    // relative request rate at the current op. 1.0 means the mean rate
+    double rate_factor() const;
+
+    inline size_t num_ops() const {
+        return op_idx;
+    }
+
+    static const char* name(char workload);
+    static const char* key_dist_name(char key_dist);
+
+private:
+    size_t next_key();
+
+    Workload_Options opt;
+    size_t num_keys;
+    size_t read_p, update_p, insert_p, scan_p, rmw_p; // cumulative percentages
+    std::unique_ptr<Key_Generator> key_gen;
+    Random32 type_gen;
+    Random64 aux_gen;
+    size_t insert_head = 0;
+    size_t flash_base = 0;
+    size_t op_idx = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "checkpoint.h"
+#include "testlog.h"
+
+#include <assert.h>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace TimberSaw {
+
+    Checkpoint_Writer::Checkpoint_Writer(const std::string& _path)
+        : path(_path), tmp_path(_path + ".tmp"), num_written(0), num_skipped(0), num_failed(0), last_write_us(0) {
+        FILE* file = fopen(tmp_path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("could not open checkpoint file " + tmp_path + " for writing");
+        }
+        fclose(file);
+        unlink(tmp_path.c_str());
+        thread = std::thread(&Checkpoint_Writer::run, this);
+    }
+
+    Checkpoint_Writer::~Checkpoint_Writer() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopped = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    bool Checkpoint_Writer::submit(const Checkpoint_Header& _header, std::vector<Checkpoint_Shard>& _shards) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (pending) {
+                num_skipped.fetch_add(1);
+                return false;
+            }
+            header = _header;
+            shards.swap(_shards);
+            pending = true;
+        }
+        cv.notify_one();
+        return true;
+    }
+
+    void Checkpoint_Writer::run() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            cv.wait(lock, [this]() { return pending || stopped; });
+            if (!pending) {
+                return;
+            }
+            // header and shards are not touched by submit while pending
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            if (write()) {
+                last_write_us.store(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+                num_written.fetch_add(1);
+            }
+            else {
+                num_failed.fetch_add(1);
+                LOGFC(COLOR_RED, stderr, "could not write checkpoint file %s\n", tmp_path.c_str());
+            }
+            lock.lock();
+            pending = false;
+        }
+    }
+
+    bool Checkpoint_Writer::write() {
+        assert(header.num_shards == shards.size());
+        FILE* file = fopen(tmp_path.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(shards.data(), sizeof(Checkpoint_Shard), shards.size(), file) == shards.size()
+            && fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = (fclose(file) == 0) && ok;
+        return ok && rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    void Checkpoint_Writer::report(char* buffer) {
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_GREEN "checkpoints:" COLOR_RESET " ");
+        #else
+        sprintf(buffer + strlen(buffer), "checkpoints: ");
+        #endif
+        sprintf(buffer + strlen(buffer), "%lu written(last in %lu us), %lu skipped while writing, %lu failed\n\n"
+            , num_written.load(), last_write_us.load(), num_skipped.load(), num_failed.load());
+    }
+
+    Checkpoint_Reader::Checkpoint_Reader(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("could not open checkpoint file " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Checkpoint_Header)) {
+            ::close(fd);
+            throw std::runtime_error("invalid checkpoint file " + path);
+        }
+        size = st.st_size;
+
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("could not map checkpoint file " + path);
+        }
+        data = static_cast<const uint8_t*>(addr);
+        madvise(addr, size, MADV_SEQUENTIAL);
+
+        if (memcmp(header().magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0 || header().version != checkpoint_version
+            // divides instead of multiplying num_shards, which a corrupt header could make overflow
+            || (size - sizeof(Checkpoint_Header)) % sizeof(Checkpoint_Shard) != 0
+            || header().num_shards != (size - sizeof(Checkpoint_Header)) / sizeof(Checkpoint_Shard)) {
+            munmap(addr, size);
+            data = nullptr;
+            throw std::runtime_error("invalid checkpoint file " + path);
+        }
+    }
+
+    Checkpoint_Reader::~Checkpoint_Reader() {
+        if (data != nullptr) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+}
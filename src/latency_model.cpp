@@ -0,0 +1,90 @@
+#include "latency_model.h"
+#include "testlog.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+namespace TimberSaw {
+
+    void Latency_Histogram::drain(std::vector<uint64_t>& snapshot) {
+        snapshot.resize(num_buckets, 0);
+        for (size_t i = 0; i < num_buckets; ++i) {
+            snapshot[i] += counts[i].exchange(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Latency_Histogram::percentile(const std::vector<uint64_t>& snapshot, double p) {
+        uint64_t num = total(snapshot);
+        if (num == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(p * num);
+        rank = std::min(std::max<uint64_t>(rank, 1), num);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            seen += snapshot[i];
+            if (seen >= rank) {
+                return bucket_value(i);
+            }
+        }
+        return bucket_value(snapshot.size() - 1);
+    }
+
+    uint64_t Latency_Histogram::total(const std::vector<uint64_t>& snapshot) {
+        uint64_t num = 0;
+        for (uint64_t c : snapshot) {
+            num += c;
+        }
+        return num;
+    }
+
+    uint64_t Queue_Node::serve(uint64_t arrival, uint64_t service_time) {
+        std::pop_heap(free_at.begin(), free_at.end(), std::greater<uint64_t>());
+        uint64_t start = std::max(arrival, free_at.back());
+        free_at.back() = start + service_time;
+        std::push_heap(free_at.begin(), free_at.end(), std::greater<uint64_t>());
+        return start + service_time - arrival;
+    }
+
+    Latency_Model::Latency_Model(size_t num_compute, size_t num_servers_per_node, size_t op_interval)
+        : nodes(num_compute, Queue_Node(num_servers_per_node)), nodes_hist(new Latency_Histogram[num_compute])
+        , clock(0), op_interval(op_interval) {
+        assert(num_servers_per_node > 0);
+    }
+
+    uint64_t Latency_Model::on_op(size_t node, uint64_t service_time, uint64_t delay) {
+        assert(node < nodes.size());
+        uint64_t arrival = clock.fetch_add(op_interval, std::memory_order_relaxed);
+        uint64_t latency = nodes[node].serve(arrival + delay, service_time) + delay;
+        nodes_hist[node].record(latency);
+        global_hist.record(latency);
+        return arrival;
+    }
+
+    void Latency_Model::report(char* buffer, size_t num_nodes_to_print) {
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_GREEN "latency(p50/p99/p999) at time %lu:" COLOR_RESET "\n", now());
+        #else
+        sprintf(buffer + strlen(buffer), "latency(p50/p99/p999) at time %lu:\n", now());
+        #endif
+
+        snapshot.assign(Latency_Histogram::num_buckets, 0);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            std::vector<uint64_t> node_snapshot(Latency_Histogram::num_buckets, 0);
+            nodes_hist[i].drain(node_snapshot);
+            if (num_nodes_to_print == 0 || i < num_nodes_to_print) {
+                sprintf(buffer + strlen(buffer), "cnode %lu: %lu ops, %lu/%lu/%lu\n", i, Latency_Histogram::total(node_snapshot)
+                    , Latency_Histogram::percentile(node_snapshot, 0.5), Latency_Histogram::percentile(node_snapshot, 0.99)
+                    , Latency_Histogram::percentile(node_snapshot, 0.999));
+            }
+        }
+
+        global_hist.drain(snapshot);
+        sprintf(buffer + strlen(buffer), "global: %lu ops, %lu/%lu/%lu\n\n", Latency_Histogram::total(snapshot)
+            , Latency_Histogram::percentile(snapshot, 0.5), Latency_Histogram::percentile(snapshot, 0.99)
+            , Latency_Histogram::percentile(snapshot, 0.999));
+    }
+}
@@ -3,16 +3,53 @@
 //
 
 #include "load_balancer.h"
+#include "warm_start.h"
 #include "testlog.h"
 #include "config.h"
 
 #include <unistd.h>
 #include <algorithm>
+#include <map>
+#include <thread>
+#include <chrono>
 #include <vector>
 #include <assert.h>
 
 namespace TimberSaw {
 
+    void Load_Balancer::start() {
+        started.store(true);
+        while (started.load()) {
+            if (period_controller != nullptr) {
+                usleep(period_controller->period_ms() * 1000);
+            }
+            else {
+                sleep(rebalance_period_seconds);
+            }
+            #ifdef PRINTER_LOCK
+            mtx.lock();
+            #endif
+            run_round();
+            #ifdef PRINTER_LOCK
+            mtx.unlock();
+            #endif
+        }
+    }
+
+    void Load_Balancer::run_round() {
+        auto start = std::chrono::steady_clock::now();
+        if (period_controller != nullptr) {
+            // the loads were gathered over the current period
+            container->set_load_scale(period_controller->load_scale());
+        }
+        balance_round();
+        if (period_controller != nullptr) {
+            // round_metrics still holds the round, it is only reset by the next begin_round
+            period_controller->update(round_metrics
+                , std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
     void Load_Balancer::shut_down() {
         started.store(false);
     }
@@ -25,18 +62,21 @@ namespace TimberSaw {
     //     container.increment_load_info(shard, num_reads, num_writes, num_remote_reads, num_flushes);
     // }
     
-    void Load_Balancer::increment_load_info(size_t shard, size_t added_load) {
-        container->increment_load_info(shard, added_load);
+    void Load_Balancer::increment_load_info(size_t shard, size_t added_load, size_t remote_reads) {
+        container->increment_load_info(shard, added_load, remote_reads);
     }
 
     // functions for updating load info per shard and node
 
     Load_Balancer::Load_Balancer(Load_Info_Container_Base* _container
         , size_t _rebalance_period_seconds, size_t _load_imbalance_ratio) 
-        : container(_container), started(false)
-            , rebalance_period_seconds(_rebalance_period_seconds), load_imbalance_ratio(_load_imbalance_ratio)
-            , load_imbalance_threshold(0), load_imbalance_threshold_half(0) {
+        : container(_container), memory_traffic(1, 0), memory_shards(1), num_changes(0), num_divides(0)
+            , dropped_round_metrics(0), started(false), rebalance_period_seconds(_rebalance_period_seconds)
+            , load_imbalance_threshold(0), load_imbalance_threshold_half(0), load_imbalance_ratio(_load_imbalance_ratio) {
                 assert(container != nullptr);
+                if (observing(OBSERVE_UPDATES)) {
+                    plan_sinks.push_back(&plan_printer);
+                }
         }
 
 
@@ -44,173 +84,355 @@ namespace TimberSaw {
         delete container;
     }
 
+    void Load_Balancer::begin_round() {
+        round_metrics = Round_Metrics();
+        round_metrics.round = round++;
+        round_metrics.period_ms = (period_controller != nullptr ? period_controller->period_ms() : rebalance_period_seconds * 1000);
 
-    Fixed_Load_Balancer::Fixed_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
-            , size_t _rebalance_period_seconds, size_t __load_imbalance_ratio, size_t low_load_threshold) 
-        : Load_Balancer(new Load_Info_Container(num_compute, num_shards_per_compute, low_load_threshold)
-            , _rebalance_period_seconds, __load_imbalance_ratio) {}
+        node_loads_buffer.resize(container->num_compute());
+        for (size_t i = 0; i < container->num_compute(); ++i) {
+            node_loads_buffer[i] = (*container)[i].load();
+        }
+        shard_loads_buffer.resize(container->num_shards());
+        for (size_t i = 0; i < container->num_shards(); ++i) {
+            shard_loads_buffer[i] = container->shard_id(i).load();
+        }
+        round_metrics.compute_imbalance(node_loads_buffer, shard_loads_buffer);
+    }
 
-    Fixed_Load_Balancer::~Fixed_Load_Balancer() {}
+    void Load_Balancer::set_routing_table(Routing_Table* table) {
+        assert(lv != nullptr && table != nullptr);
+        routing_table = table;
+        Routing_Snapshot* snapshot = routing_table->begin_update();
+        lv->fill_routes(*snapshot);
+        routing_table->publish(snapshot);
+    }
 
-    void Fixed_Load_Balancer::start() {
-        started.store(true);
-        Load_Info_Container& container = dynamic_cast<Load_Info_Container&>(*this->container);
-        while (started.load()) {
-            sleep(rebalance_period_seconds);
-            #ifdef PRINTER_LOCK
-            mtx.lock();
-            #endif
+    void Load_Balancer::set_memory_nodes(size_t _num_memory, size_t capacity) {
+        assert(_num_memory > 0 && !started.load());
+        num_memory = _num_memory;
+        memory_capacity = capacity;
+        memory_traffic.assign(num_memory, 0);
+        memory_shards.resize(num_memory);
+        container->set_memory_nodes(num_memory);
+    }
 
+    void Load_Balancer::balance_memory_nodes() {
+        container->memory_traffic(memory_traffic);
+        round_metrics.max_memory_traffic = *std::max_element(memory_traffic.begin(), memory_traffic.end());
+        if (num_memory < 2 || memory_capacity == 0 || round_metrics.max_memory_traffic <= memory_capacity) {
+            return;
+        }
 
-            size_t min_load;
-            size_t max_load;
-            size_t mean_load = 0, sum_load = 0;
+        for (std::vector<size_t>& shards : memory_shards) {
+            shards.clear();
+        }
+        for (size_t shard = 0; shard < container->num_shards(); ++shard) {
+            if (container->shard_id(shard).remote_reads() > 0) {
+                memory_shards[container->shard_id(shard).memory()].push_back(shard);
+            }
+        }
 
-            container.compute_load_and_pass(min_load, max_load, mean_load, sum_load);
-            load_imbalance_threshold = mean_load / load_imbalance_ratio;
-            load_imbalance_threshold_half = load_imbalance_threshold / 2;
+        std::multimap<size_t, size_t> ordered_memory;
+        for (size_t memory = 0; memory < num_memory; ++memory) {
+            ordered_memory.insert({memory_traffic[memory], memory});
+        }
 
-            if (max_load - min_load <= load_imbalance_threshold) { // use a statistic of shards(like max shard or mean shard as threshold)
-                #ifdef PRINTER_LOCK
-                mtx.unlock();
-                #endif
+        // moves the hottest shard of the most loaded memory node that leaves the least loaded one below it.
+        // if the capacity cannot be met, this still lowers the traffic of the most loaded memory node
+        while (ordered_memory.size() > 1 && std::prev(ordered_memory.end())->first > memory_capacity) {
+            auto max_it = std::prev(ordered_memory.end());
+            auto min_it = ordered_memory.begin();
+            size_t from = max_it->second, to = min_it->second;
+            std::vector<size_t>& shards = memory_shards[from];
+
+            size_t best = shards.size();
+            for (size_t i = 0; i < shards.size(); ++i) {
+                size_t remote_reads = container->shard_id(shards[i]).remote_reads();
+                if (memory_traffic[to] + remote_reads < memory_traffic[from]
+                    && (best == shards.size() || remote_reads > container->shard_id(shards[best]).remote_reads())) {
+                    best = i;
+                }
+            }
+            if (best == shards.size()) {
+                ordered_memory.erase(max_it);
                 continue;
             }
 
-            int min_stat = check_load(container.min_node().load(), mean_load);
-            int max_stat = check_load(container.max_node().load(), mean_load);
-            // TODO add something that if we have outlier do some shard, we recompute mean for the other nodes and try to balance those
-            while ((max_stat > 1 || min_stat < -1) && max_stat > -2 && min_stat < 2) { // loop on nodes
-                Compute_Node_Info& max_node = container.max_node();
-                Shard_Iterator& itr = max_node.ordered_iterator();
+            size_t shard = shards[best];
+            size_t remote_reads = container->shard_id(shard).remote_reads();
+            container->set_memory(shard, to);
+            std::swap(shards[best], shards.back());
+            shards.pop_back();
+            memory_shards[to].push_back(shard);
+            memory_traffic[from] -= remote_reads;
+            memory_traffic[to] += remote_reads;
+            ++round_metrics.num_memory_moves;
+            if (observing(OBSERVE_UPDATES)) {
+                LOGF(stdout, "Shard %lu from memory node %lu to memory node %lu\n", shard, from, to);
+            }
 
-                while (itr.is_valid()) { // loop on shards
-                    if (container.is_insignificant(*(itr.shard()))) {
-                        break;
-                    }
+            ordered_memory.erase(max_it);
+            ordered_memory.erase(min_it);
+            ordered_memory.insert({memory_traffic[from], from});
+            ordered_memory.insert({memory_traffic[to], to});
+        }
+    }
 
-                    int hload_stat = check_load(max_node.load() - itr.shard()->load() - container.get_current_change(), mean_load);
-                    int lload_stat = check_load(container.min_node().load() + itr.shard()->load(), mean_load);
-                    if (hload_stat < -1 || lload_stat > 1) {
-                        // it may be possible that continuing with this would result in better balance
-                        // while both nodes still remain out of prefered range but keep in mind that
-                        // ownership transfer increases the load of a shard. Therefore, the oposit may happen
-                        // as well and transfer is not worth it here.
-                        // In these cases, it is better to increase num shards. (which we cannot do in current design)
-                        ++itr;
-                        continue;
-                    }
-                    
-                    assert(&container.max_node() == &max_node);
-                    container.change_owner_from_max_to_min(itr.index());
-                    ++itr;
-                    if (hload_stat < 2 && lload_stat > -2) {
-                        break;
-                    }
-                    
-                }
-                container.update_max_load();
+    void Load_Balancer::print_memory_traffic(char* buffer) {
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_YELLOW "memory node remote reads(capacity %lu):" COLOR_RESET "\n", memory_capacity);
+        #else
+        sprintf(buffer + strlen(buffer), "memory node remote reads(capacity %lu):\n", memory_capacity);
+        #endif
+        std::vector<size_t> num_shards(num_memory, 0);
+        for (size_t shard = 0; shard < container->num_shards(); ++shard) {
+            ++num_shards[container->shard_id(shard).memory()];
+        }
+        for (size_t memory = 0; memory < num_memory; ++memory) {
+            sprintf(buffer + strlen(buffer), "mnode %lu: %lu remote reads, %lu shards\n", memory, memory_traffic[memory], num_shards[memory]);
+        }
+        sprintf(buffer + strlen(buffer), "\n");
+    }
 
-                if (&max_node == &container.max_node()) {
-                    container.ignore_max(sum_load, mean_load);
-                }
+    void Load_Balancer::renumber_shards() {
+        assert(lv != nullptr);
+        if (!container->key_order(old_to_new)) {
+            return;
+        }
+        lv->renumber_signal(old_to_new);
+        container->renumber(old_to_new);
+        lv->finish_signal();
+        for (Plan_Sink* sink : plan_sinks) {
+            sink->renumber(old_to_new);
+        }
+    }
 
-                min_stat = check_load(container.min_node().load(), mean_load);
-                max_stat = check_load(container.max_node().load(), mean_load);
+    void Load_Balancer::write_checkpoint() {
+        assert(lv != nullptr);
+        container->checkpoint(checkpoint_records);
+        lv->checkpoint_ranges(checkpoint_records);
+
+        Checkpoint_Header header;
+        memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+        header.version = checkpoint_version;
+        header.reserved = 0;
+        header.num_compute = container->num_compute();
+        header.num_memory = num_memory;
+        header.num_shards = container->num_shards();
+        header.key_lb = lv->key_lb();
+        header.key_ub = lv->key_ub();
+        header.round = round;
+        checkpoint_writer->submit(header, checkpoint_records);
+    }
+
+    void Load_Balancer::restore(const Checkpoint_Reader& checkpoint) {
+        assert(lv != nullptr && routing_table == nullptr && !started.load());
+        const Checkpoint_Header& header = checkpoint.header();
+        if (header.num_compute != container->num_compute() || header.key_lb != lv->key_lb() || header.key_ub != lv->key_ub()) {
+            throw std::runtime_error("the checkpoint of " + std::to_string(header.num_compute) + " compute nodes and keys ["
+                + std::to_string(header.key_lb) + ", " + std::to_string(header.key_ub) + ") does not fit the load balancer");
+        }
+        // both checks come first, so a rejected checkpoint leaves the shards and the ranges as they were
+        container->check_restore(checkpoint.shards(), header.num_shards, header.num_memory);
+        lv->check_restore(checkpoint.shards(), header.num_shards);
+        container->restore(checkpoint.shards(), header.num_shards, header.num_memory);
+        lv->restore(checkpoint.shards(), header.num_shards);
+        if (header.num_memory != num_memory) {
+            // the memory nodes of the checkpoint do not exist anymore, so the shards are spread again
+            container->set_memory_nodes(num_memory);
+        }
+    }
+
+    void Load_Balancer::warm_start(const Key_Load_Histogram& histogram) {
+        assert(lv != nullptr && routing_table == nullptr && !started.load());
+        std::vector<Checkpoint_Shard> records;
+        histogram.layout(lv->key_lb(), lv->key_ub(), container->num_compute(), container->num_shards()
+            , lv->minimum_shard_size(), records);
+        container->check_restore(records.data(), records.size(), 1); // the layout puts every shard on memory node 0
+        lv->check_restore(records.data(), records.size());
+        container->restore(records.data(), records.size(), 1);
+        lv->restore(records.data(), records.size());
+        container->set_memory_nodes(num_memory);
+    }
+
+    void Load_Balancer::end_round() {
+        balance_memory_nodes();
+        if (renumbering && round_metrics.num_splits > 0) {
+            PHASE_TIMER(phase_stats, PHASE_RENUMBER);
+            renumber_shards();
+        }
+        if (routing_table != nullptr
+            && round_metrics.num_transfers + round_metrics.num_splits + round_metrics.num_merges > 0) {
+            Routing_Snapshot* snapshot = routing_table->begin_update();
+            lv->fill_routes(*snapshot);
+            routing_table->publish(snapshot);
+        }
+        if (checkpoint_writer != nullptr && round % checkpoint_period == 0) {
+            PHASE_TIMER(phase_stats, PHASE_CHECKPOINT);
+            write_checkpoint();
+        }
+        round_metrics.num_runs = container->count_runs(node_runs_buffer);
+        round_metrics.max_node_runs = *std::max_element(node_runs_buffer.begin(), node_runs_buffer.end());
+        for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+            round_metrics.phase_cycles[phase] = phase_stats.round_cycles(phase);
+        }
+        phase_stats.end_round();
+        if (!round_metrics_queue.try_push(round_metrics)) {
+            dropped_round_metrics.fetch_add(1);
+        }
+    }
+
+    size_t Load_Balancer::placement(const Shard_Info& shard, size_t to, size_t mean_load) {
+        if (!locality_aware) {
+            return to;
+        }
+        // shard 0 is always the first in key order, its prev is not a shard
+        size_t num_shards = container->num_shards();
+        size_t neighbours[2] = {shard.id() != 0 ? shard.prev_id() : num_shards, shard.next_id()};
+        auto adjacency = [&](size_t node) {
+            size_t count = 0;
+            for (size_t neighbour : neighbours) {
+                count += (neighbour < num_shards && container->shard_id(neighbour).owner() == node);
+            }
+            return count;
+        };
+
+        // a node owning both neighbours joins two runs into one, a node owning one extends a run
+        size_t best = to, best_adjacency = adjacency(to);
+        for (size_t neighbour : neighbours) {
+            if (neighbour >= num_shards) {
+                continue;
+            }
+            size_t node = container->shard_id(neighbour).owner();
+            if (node == shard.owner() || node == best || !container->is_ordered(node)) {
+                continue;
+            }
+            size_t node_load = (*container)[node].load();
+            size_t node_adjacency = adjacency(node);
+            if (check_load(node_load + shard.load(), mean_load) <= 1 && (node_adjacency > best_adjacency
+                || (node_adjacency == best_adjacency && best != to && node_load < (*container)[best].load()))) {
+                best = node;
+                best_adjacency = node_adjacency;
             }
-            set_up_new_plan();
-            #ifdef PRINTER_LOCK
-            mtx.unlock();
-            #endif
         }
+        return best;
     }
 
-    void Fixed_Load_Balancer::set_up_new_plan() {
-        auto updates = container->apply();
-        #ifdef PRINT_UPDATE_INFO
-        char* buffer_2 = new char[write_buffer_size];
-        memset(buffer_2, 0, write_buffer_size);
-        #ifdef PRINT_COLORED
-        sprintf(buffer_2 + strlen(buffer_2), COLOR_RED "%lu new changes: " COLOR_RESET "\n", updates.size());
-        #else
-        sprintf(buffer_2 + strlen(buffer_2), "%lu new changes: \n", updates.size());
-        #endif
-        for (auto update : updates) {
-            sprintf(buffer_2 + strlen(buffer_2), "Shard %lu from node %lu to node %lu\n", update.shard, update.from, update.to);
+    void Load_Balancer::begin_plan(size_t num_transfers) {
+        num_changes.fetch_add(num_transfers);
+        round_metrics.num_transfers += num_transfers;
+        for (Plan_Sink* sink : plan_sinks) {
+            sink->begin_plan(num_transfers);
         }
-        LOGF(stdout, "%s", buffer_2);
-        delete[] buffer_2;
-        #endif
+    }
+
+    void Load_Balancer::transfer(const Owner_Ship_Transfer& transfer) {
+        Shard_Info& shard = container->shard_id(transfer.shard);
+        round_metrics.moved_load += shard.load();
+        if (shard.record_move(transfer.from, transfer.to, round_metrics.round)) {
+            ++round_metrics.num_ping_pongs;
+        }
+        for (Plan_Sink* sink : plan_sinks) {
+            sink->transfer(transfer);
+        }
+    }
 
+    void Load_Balancer::end_plan() {
+        for (Plan_Sink* sink : plan_sinks) {
+            sink->end_plan();
+        }
     }
 
-    
-    Dynamic_Load_Balancer::Dynamic_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+
+    template<class Container, class Threshold_Policy, class Split_Policy, class Selection_Policy>
+    Greedy_Load_Balancer<Container, Threshold_Policy, Split_Policy, Selection_Policy>::Greedy_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
             , size_t _rebalance_period_seconds, size_t __load_imbalance_ratio, size_t low_load_threshold) 
-        : Load_Balancer(new Load_Info_Container(num_compute, num_shards_per_compute, low_load_threshold)
+        : Load_Balancer(new Container(num_compute, num_shards_per_compute, low_load_threshold)
             , _rebalance_period_seconds, __load_imbalance_ratio) {}
 
-    Dynamic_Load_Balancer::~Dynamic_Load_Balancer() {}
+    template<class Container, class Threshold_Policy, class Split_Policy, class Selection_Policy>
+    Greedy_Load_Balancer<Container, Threshold_Policy, Split_Policy, Selection_Policy>::~Greedy_Load_Balancer() {}
 
-    void Dynamic_Load_Balancer::start() {
-        started.store(true);
-        Load_Info_Container& container = dynamic_cast<Load_Info_Container&>(*this->container);
-        while (started.load()) {
-            sleep(rebalance_period_seconds);
-            #ifdef PRINTER_LOCK
-            mtx.lock();
-            #endif
+    template<class Container, class Threshold_Policy, class Split_Policy, class Selection_Policy>
+    void Greedy_Load_Balancer<Container, Threshold_Policy, Split_Policy, Selection_Policy>::split_heavy_shards(Container& container
+            , Compute_Node_Info& max_node, size_t mean_load) {
+        Shard_Iterator& itr = max_node.ordered_iterator();
+        while (itr.is_valid()) { // loop on shards
+            if (container.is_insignificant(*(itr.shard())) || itr.shard()->load() * 2 < load_imbalance_threshold_half) {
+                break;
+            }
+
+            int hload_stat = check_load(max_node.load() - itr.shard()->load(), mean_load);
+            int lload_stat = check_load(container.min_node().load() + itr.shard()->load(), mean_load);
+            if (hload_stat >= -1 && lload_stat <= 1) {
+                // passing this shard(and next ones) will not cause troble
+                break;
+            }
+
+            size_t divide_to = Split_Policy::num_pieces(itr.shard()->load(), load_imbalance_threshold_half);
+            PHASE_TIMER(phase_stats, PHASE_SPLIT);
+            size_t shard = itr.shard()->id();
+            divide_to = std::min(divide_to, lv->max_divide(shard));
+            if (divide_to > 1) {
+                // the new shards are appended before the keys move to them, so flushes are not blocked meanwhile
+                container.divide_shard(itr.shard()->owner(), itr.index(), divide_to);
+                lv->divide_signal(shard, divide_to);
+                lv->finish_signal();
+                num_divides.fetch_add(1);
+                ++round_metrics.num_splits;
+                itr.reset(); // can do better
+            }
+            else {
+                ++itr;
+            }
+        }
+        itr.reset();
+    }
+
+    template<class Container, class Threshold_Policy, class Split_Policy, class Selection_Policy>
+    void Greedy_Load_Balancer<Container, Threshold_Policy, Split_Policy, Selection_Policy>::balance_round() {
+        Container& container = typed_container<Container>();
 
-            size_t min_load;
-            size_t max_load;
-            size_t mean_load = 0, sum_load = 0;
+        size_t min_load;
+        size_t max_load;
+        size_t mean_load = 0, sum_load = 0;
 
+        {
+            PHASE_TIMER(phase_stats, PHASE_AGGREGATION);
             container.compute_load_and_pass(min_load, max_load, mean_load, sum_load);
-            load_imbalance_threshold = mean_load / load_imbalance_ratio;
-            load_imbalance_threshold_half = load_imbalance_threshold / 2;
+        }
+        begin_round();
+        load_imbalance_threshold = Threshold_Policy::threshold(mean_load, load_imbalance_ratio);
+        load_imbalance_threshold_half = load_imbalance_threshold / 2;
 
-            if (max_load - min_load <= load_imbalance_threshold) { // use a statistic of shards(like max shard or mean shard as threshold)
-                #ifdef PRINTER_LOCK
-                mtx.unlock();
-                #endif
-                continue;
-            }
+        if (max_load - min_load <= load_imbalance_threshold) { // use a statistic of shards(like max shard or mean shard as threshold)
+            end_round();
+            return;
+        }
 
+        {
+            PHASE_TIMER(phase_stats, PHASE_SELECTION);
             int min_stat = check_load(container.min_node().load(), mean_load);
             int max_stat = check_load(container.max_node().load(), mean_load);
+            was_max.assign(container.num_compute(), false);
             // TODO add something that if we have outlier do some shard, we recompute mean for the other nodes and try to balance those
             while ((max_stat > 1 || min_stat < -1) && max_stat > -2 && min_stat < 2) { // loop on nodes
                 Compute_Node_Info& max_node = container.max_node();
+                {
+                    PHASE_TIMER(phase_stats, PHASE_SORT);
+                    max_node.ordered_iterator(); // sorts the shards if needed
+                }
                 Shard_Iterator& itr = max_node.ordered_iterator();
 
-                // divide if needed
-                while (itr.is_valid()) { // loop on shards
-                    if (container.is_insignificant(*(itr.shard())) || itr.shard()->load() * 2 < load_imbalance_threshold_half) {
-                        break;
-                    }
-
-                    int hload_stat = check_load(max_node.load() - itr.shard()->load(), mean_load);
-                    int lload_stat = check_load(container.min_node().load() + itr.shard()->load(), mean_load);
-                    if (hload_stat >= -1 && lload_stat <= 1) {
-                        // passing this shard(and next ones) will not cause troble
-                        break;
+                if constexpr (Split_Policy::enabled) {
+                    // a divide reorders the shards of the node, which breaks the transfers it planned on an earlier
+                    // turn as the max node in the round
+                    if (!was_max[max_node.id()]) {
+                        split_heavy_shards(container, max_node, mean_load);
                     }
-
-                    size_t mean_shard = sum_load / container.num_shards();
-
-                    size_t divide_to = (itr.shard()->load() * 4) / load_imbalance_threshold_half;
-                    divide_to = lv->divide_signal(itr.shard()->id(), divide_to);
-                    if (divide_to > 1) {
-                        container.divide_shard(itr.shard()->owner(), itr.index(), divide_to);
-                        itr.reset(); // can do better
-                    }
-                    else {
-                        ++itr;
-                    }
-                    lv->finish_signal();            
                 }
-
-                itr.reset();
+                was_max[max_node.id()] = true;
 
                 while (itr.is_valid()) { // loop on shards
                     if (container.is_insignificant(*(itr.shard()))) {
@@ -219,59 +441,61 @@ namespace TimberSaw {
 
                     int hload_stat = check_load(max_node.load() - itr.shard()->load() - container.get_current_change(), mean_load);
                     int lload_stat = check_load(container.min_node().load() + itr.shard()->load(), mean_load);
-                    if (hload_stat < -1 || lload_stat > 1) {
+                    if (Selection_Policy::skip(hload_stat, lload_stat)) {
                         // it may be possible that continuing with this would result in better balance
                         // while both nodes still remain out of prefered range but keep in mind that
                         // ownership transfer increases the load of a shard. Therefore, the oposit may happen
                         // as well and transfer is not worth it here.
-                        // In these cases, it is better to increase num shards. (which we cannot do in current design)
+                        // In these cases, it is better to increase num shards.
                         ++itr;
                         continue;
                     }
-                    
+                    size_t to = placement(*itr.shard(), container.min_node().id(), mean_load);
+                    if (held_back(*itr.shard(), max_node.load() - container.get_current_change(), container[to].load())) {
+                        ++round_metrics.num_held_back;
+                        ++itr;
+                        continue;
+                    }
+                
                     assert(&container.max_node() == &max_node);
-                    container.change_owner_from_max_to_min(itr.index());
+                    if (to == container.min_node().id()) {
+                        container.change_owner_from_max_to_min(itr.index());
+                    }
+                    else {
+                        lload_stat = check_load(container[to].load() + itr.shard()->load(), mean_load);
+                        container.change_owner_from_max(itr.index(), to);
+                    }
                     ++itr;
-                    if (hload_stat < 2 && lload_stat > -2) {
+                    if (Selection_Policy::done(hload_stat, lload_stat)) {
                         break;
                     }
                 }
                 container.update_max_load();
 
                 if (&max_node == &container.max_node()) {
-                    container.ignore_max(sum_load, mean_load); // should not happen?
+                    container.ignore_max(sum_load, mean_load);
                 }
 
                 min_stat = check_load(container.min_node().load(), mean_load);
                 max_stat = check_load(container.max_node().load(), mean_load);
             }
+        }
 
+        {
+            PHASE_TIMER(phase_stats, PHASE_APPLY);
             set_up_new_plan();
-            #ifdef PRINTER_LOCK
-            mtx.unlock();
-            #endif
         }
+        end_round();
     }
 
-    void Dynamic_Load_Balancer::set_up_new_plan() {
-        auto updates = container->apply();
-        #ifdef PRINT_UPDATE_INFO
-        char* buffer_2 = new char[write_buffer_size];
-        memset(buffer_2, 0, write_buffer_size);
-        #ifdef PRINT_COLORED
-        sprintf(buffer_2 + strlen(buffer_2), COLOR_RED "%lu new changes: " COLOR_RESET "\n", updates.size());
-        #else
-        sprintf(buffer_2 + strlen(buffer_2), "%lu new changes: \n", updates.size());
-        #endif
-        for (auto update : updates) {
-            sprintf(buffer_2 + strlen(buffer_2), "Shard %lu from node %lu to node %lu\n", update.shard, update.from, update.to);
-        }
-        LOGF(stdout, "%s", buffer_2);
-        delete[] buffer_2;
-        #endif
-
+    template<class Container, class Threshold_Policy, class Split_Policy, class Selection_Policy>
+    void Greedy_Load_Balancer<Container, Threshold_Policy, Split_Policy, Selection_Policy>::set_up_new_plan() {
+        typed_container<Container>().apply(*this);
     }
 
+    template class Greedy_Load_Balancer<Load_Info_Container, Ratio_Threshold, No_Split, Heaviest_First_Selection>;
+    template class Greedy_Load_Balancer<Load_Info_Container, Ratio_Threshold, Proportional_Split, Heaviest_First_Selection>;
+
     Dynamic_Restricted_Load_Balancer::Dynamic_Restricted_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
             , size_t _rebalance_period_seconds, size_t __load_imbalance_ratio, size_t low_load_threshold) 
         : Load_Balancer(new Load_Info_Container_Restricted(num_compute, num_shards_per_compute, low_load_threshold)
@@ -353,7 +577,7 @@ namespace TimberSaw {
     }
 
     void Dynamic_Restricted_Load_Balancer::push_load_left(size_t node_idx, size_t load, size_t mean_load) {
-        Load_Info_Container_Restricted& container = dynamic_cast<Load_Info_Container_Restricted&>(*this->container);
+        Load_Info_Container_Restricted& container = typed_container<Load_Info_Container_Restricted>();
 
         if (load == 0) {
             return;
@@ -376,14 +600,17 @@ namespace TimberSaw {
             }
 
             if (shard_itr->load() > load - pushed) {
+                PHASE_TIMER(phase_stats, PHASE_SPLIT);
                 size_t divide_to = (shard_itr->load() / (load - pushed)) + 1;
-                divide_to = lv->divide_signal(shard_itr->id(), divide_to);
+                divide_to = std::min(divide_to, lv->max_divide(shard_itr->id()));
                 if (divide_to > 1) {
                     container.divide_shard(node_idx, shard_itr->id(), divide_to);
+                    lv->divide_signal(shard_itr->id(), divide_to);
                     lv->finish_signal();
+                    num_divides.fetch_add(1);
+                    ++round_metrics.num_splits;
                 }
                 else {
-                    lv->finish_signal();
                     break;
                 }
             }
@@ -406,7 +633,7 @@ namespace TimberSaw {
     }
 
     void Dynamic_Restricted_Load_Balancer::push_load_right(size_t node_idx, size_t load, size_t mean_load) {
-        Load_Info_Container_Restricted& container = dynamic_cast<Load_Info_Container_Restricted&>(*this->container);
+        Load_Info_Container_Restricted& container = typed_container<Load_Info_Container_Restricted>();
 
         if (load == 0) {
             return;
@@ -428,12 +655,16 @@ namespace TimberSaw {
             }
 
             if (shard_itr->load() > load - pushed) {
+                PHASE_TIMER(phase_stats, PHASE_SPLIT);
                 size_t divide_to = (shard_itr->load() / (load - pushed)) + 1;
-                divide_to = lv->divide_signal(shard_itr->id(), divide_to);
+                divide_to = std::min(divide_to, lv->max_divide(shard_itr->id()));
                 if (divide_to > 1) {
                     bool was_last = shard_itr->id() == node.last_shard_id();
                     container.divide_shard(node_idx, shard_itr->id(), divide_to);
+                    lv->divide_signal(shard_itr->id(), divide_to);
                     lv->finish_signal();
+                    num_divides.fetch_add(1);
+                    ++round_metrics.num_splits;
                     assert(container.shard_id(container.num_shards() - 1).owner() == node_idx);
                     // assert((!was_last 
                     //         && container.shard_id(container.num_shards() - 1).next_id() == container[node_idx].last_shard_id())
@@ -442,7 +673,6 @@ namespace TimberSaw {
                     shard_id = shard_itr->id();
                 }
                 else {
-                    lv->finish_signal();
                     break;
                 }
             }
@@ -473,40 +703,38 @@ namespace TimberSaw {
     //     Load_Info_Container_Base& container = *this->container;
     // }
 
-    void Dynamic_Restricted_Load_Balancer::start() {
-        started.store(true);
+    void Dynamic_Restricted_Load_Balancer::balance_round() {
         Load_Info_Container_Base& container = *this->container;
-        while (started.load()) {
-            sleep(rebalance_period_seconds);
-            #ifdef PRINTER_LOCK
-            mtx.lock();
-            #endif
 
-            size_t min_load;
-            size_t max_load;
-            size_t mean_load = 0, sum_load = 0;
+        size_t min_load;
+        size_t max_load;
+        size_t mean_load = 0, sum_load = 0;
 
+        {
+            PHASE_TIMER(phase_stats, PHASE_AGGREGATION);
             container.compute_load_and_pass(min_load, max_load, mean_load, sum_load);
-            load_imbalance_threshold = mean_load / load_imbalance_ratio;
-            load_imbalance_threshold_half = load_imbalance_threshold / 2;
+        }
+        begin_round();
+        load_imbalance_threshold = mean_load / load_imbalance_ratio;
+        load_imbalance_threshold_half = load_imbalance_threshold / 2;
 
-            if (max_load - min_load <= load_imbalance_threshold) { // use a statistic of shards(like max shard or mean shard as threshold)
-                #ifdef PRINTER_LOCK
-                mtx.unlock();
-                #endif
-                continue;
-            }
+        if (max_load - min_load <= load_imbalance_threshold) { // use a statistic of shards(like max shard or mean shard as threshold)
+            end_round();
+            return;
+        }
 
-            size_t left = 0, right = sum_load;
-            for(size_t i = 0; i < num_compute(); ++i) {
-                right -= container[i].load();
-                lr_load[i].first = left;
-                lr_load[i].second = right;
-                if (i < num_compute() - 1) {
-                    left += container[i].load();
-                }
+        size_t left = 0, right = sum_load;
+        for(size_t i = 0; i < num_compute(); ++i) {
+            right -= container[i].load();
+            lr_load[i].first = left;
+            lr_load[i].second = right;
+            if (i < num_compute() - 1) {
+                left += container[i].load();
             }
+        }
 
+        {
+            PHASE_TIMER(phase_stats, PHASE_SELECTION);
             int min_stat = check_load(container.min_node().load(), mean_load);
             int max_stat = check_load(container.max_node().load(), mean_load);
             // TODO add something that if we have outlier do some shard, we recompute mean for the other nodes and try to balance those
@@ -516,7 +744,7 @@ namespace TimberSaw {
                 get_load_req(max_node.id(), max_node.id(), num_compute() - max_node.id() - 1
                     , max_node.load(), lr_load[max_node.id()].first, lr_load[max_node.id()].second, true
                     , left_req, right_req);
-                
+            
                 push_load_left(max_node.id(), left_req, mean_load);
                 push_load_right(max_node.id(), right_req, mean_load);
 
@@ -527,31 +755,494 @@ namespace TimberSaw {
                 min_stat = check_load(container.min_node().load(), mean_load);
                 max_stat = check_load(container.max_node().load(), mean_load);
             }
+        }
 
+        {
+            PHASE_TIMER(phase_stats, PHASE_APPLY);
             set_up_new_plan();
-            #ifdef PRINTER_LOCK
-            mtx.unlock();
-            #endif
         }
+        end_round();
     }
 
     void Dynamic_Restricted_Load_Balancer::set_up_new_plan() {
-        auto updates = container->apply();
-        #ifdef PRINT_UPDATE_INFO
-        char* buffer_2 = new char[write_buffer_size];
-        memset(buffer_2, 0, write_buffer_size);
-        #ifdef PRINT_COLORED
-        sprintf(buffer_2 + strlen(buffer_2), COLOR_RED "%lu new changes: " COLOR_RESET "\n", updates.size());
-        #else
-        sprintf(buffer_2 + strlen(buffer_2), "%lu new changes: \n", updates.size());
-        #endif
-        for (auto update : updates) {
-            sprintf(buffer_2 + strlen(buffer_2), "Shard %lu from node %lu to node %lu\n", update.shard, update.from, update.to);
+        typed_container<Load_Info_Container_Restricted>().apply(*this);
+    }
+
+    size_t Dynamic_Restricted_Load_Balancer::node_of_key(size_t key) {
+        Load_Info_Container_Restricted& container = typed_container<Load_Info_Container_Restricted>();
+        return container.node_of_key(key, [this](size_t shard) { return lv->shard_upper_bound(shard); });
+    }
+
+    Hierarchical_Load_Balancer::Hierarchical_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+            , size_t _rebalance_period_seconds, size_t __load_imbalance_ratio, size_t low_load_threshold
+            , size_t _group_size, size_t _num_planner_threads)
+        : Load_Balancer(new Load_Info_Container(num_compute, num_shards_per_compute, low_load_threshold)
+            , _rebalance_period_seconds, __load_imbalance_ratio)
+            , group_size(_group_size), num_groups((num_compute + _group_size - 1) / _group_size)
+            , num_planner_threads(_num_planner_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : _num_planner_threads)
+            , planned_loads(num_compute, 0), group_loads(num_groups, 0), group_transfers(num_groups) {
+                assert(group_size > 0);
+            }
+
+    Hierarchical_Load_Balancer::~Hierarchical_Load_Balancer() {}
+
+    bool Hierarchical_Load_Balancer::pick_shard(Load_Info_Container& container, size_t node, size_t max_load, size_t& index) {
+        Compute_Node_Info& cnode = container[node];
+        cnode.ordered_iterator(); // sorts the shards if needed
+        for (size_t i = cnode.num_shards(); i-- > 0;) {
+            Shard_Info& shard = cnode[i];
+            if (container.is_insignificant(shard) || shard.load() == 0) {
+                return false;
+            }
+            if (shard.load() <= max_load && !moved[shard.id()]) {
+                index = i;
+                return true;
+            }
         }
-        LOGF(stdout, "%s", buffer_2);
-        delete[] buffer_2;
-        #endif
+        return false;
+    }
+
+    void Hierarchical_Load_Balancer::move_planned(std::vector<Owner_Ship_Transfer>& transfers, Load_Info_Container& container
+        , size_t from, size_t index, size_t to) {
+        Shard_Info& shard = container[from][index];
+        moved[shard.id()] = true;
+        planned_loads[from] -= shard.load();
+        planned_loads[to] += shard.load();
+        transfers.push_back({from, to, index});
+    }
+
+    void Hierarchical_Load_Balancer::plan_between_groups(Load_Info_Container& container) {
+        inter_group_transfers.clear();
+        if (num_groups < 2) {
+            return;
+        }
+
+        // the last group may be smaller, so the groups are ordered by their mean node load
+        auto group_end = [this](size_t group) { return std::min((group + 1) * group_size, num_compute()); };
+        auto group_mean = [this, &group_end](size_t group) { return group_loads[group] / (group_end(group) - group * group_size); };
+        std::multimap<size_t, size_t> ordered_groups;
+        for (size_t group = 0; group < num_groups; ++group) {
+            group_loads[group] = 0;
+            for (size_t node = group * group_size; node < group_end(group); ++node) {
+                group_loads[group] += planned_loads[node];
+            }
+            ordered_groups.insert({group_mean(group), group});
+        }
+
+        while (ordered_groups.size() > 1) {
+            auto max_it = std::prev(ordered_groups.end());
+            auto min_it = ordered_groups.begin();
+            size_t max_group = max_it->second, min_group = min_it->second;
+            if (max_it->first - min_it->first <= load_imbalance_threshold) {
+                break;
+            }
+
+            size_t from = max_group * group_size, to = min_group * group_size;
+            for (size_t node = from; node < group_end(max_group); ++node) {
+                if (planned_loads[node] > planned_loads[from]) {
+                    from = node;
+                }
+            }
+            for (size_t node = to; node < group_end(min_group); ++node) {
+                if (planned_loads[node] < planned_loads[to]) {
+                    to = node;
+                }
+            }
+
+            // moving at most half of the difference times the size of the smaller group narrows the gap between the means
+            size_t min_group_size = std::min(group_end(max_group) - max_group * group_size, group_end(min_group) - min_group * group_size);
+            size_t index;
+            if (!pick_shard(container, from, (max_it->first - min_it->first) * min_group_size / 2, index)) {
+                ordered_groups.erase(max_it);
+                continue;
+            }
+
+            size_t load = container[from][index].load();
+            move_planned(inter_group_transfers, container, from, index, to);
+            group_loads[max_group] -= load;
+            group_loads[min_group] += load;
+            ordered_groups.erase(max_it);
+            ordered_groups.erase(min_it);
+            ordered_groups.insert({group_mean(max_group), max_group});
+            ordered_groups.insert({group_mean(min_group), min_group});
+        }
+    }
+
+    void Hierarchical_Load_Balancer::plan_group(Load_Info_Container& container, size_t group) {
+        std::vector<Owner_Ship_Transfer>& transfers = group_transfers[group];
+        transfers.clear();
+
+        std::multimap<size_t, size_t> ordered_nodes;
+        for (size_t node = group * group_size; node < std::min((group + 1) * group_size, num_compute()); ++node) {
+            ordered_nodes.insert({planned_loads[node], node});
+        }
+
+        while (ordered_nodes.size() > 1) {
+            auto max_it = std::prev(ordered_nodes.end());
+            auto min_it = ordered_nodes.begin();
+            size_t from = max_it->second, to = min_it->second;
+            if (max_it->first - min_it->first <= load_imbalance_threshold) {
+                break;
+            }
+
+            // moving at most half of the difference always narrows the gap between the two nodes
+            size_t index;
+            if (!pick_shard(container, from, (max_it->first - min_it->first) / 2, index)) {
+                ordered_nodes.erase(max_it);
+                continue;
+            }
+
+            move_planned(transfers, container, from, index, to);
+            ordered_nodes.erase(max_it);
+            ordered_nodes.erase(min_it);
+            ordered_nodes.insert({planned_loads[from], from});
+            ordered_nodes.insert({planned_loads[to], to});
+        }
+    }
+
+    void Hierarchical_Load_Balancer::balance_round() {
+        Load_Info_Container& container = typed_container<Load_Info_Container>();
+
+        size_t min_load;
+        size_t max_load;
+        size_t mean_load = 0, sum_load = 0;
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_AGGREGATION);
+            container.compute_load_and_pass(min_load, max_load, mean_load, sum_load);
+        }
+        begin_round();
+        load_imbalance_threshold = mean_load / load_imbalance_ratio;
+        load_imbalance_threshold_half = load_imbalance_threshold / 2;
+
+        if (max_load - min_load <= load_imbalance_threshold) {
+            end_round();
+            return;
+        }
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_SELECTION);
+            for (size_t node = 0; node < num_compute(); ++node) {
+                planned_loads[node] = container[node].load();
+            }
+            moved.assign(container.num_shards(), false);
+
+            plan_between_groups(container);
+
+            // groups only touch their own nodes, the shards of those nodes and their own transfers
+            size_t num_threads = std::min(num_planner_threads, num_groups);
+            if (num_threads <= 1) {
+                for (size_t group = 0; group < num_groups; ++group) {
+                    plan_group(container, group);
+                }
+            }
+            else {
+                std::vector<std::thread> planners;
+                planners.reserve(num_threads);
+                for (size_t t = 0; t < num_threads; ++t) {
+                    planners.emplace_back([this, &container, t, num_threads]() {
+                        for (size_t group = t; group < num_groups; group += num_threads) {
+                            plan_group(container, group);
+                        }
+                    });
+                }
+                for (std::thread& planner : planners) {
+                    planner.join();
+                }
+            }
+
+            for (const Owner_Ship_Transfer& transfer : inter_group_transfers) {
+                container.add_transfer(transfer.from, transfer.shard, transfer.to);
+            }
+            for (const std::vector<Owner_Ship_Transfer>& transfers : group_transfers) {
+                for (const Owner_Ship_Transfer& transfer : transfers) {
+                    container.add_transfer(transfer.from, transfer.shard, transfer.to);
+                }
+            }
+        }
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_APPLY);
+            set_up_new_plan();
+        }
+        end_round();
+    }
+
+    void Hierarchical_Load_Balancer::set_up_new_plan() {
+        typed_container<Load_Info_Container>().apply(*this);
+    }
+
+    Consistent_Hashing_Load_Balancer::Consistent_Hashing_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+            , size_t _rebalance_period_seconds, size_t __load_imbalance_ratio, size_t low_load_threshold
+            , size_t num_virtual_nodes, size_t _load_bound_percent)
+        : Load_Balancer(new Load_Info_Container(num_compute, num_shards_per_compute, low_load_threshold)
+            , _rebalance_period_seconds, __load_imbalance_ratio)
+            , load_bound_percent(_load_bound_percent), planned_loads(num_compute, 0), visited(num_compute, 0) {
+                assert(num_virtual_nodes > 0);
+                ring.reserve(num_compute * num_virtual_nodes);
+                for (size_t node = 0; node < num_compute; ++node) {
+                    for (size_t v = 0; v < num_virtual_nodes; ++v) {
+                        ring.push_back({hash(hash(node + (1ull << 63)) + v), node});
+                    }
+                }
+                std::sort(ring.begin(), ring.end());
+
+                // the shards start on their first node instead of the contiguous ranges of the other balancers
+                std::vector<size_t> owners(container->num_shards());
+                for (size_t shard = 0; shard < owners.size(); ++shard) {
+                    owners[shard] = home(shard);
+                }
+                typed_container<Load_Info_Container>().set_owners(owners);
+            }
+
+    Consistent_Hashing_Load_Balancer::~Consistent_Hashing_Load_Balancer() {}
+
+    size_t Consistent_Hashing_Load_Balancer::next_with_room(size_t shard, size_t owner, size_t load, size_t bound) {
+        ++visit;
+        visited[owner] = visit;
+        size_t pos = ring_position(shard);
+        for (size_t i = 0, num_visited = 1; i < ring.size() && num_visited < num_compute(); ++i, pos = (pos + 1 == ring.size() ? 0 : pos + 1)) {
+            size_t node = ring[pos].second;
+            if (visited[node] == visit) {
+                continue;
+            }
+            if (planned_loads[node] + load <= bound) {
+                return node;
+            }
+            visited[node] = visit;
+            ++num_visited;
+        }
+        return owner;
+    }
+
+    void Consistent_Hashing_Load_Balancer::balance_round() {
+        Load_Info_Container& container = typed_container<Load_Info_Container>();
+
+        size_t min_load;
+        size_t max_load;
+        size_t mean_load = 0, sum_load = 0;
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_AGGREGATION);
+            container.compute_load_and_pass(min_load, max_load, mean_load, sum_load);
+        }
+        begin_round();
+        load_imbalance_threshold = mean_load / load_imbalance_ratio;
+        load_imbalance_threshold_half = load_imbalance_threshold / 2;
+        size_t bound = mean_load + std::max<size_t>(mean_load * load_bound_percent / 100, 1);
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_SELECTION);
+            for (size_t node = 0; node < num_compute(); ++node) {
+                planned_loads[node] = container[node].load();
+            }
+            moved.assign(container.num_shards(), false);
+            num_planned = 0;
+
+            // the indices of the transfers are in the sorted order of the shards of each node
+            {
+                PHASE_TIMER(phase_stats, PHASE_SORT);
+                for (size_t node = 0; node < num_compute(); ++node) {
+                    container[node].ordered_iterator();
+                }
+            }
+
+            // shards away from their first node go back once it has room
+            for (size_t node = 0; node < num_compute(); ++node) {
+                Compute_Node_Info& cnode = container[node];
+                for (size_t i = cnode.num_shards(); i-- > 0;) {
+                    Shard_Info& shard = cnode[i];
+                    size_t to = home(shard.id());
+                    if (to != node && planned_loads[to] + shard.load() <= bound) {
+                        moved[shard.id()] = true;
+                        planned_loads[node] -= shard.load();
+                        planned_loads[to] += shard.load();
+                        container.add_transfer(node, i, to);
+                        ++num_planned;
+                    }
+                }
+            }
+
+            // the largest shards of the nodes above the bound go to the next node on the ring with room
+            for (size_t node = 0; node < num_compute(); ++node) {
+                Compute_Node_Info& cnode = container[node];
+                for (size_t i = cnode.num_shards(); i-- > 0 && planned_loads[node] > bound;) {
+                    Shard_Info& shard = cnode[i];
+                    if (container.is_insignificant(shard)) {
+                        break;
+                    }
+                    // planned loads only grow on the receivers, so no node has room for the shard in this case
+                    if (moved[shard.id()] || min_load + shard.load() > bound) {
+                        continue;
+                    }
+                    size_t to = next_with_room(shard.id(), node, shard.load(), bound);
+                    if (to != node) {
+                        moved[shard.id()] = true;
+                        planned_loads[node] -= shard.load();
+                        planned_loads[to] += shard.load();
+                        container.add_transfer(node, i, to);
+                        ++num_planned;
+                    }
+                }
+            }
+        }
+
+        if (num_planned == 0) {
+            end_round();
+            return;
+        }
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_APPLY);
+            set_up_new_plan();
+        }
+        end_round();
+    }
+
+    void Consistent_Hashing_Load_Balancer::set_up_new_plan() {
+        typed_container<Load_Info_Container>().apply(*this);
+    }
+
+    Pairwise_Load_Balancer::Pairwise_Load_Balancer(size_t num_compute, size_t num_shards_per_compute
+            , size_t _rebalance_period_seconds, size_t __load_imbalance_ratio, size_t low_load_threshold
+            , size_t _num_pairs, bool _weighted_choice, size_t _num_planner_threads, uint64_t seed)
+        : Load_Balancer(new Load_Info_Container(num_compute, num_shards_per_compute, low_load_threshold)
+            , _rebalance_period_seconds, __load_imbalance_ratio)
+            , num_pairs(_num_pairs == 0 ? num_compute / 2 : std::min(_num_pairs, num_compute / 2)), weighted_choice(_weighted_choice)
+            , num_planner_threads(_num_planner_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : _num_planner_threads)
+            , rng(seed), pair_transfers(num_pairs) {
+                assert(num_pairs > 0);
+                pool.reserve(num_compute);
+                pairs.reserve(num_pairs);
+            }
+
+    Pairwise_Load_Balancer::~Pairwise_Load_Balancer() {}
+
+    size_t Pairwise_Load_Balancer::draw(Load_Info_Container& container, size_t num_choices, bool heavier) {
+        assert(!pool.empty());
+        size_t best = rng.Uniform(pool.size());
+        for (size_t i = 1; i < num_choices; ++i) {
+            size_t other = rng.Uniform(pool.size());
+            if (heavier ? container[pool[other]].load() > container[pool[best]].load()
+                        : container[pool[other]].load() < container[pool[best]].load()) {
+                best = other;
+            }
+        }
+        size_t node = pool[best];
+        pool[best] = pool.back();
+        pool.pop_back();
+        return node;
+    }
+
+    void Pairwise_Load_Balancer::choose_pairs(Load_Info_Container& container) {
+        pool.clear();
+        for (size_t node = 0; node < num_compute(); ++node) {
+            pool.push_back(node);
+        }
+        pairs.clear();
+        size_t num_choices = weighted_choice ? 2 : 1;
+        while (pairs.size() < num_pairs && pool.size() >= 2) {
+            size_t from = draw(container, num_choices, true);
+            size_t to = draw(container, num_choices, false);
+            if (container[from].load() < container[to].load()) {
+                std::swap(from, to);
+            }
+            pairs.push_back({from, to});
+        }
+    }
+
+    void Pairwise_Load_Balancer::balance_pair(Load_Info_Container& container, size_t pair) {
+        std::vector<Owner_Ship_Transfer>& transfers = pair_transfers[pair];
+        transfers.clear();
+        size_t from = pairs[pair].first, to = pairs[pair].second;
+        size_t gap = container[from].load() - container[to].load();
+        if (gap <= load_imbalance_threshold) {
+            return;
+        }
+
+        // a shard of at most half of the gap never makes the lighter node the heavier one
+        Shard_Iterator& itr = container[from].ordered_iterator();
+        for (; itr.is_valid() && gap > load_imbalance_threshold; ++itr) {
+            Shard_Info* shard = itr.shard();
+            if (shard == nullptr || container.is_insignificant(*shard)) {
+                break;
+            }
+            if (shard->load() * 2 <= gap) {
+                transfers.push_back({from, to, itr.index()});
+                gap -= shard->load() * 2;
+            }
+        }
+    }
+
+    void Pairwise_Load_Balancer::balance_round() {
+        Load_Info_Container& container = typed_container<Load_Info_Container>();
+
+        size_t min_load;
+        size_t max_load;
+        size_t mean_load = 0, sum_load = 0;
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_AGGREGATION);
+            container.compute_load_and_pass(min_load, max_load, mean_load, sum_load);
+        }
+        begin_round();
+        load_imbalance_threshold = mean_load / load_imbalance_ratio;
+        load_imbalance_threshold_half = load_imbalance_threshold / 2;
+
+        if (max_load - min_load <= load_imbalance_threshold) {
+            end_round();
+            return;
+        }
+
+        size_t num_planned = 0;
+        {
+            PHASE_TIMER(phase_stats, PHASE_SELECTION);
+            choose_pairs(container);
+
+            // the pairs are disjoint, so each one only touches its own two nodes and its own transfers
+            size_t num_threads = std::min(num_planner_threads, pairs.size());
+            if (num_threads <= 1) {
+                for (size_t pair = 0; pair < pairs.size(); ++pair) {
+                    balance_pair(container, pair);
+                }
+            }
+            else {
+                std::vector<std::thread> planners;
+                planners.reserve(num_threads);
+                for (size_t t = 0; t < num_threads; ++t) {
+                    planners.emplace_back([this, &container, t, num_threads]() {
+                        for (size_t pair = t; pair < pairs.size(); pair += num_threads) {
+                            balance_pair(container, pair);
+                        }
+                    });
+                }
+                for (std::thread& planner : planners) {
+                    planner.join();
+                }
+            }
+
+            for (size_t pair = 0; pair < pairs.size(); ++pair) {
+                for (const Owner_Ship_Transfer& transfer : pair_transfers[pair]) {
+                    container.add_transfer(transfer.from, transfer.shard, transfer.to);
+                    ++num_planned;
+                }
+            }
+        }
+
+        if (num_planned == 0) {
+            end_round();
+            return;
+        }
+
+        {
+            PHASE_TIMER(phase_stats, PHASE_APPLY);
+            set_up_new_plan();
+        }
+        end_round();
+    }
 
+    void Pairwise_Load_Balancer::set_up_new_plan() {
+        typed_container<Load_Info_Container>().apply(*this);
     }
 
-}
\ No newline at end of file
+}
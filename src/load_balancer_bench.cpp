@@ -0,0 +1,979 @@
+#include "routing_table.h"
+#include "load_balancer.h"
+#include "warm_start.h"
+#include "random.h"
+#include "testlog.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Micro benchmarks of the load balancer components. Every benchmark is a subcommand:
+ * ./load_balancer_bench <benchmark> [OPTIONS]
+ */
+
+struct Bench_Input {
+    size_t num_shards = 4096; // --num_shards -ns
+    size_t num_compute = 64; // --num_compute -nc
+    vector<size_t> threads = {1, 2, 4, 8}; // --threads -t
+    size_t duration_ms = 1000; // --duration_ms -d
+    size_t publish_period_us = 1000; // --publish_period_us -pp 0 means the ownership never changes
+    size_t random_seed = 65406; // --random_seed -rs
+    vector<size_t> nodes = {256, 1024, 4096}; // --nodes -n numbers of compute nodes of the balancer benchmarks
+    size_t num_shard_per_compute = 8; // --num_shard_per_compute -nspc
+    size_t num_rounds = 10; // --num_rounds -nr
+    size_t group_size = 16; // --group_size -gs
+    size_t planner_threads = 0; // --planner_threads -pt 0 means one per core
+    size_t converged_percent = 110; // --converged_percent -cp a balancer converged once max/mean load is at most this percent
+    size_t load_imbalance_ratio = 10; // --load_imbalance_ratio -lir of the greedy benchmark
+    string checkpoint_path = "/tmp/load_balancer_bench.ckpt"; // --checkpoint -ckp file of the checkpoint benchmark
+    vector<size_t> periods = {50, 100, 250, 500, 1000, 2000, 5000}; // --periods -ps fixed rebalance periods in ms of the period benchmark
+    size_t sim_seconds = 600; // --sim_seconds -ss simulated time of every run of the period benchmark
+    size_t shift_seconds = 30; // --shift_seconds -shs mean simulated time between two hot set shifts of the period benchmark
+    vector<size_t> cooldowns = {0, 2, 4, 8, 16}; // --cooldowns -cds cooldown rounds of the damping benchmark. 0 means no damping
+    size_t hysteresis_percent = 50; // --hysteresis_percent -hyp of the damping benchmark
+    size_t noise_percent = 30; // --noise_percent -np per-round noise of the shard loads of the damping benchmark
+    size_t damping_rounds = 200; // --damping_rounds -dmr rounds of every run of the damping benchmark
+};
+
+Bench_Input input;
+
+struct Benchmark {
+    const char* name;
+    const char* description;
+    function<void()> run;
+};
+
+void run_routing();
+void run_hierarchical();
+void run_pairwise();
+void run_shard_memory();
+void run_restricted();
+void run_greedy();
+void run_increment();
+void run_checkpoint();
+void run_period();
+void run_damping();
+void run_locality();
+void run_warm_start();
+
+vector<Benchmark> benchmarks = {
+    {"routing", "key to owner lookups of the routing table against a shared_mutex protected map", run_routing},
+    {"hierarchical", "planning time and plan size of the fixed, hierarchical and consistent hashing load balancers(none divides shards) on large clusters", run_hierarchical},
+    {"pairwise", "convergence and planning time of the pairwise load balancer(power of two choices and random pairs) against the fixed one", run_pairwise},
+    {"shard_memory", "memory per shard and cycles per shard of the aggregation, sort and selection phases of the fixed load balancer", run_shard_memory},
+    {"restricted", "per-round apply time and node by key lookups of the dynamic restricted load balancer", run_restricted},
+    {"greedy", "per-round planning time of the fixed and dynamic load balancers by phase", run_greedy},
+    {"increment", "time of a load info increment with the round load counter observed and not", run_increment},
+    {"checkpoint", "round pause of writing a checkpoint every round and time to restore a balancer from it", run_checkpoint},
+    {"period", "time weighted imbalance and balancer time of fixed rebalance periods and the adaptive one over shifting hot sets", run_period},
+    {"damping", "transfers, ping-pongs and imbalance of the fixed load balancer over noisy loads with and without migration cooldowns", run_damping},
+    {"locality", "fragmentation, scan fan-out and imbalance of the fixed and dynamic load balancers with and without locality aware placement", run_locality},
+    {"warm_start", "time and node imbalance of warm start layouts over uniform, hot key and partly idle load profiles", run_warm_start},
+};
+
+void help() {
+    LOGF(stderr, "USAGE: ./load_balancer_bench <benchmark> [OPTIONS]\n\
+        \tbenchmarks:\n");
+    for (const Benchmark& bench : benchmarks) {
+        LOGF(stderr, "\t\t%s -> %s\n", bench.name, bench.description);
+    }
+    LOGF(stderr, "\tOPTIONS:\n\
+            \t\t--help, -h -> for printing this message\n\
+            \t\t--num_shards=<number>, -ns=<number> -> number of key ranges. default is 4096.\n\
+            \t\t--num_compute=<number>, -nc=<number> -> number of compute nodes. default is 64.\n\
+            \t\t--threads=<list>, -t=<list> -> numbers of reader threads. default is 1,2,4,8.\n\
+            \t\t--duration_ms=<number>, -d=<number> -> duration of every run. default is 1000.\n\
+            \t\t--publish_period_us=<number>, -pp=<number> -> time between two ownership changes. 0 means no changes. default is 1000.\n\
+            \t\t--random_seed=<number>, -rs=<number> -> default is 65406.\n\
+            \t\t--nodes=<list>, -n=<list> -> numbers of compute nodes of the balancer benchmarks. default is 256,1024,4096.\n\
+            \t\t--num_shard_per_compute=<number>, -nspc=<number> -> shards per compute node of the balancer benchmarks. default is 8.\n\
+            \t\t--num_rounds=<number>, -nr=<number> -> load balancing rounds per balancer. default is 10.\n\
+            \t\t--group_size=<number>, -gs=<number> -> compute nodes per group of the hierarchical load balancer. default is 16.\n\
+            \t\t--planner_threads=<number>, -pt=<number> -> group or pair planning threads of the hierarchical and pairwise load balancers. 0 means one per core. default is 0.\n\
+            \t\t--converged_percent=<number>, -cp=<number> -> a balancer converged in the first round with max/mean load of at most <number> percent. default is 110.\n\
+            \t\t--load_imbalance_ratio=<number>, -lir=<number> -> load imbalance ratio of the greedy benchmark. default is 10.\n\
+            \t\t--checkpoint=<path>, -ckp=<path> -> checkpoint file of the checkpoint benchmark. default is /tmp/load_balancer_bench.ckpt.\n\
+            \t\t--periods=<list>, -ps=<list> -> fixed rebalance periods in ms of the period benchmark. the adaptive one is bounded by the first and the last. default is 50,100,250,500,1000,2000,5000.\n\
+            \t\t--sim_seconds=<number>, -ss=<number> -> simulated time of every run of the period benchmark. default is 600.\n\
+            \t\t--shift_seconds=<number>, -shs=<number> -> mean simulated time between two hot set shifts of the period benchmark. default is 30.\n\
+            \t\t--cooldowns=<list>, -cds=<list> -> cooldown rounds of the damping benchmark. 0 means no damping. default is 0,2,4,8,16.\n\
+            \t\t--hysteresis_percent=<number>, -hyp=<number> -> hysteresis of the damping benchmark. default is 50.\n\
+            \t\t--noise_percent=<number>, -np=<number> -> shard loads of the damping benchmark vary by up to <number> percent every round. default is 30.\n\
+            \t\t--damping_rounds=<number>, -dmr=<number> -> rounds of every run of the damping benchmark. default is 200.\n\
+        \t<list>: is a comma separated list of values\n");
+}
+
+bool get_arg(const char* arg, const char* arg_name, size_t& res) {
+    size_t len = strlen(arg_name);
+    assert(len > 0 && arg_name[len - 1] == '=');
+
+    if (strncmp(arg, arg_name, len)) {
+        return false;
+    }
+    if (strlen(arg + len) == 0) {
+        throw invalid_argument("no number after argument " + string(arg_name, len - 1));
+    }
+    if (strspn(arg + len, "0123456789") != strlen(arg + len)) {
+        throw invalid_argument("invalid number " + string(arg + len) + " after argument " + string(arg_name, len - 1));
+    }
+    res = stoul(arg + len);
+    return true;
+}
+
+bool get_arg(const char* arg, const char* arg_name, string& res) {
+    size_t len = strlen(arg_name);
+    if (strncmp(arg, arg_name, len)) {
+        return false;
+    }
+    if (strlen(arg + len) == 0) {
+        throw invalid_argument("no value after argument " + string(arg_name, len - 1));
+    }
+    res = arg + len;
+    return true;
+}
+
+bool get_arg(const char* arg, const char* arg_name, vector<size_t>& res) {
+    size_t len = strlen(arg_name);
+    if (strncmp(arg, arg_name, len)) {
+        return false;
+    }
+    res.clear();
+    stringstream ss(arg + len);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (item.empty() || strspn(item.c_str(), "0123456789") != item.size()) {
+            throw invalid_argument("invalid number " + item + " after argument " + string(arg_name, len - 1));
+        }
+        res.push_back(stoul(item));
+    }
+    if (res.empty()) {
+        throw invalid_argument("empty list after argument " + string(arg_name, len - 1));
+    }
+    return true;
+}
+
+void parse_input(int argc, char** argv) {
+    try {
+        for (int i = 2; i < argc; ++i) {
+            if (get_arg(argv[i], "--num_shards=", input.num_shards) || get_arg(argv[i], "-ns=", input.num_shards)) {}
+            else if (get_arg(argv[i], "--num_compute=", input.num_compute) || get_arg(argv[i], "-nc=", input.num_compute)) {}
+            else if (get_arg(argv[i], "--threads=", input.threads) || get_arg(argv[i], "-t=", input.threads)) {}
+            else if (get_arg(argv[i], "--duration_ms=", input.duration_ms) || get_arg(argv[i], "-d=", input.duration_ms)) {}
+            else if (get_arg(argv[i], "--publish_period_us=", input.publish_period_us)
+                || get_arg(argv[i], "-pp=", input.publish_period_us)) {}
+            else if (get_arg(argv[i], "--random_seed=", input.random_seed) || get_arg(argv[i], "-rs=", input.random_seed)) {}
+            else if (get_arg(argv[i], "--nodes=", input.nodes) || get_arg(argv[i], "-n=", input.nodes)) {}
+            else if (get_arg(argv[i], "--num_shard_per_compute=", input.num_shard_per_compute)
+                || get_arg(argv[i], "-nspc=", input.num_shard_per_compute)) {}
+            else if (get_arg(argv[i], "--num_rounds=", input.num_rounds) || get_arg(argv[i], "-nr=", input.num_rounds)) {}
+            else if (get_arg(argv[i], "--group_size=", input.group_size) || get_arg(argv[i], "-gs=", input.group_size)) {}
+            else if (get_arg(argv[i], "--planner_threads=", input.planner_threads) || get_arg(argv[i], "-pt=", input.planner_threads)) {}
+            else if (get_arg(argv[i], "--converged_percent=", input.converged_percent)
+                || get_arg(argv[i], "-cp=", input.converged_percent)) {}
+            else if (get_arg(argv[i], "--load_imbalance_ratio=", input.load_imbalance_ratio)
+                || get_arg(argv[i], "-lir=", input.load_imbalance_ratio)) {}
+            else if (get_arg(argv[i], "--checkpoint=", input.checkpoint_path) || get_arg(argv[i], "-ckp=", input.checkpoint_path)) {}
+            else if (get_arg(argv[i], "--periods=", input.periods) || get_arg(argv[i], "-ps=", input.periods)) {}
+            else if (get_arg(argv[i], "--sim_seconds=", input.sim_seconds) || get_arg(argv[i], "-ss=", input.sim_seconds)) {}
+            else if (get_arg(argv[i], "--shift_seconds=", input.shift_seconds) || get_arg(argv[i], "-shs=", input.shift_seconds)) {}
+            else if (get_arg(argv[i], "--cooldowns=", input.cooldowns) || get_arg(argv[i], "-cds=", input.cooldowns)) {}
+            else if (get_arg(argv[i], "--hysteresis_percent=", input.hysteresis_percent) || get_arg(argv[i], "-hyp=", input.hysteresis_percent)) {}
+            else if (get_arg(argv[i], "--noise_percent=", input.noise_percent) || get_arg(argv[i], "-np=", input.noise_percent)) {}
+            else if (get_arg(argv[i], "--damping_rounds=", input.damping_rounds) || get_arg(argv[i], "-dmr=", input.damping_rounds)) {}
+            else {
+                throw invalid_argument("Unknown argument: " + string(argv[i]));
+            }
+        }
+        if (input.num_shards == 0 || input.num_compute == 0) {
+            throw invalid_argument("num_shards and num_compute cannot be 0");
+        }
+        if (input.num_shard_per_compute == 0 || input.num_rounds == 0 || input.group_size == 0 || input.load_imbalance_ratio == 0) {
+            throw invalid_argument("num_shard_per_compute, num_rounds, group_size and load_imbalance_ratio cannot be 0");
+        }
+        if (input.sim_seconds == 0 || input.shift_seconds == 0) {
+            throw invalid_argument("sim_seconds and shift_seconds cannot be 0");
+        }
+        if (input.noise_percent > 100 || input.damping_rounds == 0) {
+            throw invalid_argument("noise_percent should be at most 100 and damping_rounds cannot be 0");
+        }
+        for (size_t period : input.periods) {
+            if (period == 0) {
+                throw invalid_argument("periods cannot be 0");
+            }
+        }
+        for (size_t num_compute : input.nodes) {
+            if (num_compute < 2) {
+                throw invalid_argument("nodes should be at least 2");
+            }
+        }
+    } catch(exception& a) {
+        LOGFC(COLOR_RED, stderr, "%s\n", a.what());
+        help();
+        exit(1);
+    }
+}
+
+// runs num_threads readers for duration_ms next to a writer changing the ownership and returns the total lookups
+size_t run_readers(size_t num_threads, const function<size_t(size_t, const atomic<bool>&)>& reader, const function<void()>& writer) {
+    atomic<bool> stop(false);
+    vector<size_t> lookups(num_threads, 0);
+    vector<thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&, i]() { lookups[i] = reader(i, stop); });
+    }
+    thread writer_thread([&]() {
+        while (!stop.load(memory_order_relaxed)) {
+            if (input.publish_period_us == 0) {
+                usleep(1000);
+                continue;
+            }
+            usleep(input.publish_period_us);
+            writer();
+        }
+    });
+
+    usleep(input.duration_ms * 1000);
+    stop.store(true);
+    for (thread& t : threads) {
+        t.join();
+    }
+    writer_thread.join();
+
+    size_t total = 0;
+    for (size_t num : lookups) {
+        total += num;
+    }
+    return total;
+}
+
+void print_result(const char* structure, size_t num_threads, size_t lookups) {
+    double mops = lookups / (input.duration_ms * 1000.0);
+    LOGF(stdout, "%s,%lu,%lu,%.2f,%.2f\n", structure, num_threads, lookups, mops, mops / num_threads);
+}
+
+void run_routing() {
+    const size_t key_range = input.num_shards * 1024;
+    TimberSaw::Random64 owner_gen(input.random_seed);
+
+    TimberSaw::Routing_Table table;
+    auto publish = [&]() {
+        TimberSaw::Routing_Snapshot* snapshot = table.begin_update();
+        for (size_t shard = 0; shard < input.num_shards; ++shard) {
+            snapshot->add_range((shard + 1) * 1024, shard, owner_gen.Next() % input.num_compute);
+        }
+        table.publish(snapshot);
+    };
+    publish();
+
+    // the structure used by load_vector and the container
+    shared_mutex mtx;
+    map<size_t, size_t> ub_to_index;
+    vector<size_t> owners(input.num_shards);
+    for (size_t shard = 0; shard < input.num_shards; ++shard) {
+        ub_to_index[(shard + 1) * 1024] = shard;
+        owners[shard] = owner_gen.Next() % input.num_compute;
+    }
+
+    LOGF(stdout, "structure,threads,lookups,mops,mops_per_thread\n");
+    for (size_t num_threads : input.threads) {
+        size_t lookups = run_readers(num_threads, [&](size_t id, const atomic<bool>& stop) {
+            TimberSaw::Routing_Table::Reader reader(table);
+            TimberSaw::Random64 key_gen(input.random_seed + id);
+            size_t num = 0, owner, shard, sum = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                for (size_t i = 0; i < 256; ++i, ++num) {
+                    reader.lookup(key_gen.Next() % key_range, owner, shard);
+                    sum += owner;
+                }
+            }
+            asm volatile("" : : "r"(sum));
+            return num;
+        }, publish);
+        print_result("routing_table", num_threads, lookups);
+
+        lookups = run_readers(num_threads, [&](size_t id, const atomic<bool>& stop) {
+            TimberSaw::Random64 key_gen(input.random_seed + id);
+            size_t num = 0, sum = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                for (size_t i = 0; i < 256; ++i, ++num) {
+                    size_t key = key_gen.Next() % key_range;
+                    shared_lock<shared_mutex> lock(mtx);
+                    sum += owners[ub_to_index.upper_bound(key)->second];
+                }
+            }
+            asm volatile("" : : "r"(sum));
+            return num;
+        }, [&]() {
+            unique_lock<shared_mutex> lock(mtx);
+            for (size_t shard = 0; shard < input.num_shards; ++shard) {
+                owners[shard] = owner_gen.Next() % input.num_compute;
+            }
+        });
+        print_result("locked_map", num_threads, lookups);
+    }
+}
+
+// counts the transfers of the plans crossing the groups of group_size consecutive nodes
+class Transfer_Counter : public TimberSaw::Plan_Sink {
+public:
+    explicit Transfer_Counter(size_t _group_size) : group_size(_group_size) {}
+
+    void transfer(const TimberSaw::Owner_Ship_Transfer& transfer) override {
+        ++num_transfers;
+        num_cross_group += transfer.from / group_size != transfer.to / group_size;
+    }
+
+    size_t group_size;
+    size_t num_transfers = 0;
+    size_t num_cross_group = 0;
+};
+
+// feeds the same skewed shard loads before every round, runs num_rounds rounds directly and prints one row.
+// converged_round is the first round seeing a max/mean load of at most converged_percent, or -1
+template <typename Balancer>
+void run_balancer(Balancer& lb, const char* name, size_t num_compute, FILE* out) {
+    const size_t shard_size = 1024;
+    load_vector loads(0, lb.num_shards() * shard_size, lb, 1, 1, 1, 1, 1);
+    lb.set_vector(loads);
+    Transfer_Counter counter(input.group_size);
+    lb.add_plan_sink(&counter);
+
+    // every 16th shard on average is hot
+    TimberSaw::Random64 load_gen(input.random_seed);
+    vector<size_t> shard_loads;
+    double first_ratio = 0, last_ratio = 0;
+    long converged_round = -1;
+    size_t moved_load = 0;
+    uint64_t plan_ns = 0;
+    for (size_t round = 0; round < input.num_rounds; ++round) {
+        while (shard_loads.size() < lb.num_shards()) {
+            shard_loads.push_back(100 + load_gen.Next() % 100 + (load_gen.Next() % 16 == 0 ? 1000 : 0));
+        }
+        for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+            lb.increment_load_info(shard, shard_loads[shard]);
+        }
+
+        auto start = chrono::steady_clock::now();
+        lb.balance_round();
+        plan_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+        TimberSaw::Round_Metrics metrics;
+        while (lb.pop_round_metrics(metrics)) {
+            if (round == 0) {
+                first_ratio = metrics.max_mean_ratio;
+            }
+            last_ratio = metrics.max_mean_ratio;
+            if (converged_round == -1 && metrics.max_mean_ratio * 100 <= input.converged_percent) {
+                converged_round = metrics.round;
+            }
+            moved_load += metrics.moved_load;
+        }
+    }
+
+    LOGF(out, "%s,%lu,%lu,%.1f,%lu,%lu,%lu,%.3f,%.3f,%ld\n", name, num_compute, lb.num_shards()
+        , plan_ns / 1000.0 / input.num_rounds, counter.num_transfers, counter.num_cross_group, moved_load, first_ratio, last_ratio
+        , converged_round);
+    fflush(out);
+}
+
+// the balancers print their plans to stdout, so the results go to a copy of it
+FILE* redirect_stdout() {
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    fflush(stdout);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    return out;
+}
+
+FILE* balancer_output() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "balancer,num_compute,num_shards,round_us,transfers,cross_group_transfers,moved_load,first_max_mean_ratio"
+        ",last_max_mean_ratio,converged_round\n");
+    return out;
+}
+
+void run_hierarchical() {
+    FILE* out = balancer_output();
+    for (size_t num_compute : input.nodes) {
+        {
+            TimberSaw::Fixed_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0);
+            run_balancer(lb, "fixed", num_compute, out);
+        }
+        {
+            TimberSaw::Hierarchical_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0
+                , input.group_size, input.planner_threads);
+            run_balancer(lb, "hierarchical", num_compute, out);
+        }
+        {
+            TimberSaw::Consistent_Hashing_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0, 64, 25);
+            run_balancer(lb, "consistent_hashing", num_compute, out);
+        }
+    }
+    fclose(out);
+}
+
+void run_pairwise() {
+    FILE* out = balancer_output();
+    for (size_t num_compute : input.nodes) {
+        {
+            TimberSaw::Fixed_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0);
+            run_balancer(lb, "fixed", num_compute, out);
+        }
+        {
+            TimberSaw::Pairwise_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0
+                , 0, true, input.planner_threads, input.random_seed);
+            run_balancer(lb, "pairwise_two_choices", num_compute, out);
+        }
+        {
+            TimberSaw::Pairwise_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0
+                , 0, false, input.planner_threads, input.random_seed);
+            run_balancer(lb, "pairwise_random", num_compute, out);
+        }
+    }
+    fclose(out);
+}
+
+void run_shard_memory() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "num_compute,num_shards,bytes_per_shard,aggregation_cycles_per_shard,sort_cycles_per_shard,selection_cycles_per_shard\n");
+    for (size_t num_compute : input.nodes) {
+        TimberSaw::Fixed_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0);
+        load_vector loads(0, lb.num_shards() * 1024, lb, 1, 1, 1, 1, 1);
+        lb.set_vector(loads);
+
+        TimberSaw::Random64 load_gen(input.random_seed);
+        uint64_t cycles[TimberSaw::NUM_PHASES] = {};
+        for (size_t round = 0; round < input.num_rounds; ++round) {
+            for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+                lb.increment_load_info(shard, 100 + load_gen.Next() % 100 + (load_gen.Next() % 16 == 0 ? 1000 : 0));
+            }
+            lb.balance_round();
+            TimberSaw::Round_Metrics metrics;
+            while (lb.pop_round_metrics(metrics)) {
+                for (size_t phase = 0; phase < TimberSaw::NUM_PHASES; ++phase) {
+                    cycles[phase] += metrics.phase_cycles[phase];
+                }
+            }
+        }
+
+        double per_shard = 1.0 / (lb.num_shards() * input.num_rounds);
+        LOGF(out, "%lu,%lu,%.1f,%.2f,%.2f,%.2f\n", num_compute, lb.num_shards(), double(lb.shard_metadata_bytes()) / lb.num_shards()
+            , cycles[TimberSaw::PHASE_AGGREGATION] * per_shard, cycles[TimberSaw::PHASE_SORT] * per_shard
+            , cycles[TimberSaw::PHASE_SELECTION] * per_shard);
+        fflush(out);
+    }
+    fclose(out);
+}
+
+void run_restricted() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "num_compute,num_shards,transfers,apply_cycles_per_round,last_apply_cycles,aggregation_cycles_per_round"
+        ",node_of_key_ns\n");
+    for (size_t num_compute : input.nodes) {
+        TimberSaw::Dynamic_Restricted_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0);
+        size_t num_keys = lb.num_shards() * 1024;
+        load_vector loads(0, num_keys, lb, 1, 1, 1, 1, 1);
+        lb.set_vector(loads);
+        Transfer_Counter counter(input.group_size);
+        lb.add_plan_sink(&counter);
+
+        // the same loads every round, so the later rounds only move a few boundaries
+        TimberSaw::Random64 load_gen(input.random_seed);
+        vector<size_t> shard_loads;
+        uint64_t cycles[TimberSaw::NUM_PHASES] = {};
+        uint64_t last_apply_cycles = 0;
+        for (size_t round = 0; round < input.num_rounds; ++round) {
+            while (shard_loads.size() < lb.num_shards()) {
+                shard_loads.push_back(100 + load_gen.Next() % 100 + (load_gen.Next() % 16 == 0 ? 1000 : 0));
+            }
+            for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+                lb.increment_load_info(shard, shard_loads[shard]);
+            }
+            lb.balance_round();
+            TimberSaw::Round_Metrics metrics;
+            while (lb.pop_round_metrics(metrics)) {
+                for (size_t phase = 0; phase < TimberSaw::NUM_PHASES; ++phase) {
+                    cycles[phase] += metrics.phase_cycles[phase];
+                }
+                last_apply_cycles = metrics.phase_cycles[TimberSaw::PHASE_APPLY];
+            }
+        }
+
+        // checks the lookups against the routes of the load vector
+        TimberSaw::Routing_Snapshot routes;
+        loads.fill_routes(routes);
+        const size_t num_lookups = 1000000;
+        vector<size_t> keys(num_lookups);
+        for (size_t& key : keys) {
+            key = load_gen.Next() % num_keys;
+        }
+        volatile size_t owner;
+        auto start = chrono::steady_clock::now();
+        for (size_t key : keys) {
+            owner = lb.node_of_key(key);
+        }
+        (void)owner;
+        double lookup_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()
+            / double(num_lookups);
+        for (size_t i = 0; i < 1000; ++i) {
+            if (lb.node_of_key(keys[i]) != routes.owners[routes.index(keys[i])]) {
+                throw logic_error("node_of_key does not match the routes of the load vector");
+            }
+        }
+
+        LOGF(out, "%lu,%lu,%lu,%lu,%lu,%lu,%.1f\n", num_compute, lb.num_shards(), counter.num_transfers
+            , cycles[TimberSaw::PHASE_APPLY] / input.num_rounds, last_apply_cycles
+            , cycles[TimberSaw::PHASE_AGGREGATION] / input.num_rounds, lookup_ns);
+        fflush(out);
+    }
+    fclose(out);
+}
+
+// the same skewed loads every round like run_balancer, so the dynamic balancer stops dividing once converged
+template <typename Balancer>
+void run_greedy_balancer(const char* name, size_t num_compute, FILE* out) {
+    Balancer lb(num_compute, input.num_shard_per_compute, 1, input.load_imbalance_ratio, 0);
+    load_vector loads(0, lb.num_shards() * 1024, lb, 1, 1, 1, 1, 1);
+    lb.set_vector(loads);
+
+    TimberSaw::Random64 load_gen(input.random_seed);
+    vector<size_t> shard_loads;
+    uint64_t cycles[TimberSaw::NUM_PHASES] = {};
+    uint64_t plan_ns = 0;
+    for (size_t round = 0; round < input.num_rounds; ++round) {
+        while (shard_loads.size() < lb.num_shards()) {
+            shard_loads.push_back(100 + load_gen.Next() % 100 + (load_gen.Next() % 16 == 0 ? 1000 : 0));
+        }
+        for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+            lb.increment_load_info(shard, shard_loads[shard]);
+        }
+        auto start = chrono::steady_clock::now();
+        lb.balance_round();
+        plan_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        TimberSaw::Round_Metrics metrics;
+        while (lb.pop_round_metrics(metrics)) {
+            for (size_t phase = 0; phase < TimberSaw::NUM_PHASES; ++phase) {
+                cycles[phase] += metrics.phase_cycles[phase];
+            }
+        }
+    }
+
+    LOGF(out, "%s,%lu,%lu,%.1f,%lu,%lu,%lu,%lu\n", name, num_compute, lb.num_shards(), plan_ns / 1000.0 / input.num_rounds
+        , cycles[TimberSaw::PHASE_SELECTION] / input.num_rounds, cycles[TimberSaw::PHASE_SORT] / input.num_rounds
+        , cycles[TimberSaw::PHASE_SPLIT] / input.num_rounds, cycles[TimberSaw::PHASE_APPLY] / input.num_rounds);
+    fflush(out);
+}
+
+void run_greedy() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "balancer,num_compute,num_shards,round_us,selection_cycles_per_round,sort_cycles_per_round"
+        ",split_cycles_per_round,apply_cycles_per_round\n");
+    for (size_t num_compute : input.nodes) {
+        run_greedy_balancer<TimberSaw::Fixed_Load_Balancer>("fixed", num_compute, out);
+        run_greedy_balancer<TimberSaw::Dynamic_Load_Balancer>("dynamic", num_compute, out);
+    }
+    fclose(out);
+}
+
+void run_increment() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "observed,num_shards,increment_ns\n");
+    const size_t num_increments = 10000000;
+    for (uint32_t features : {0u, uint32_t(TimberSaw::OBSERVE_ROUND_LOAD)}) {
+        // the container picks its increment variant when it is created
+        TimberSaw::set_observed_features(features);
+        size_t num_shard_per_compute = input.num_shards < input.num_compute ? 1 : input.num_shards / input.num_compute;
+        TimberSaw::Fixed_Load_Balancer lb(input.num_compute, num_shard_per_compute, 1, 100, 0);
+        TimberSaw::Random64 shard_gen(input.random_seed);
+        vector<size_t> shards(4096);
+        for (size_t& shard : shards) {
+            shard = shard_gen.Next() % lb.num_shards();
+        }
+
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < num_increments; ++i) {
+            lb.increment_load_info(shards[i % shards.size()], 1);
+        }
+        double increment_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()
+            / double(num_increments);
+
+        char names[256] = {};
+        TimberSaw::print_observed_features(names, features);
+        LOGF(out, "%s,%lu,%.2f\n", names, lb.num_shards(), increment_ns);
+        fflush(out);
+    }
+    fclose(out);
+}
+
+void run_checkpoint() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "num_compute,num_shards,checkpoint_cycles_per_round,restore_ms\n");
+    for (size_t num_compute : input.nodes) {
+        size_t num_keys = num_compute * input.num_shard_per_compute * 1024;
+        vector<size_t> owners;
+        uint64_t checkpoint_cycles = 0;
+        {
+            TimberSaw::Checkpoint_Writer writer(input.checkpoint_path);
+            TimberSaw::Fixed_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0);
+            load_vector loads(0, num_keys, lb, 1, 1, 1, 1, 1);
+            lb.set_vector(loads);
+            lb.set_checkpoint(&writer, 1);
+
+            TimberSaw::Random64 load_gen(input.random_seed);
+            for (size_t round = 0; round < input.num_rounds; ++round) {
+                for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+                    lb.increment_load_info(shard, 100 + load_gen.Next() % 100 + (load_gen.Next() % 16 == 0 ? 1000 : 0));
+                }
+                lb.balance_round();
+                TimberSaw::Round_Metrics metrics;
+                while (lb.pop_round_metrics(metrics)) {
+                    checkpoint_cycles += metrics.phase_cycles[TimberSaw::PHASE_CHECKPOINT];
+                }
+            }
+            for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+                owners.push_back(lb.shard_owner(shard));
+            }
+        } // the writer finishes the last checkpoint
+
+        // the restored balancer should own the shards like the one writing the checkpoint
+        TimberSaw::Fixed_Load_Balancer lb(num_compute, input.num_shard_per_compute, 1, 100, 0);
+        load_vector loads(0, num_keys, lb, 1, 1, 1, 1, 1);
+        lb.set_vector(loads);
+        auto start = chrono::steady_clock::now();
+        {
+            TimberSaw::Checkpoint_Reader checkpoint(input.checkpoint_path);
+            lb.restore(checkpoint);
+        }
+        double restore_ms = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1000.0;
+        for (size_t shard = 0; shard < owners.size(); ++shard) {
+            if (lb.shard_owner(shard) != owners[shard]) {
+                throw logic_error("the restored owners do not match the checkpoint");
+            }
+        }
+
+        LOGF(out, "%lu,%lu,%lu,%.3f\n", num_compute, lb.num_shards(), checkpoint_cycles / input.num_rounds, restore_ms);
+        fflush(out);
+    }
+    unlink(input.checkpoint_path.c_str());
+    fclose(out);
+}
+
+// runs the fixed balancer over sim_seconds of simulated time. every shard has a base rate and a changing 1/16 of
+// them is hot. the hot set moves after a random time of about shift_seconds. the loads of the simulated time
+// between two rounds are added right before the round, and the imbalance of the rates of the nodes is weighted by
+// the time it lasts. controller is null for a fixed period
+void run_period_balancer(size_t period_ms, TimberSaw::Period_Controller* controller, FILE* out) {
+    TimberSaw::Fixed_Load_Balancer lb(input.num_compute, input.num_shard_per_compute, 1, input.load_imbalance_ratio, 0);
+    load_vector loads(0, lb.num_shards() * 1024, lb, 1, 1, 1, 1, 1);
+    lb.set_vector(loads);
+    if (controller != nullptr) {
+        lb.set_period_controller(controller);
+    }
+
+    TimberSaw::Random64 gen(input.random_seed);
+    vector<size_t> rates(lb.num_shards()), pending(lb.num_shards(), 0), node_rates(input.num_compute);
+    auto shift = [&]() {
+        for (size_t& rate : rates) {
+            rate = 100 + (gen.Next() % 16 == 0 ? 1000 : 0);
+        }
+    };
+    auto max_mean_ratio = [&]() {
+        fill(node_rates.begin(), node_rates.end(), 0);
+        size_t sum = 0;
+        for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+            node_rates[lb.shard_owner(shard)] += rates[shard];
+            sum += rates[shard];
+        }
+        return *max_element(node_rates.begin(), node_rates.end()) * double(input.num_compute) / sum;
+    };
+    shift();
+
+    const size_t end_ms = input.sim_seconds * 1000;
+    size_t now = 0, next_shift = (input.shift_seconds * 500) + gen.Next() % (input.shift_seconds * 1000);
+    size_t next_round = (controller != nullptr ? controller->period_ms() : period_ms);
+    size_t num_rounds = 0;
+    uint64_t balancer_ns = 0;
+    double ratio = max_mean_ratio(), weighted_ratio = 0;
+    while (now < end_ms) {
+        size_t next = min({next_round, next_shift, end_ms});
+        for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+            pending[shard] += rates[shard] * (next - now);
+        }
+        weighted_ratio += ratio * (next - now);
+        now = next;
+
+        if (now == next_shift) {
+            shift();
+            next_shift = now + (input.shift_seconds * 500) + gen.Next() % (input.shift_seconds * 1000);
+        }
+        if (now == next_round) {
+            for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+                lb.increment_load_info(shard, pending[shard]);
+                pending[shard] = 0;
+            }
+            auto start = chrono::steady_clock::now();
+            lb.run_round();
+            balancer_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            ++num_rounds;
+            next_round = now + (controller != nullptr ? controller->period_ms() : period_ms);
+            TimberSaw::Round_Metrics metrics;
+            while (lb.pop_round_metrics(metrics)) {}
+        }
+        ratio = max_mean_ratio();
+    }
+
+    LOGF(out, "%s,%lu,%lu,%.3f,%lu,%.4f\n", controller != nullptr ? "adaptive" : "fixed", period_ms, num_rounds
+        , balancer_ns / 1e6, num_rounds == 0 ? 0 : end_ms / num_rounds, weighted_ratio / end_ms);
+    fflush(out);
+}
+
+void run_period() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "policy,period_ms,rounds,balancer_ms,mean_period_ms,time_weighted_max_mean_ratio\n");
+    for (size_t period_ms : input.periods) {
+        run_period_balancer(period_ms, nullptr, out);
+    }
+    size_t min_ms = *min_element(input.periods.begin(), input.periods.end());
+    size_t max_ms = *max_element(input.periods.begin(), input.periods.end());
+    TimberSaw::Period_Controller controller(min_ms, max_ms, 1);
+    run_period_balancer(0, &controller, out);
+    fclose(out);
+}
+
+// runs the fixed balancer for damping_rounds rounds. every shard has a fixed mean load, 1/16 of them a hot one,
+// and every round adds it plus or minus up to noise_percent. the rounds before the first sample let the layout settle,
+// so the moves counted after them are mostly the noise
+void run_damping_balancer(size_t cooldown_rounds, FILE* out) {
+    TimberSaw::Fixed_Load_Balancer lb(input.num_compute, input.num_shard_per_compute, 1, input.load_imbalance_ratio, 0);
+    load_vector loads(0, lb.num_shards() * 1024, lb, 1, 1, 1, 1, 1);
+    lb.set_vector(loads);
+    lb.set_migration_damping(cooldown_rounds, input.hysteresis_percent);
+
+    TimberSaw::Random64 gen(input.random_seed);
+    vector<size_t> means(lb.num_shards());
+    for (size_t& mean : means) {
+        mean = 10000 + (gen.Next() % 16 == 0 ? 100000 : 0);
+    }
+
+    const size_t warmup_rounds = 10;
+    size_t num_rounds = 0, num_transfers = 0, num_ping_pongs = 0, num_held_back = 0;
+    uint64_t moved_load = 0, sum_load = 0, balancer_ns = 0;
+    double sum_ratio = 0;
+    for (size_t round = 0; round < warmup_rounds + input.damping_rounds; ++round) {
+        for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+            size_t spread = means[shard] * input.noise_percent / 100;
+            lb.increment_load_info(shard, means[shard] - spread + gen.Next() % (2 * spread + 1));
+        }
+        auto start = chrono::steady_clock::now();
+        lb.run_round();
+        uint64_t round_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+        TimberSaw::Round_Metrics metrics;
+        while (lb.pop_round_metrics(metrics)) {
+            if (round < warmup_rounds) {
+                continue;
+            }
+            ++num_rounds;
+            num_transfers += metrics.num_transfers;
+            num_ping_pongs += metrics.num_ping_pongs;
+            num_held_back += metrics.num_held_back;
+            moved_load += metrics.moved_load;
+            sum_load += metrics.mean_load * metrics.num_compute;
+            sum_ratio += metrics.max_mean_ratio;
+        }
+        if (round >= warmup_rounds) {
+            balancer_ns += round_ns;
+        }
+    }
+
+    LOGF(out, "%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f,%.3f\n", cooldown_rounds, input.hysteresis_percent, num_rounds, num_transfers
+        , num_ping_pongs, num_held_back, sum_load == 0 ? 0 : double(moved_load) / sum_load, num_rounds == 0 ? 0 : sum_ratio / num_rounds
+        , balancer_ns / 1e6);
+    fflush(out);
+}
+
+void run_damping() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "cooldown_rounds,hysteresis_percent,rounds,transfers,ping_pongs,held_back,moved_fraction,mean_max_mean_ratio,balancer_ms\n");
+    for (size_t cooldown_rounds : input.cooldowns) {
+        run_damping_balancer(cooldown_rounds, out);
+    }
+    fclose(out);
+}
+
+// runs the balancer for num_rounds rounds over a hot set of 1/16 of the shards that moves every 10 rounds, and
+// reports the key ranges(runs) of the nodes after the last round and the nodes a scan of 16 key adjacent shards
+// visits, counting a node again when the scan comes back to it
+template <typename Balancer>
+void run_locality_balancer(const char* name, bool locality_aware, FILE* out) {
+    Balancer lb(input.num_compute, input.num_shard_per_compute, 1, input.load_imbalance_ratio, 0);
+    load_vector loads(0, lb.num_shards() * 1024, lb, 1, 1, 1, 1, 1);
+    lb.set_vector(loads);
+    lb.set_locality_aware(locality_aware);
+
+    const size_t shift_rounds = 10, scan_shards = 16;
+    TimberSaw::Random64 gen(input.random_seed);
+    vector<char> hot;
+    size_t num_transfers = 0, num_runs = 0, max_node_runs = 0;
+    uint64_t balancer_ns = 0;
+    double sum_ratio = 0;
+    for (size_t round = 0; round < input.num_rounds; ++round) {
+        if (round % shift_rounds == 0) {
+            hot.clear();
+        }
+        while (hot.size() < lb.num_shards()) {
+            hot.push_back(gen.Next() % 16 == 0);
+        }
+        for (size_t shard = 0; shard < lb.num_shards(); ++shard) {
+            lb.increment_load_info(shard, 100 + gen.Next() % 100 + (hot[shard] ? 1000 : 0));
+        }
+        auto start = chrono::steady_clock::now();
+        lb.balance_round();
+        balancer_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        TimberSaw::Round_Metrics metrics;
+        while (lb.pop_round_metrics(metrics)) {
+            num_transfers += metrics.num_transfers;
+            sum_ratio += metrics.max_mean_ratio;
+            num_runs = metrics.num_runs;
+            max_node_runs = metrics.max_node_runs;
+        }
+    }
+
+    // the ids follow the key order, as the shards are renumbered after every round dividing shards
+    size_t num_shards = lb.num_shards(), owner_changes = 0, window_changes = 0;
+    for (size_t shard = 1; shard < num_shards; ++shard) {
+        window_changes += (lb.shard_owner(shard) != lb.shard_owner(shard - 1));
+        if (shard >= scan_shards) {
+            window_changes -= (lb.shard_owner(shard - scan_shards + 1) != lb.shard_owner(shard - scan_shards));
+        }
+        if (shard + 1 >= scan_shards) {
+            owner_changes += window_changes;
+        }
+    }
+    size_t num_scans = num_shards + 1 > scan_shards ? num_shards + 1 - scan_shards : 1;
+
+    LOGF(out, "%s,%d,%lu,%lu,%lu,%.4f,%lu,%lu,%.3f,%.1f\n", name, locality_aware, input.num_compute, num_shards, num_transfers
+        , sum_ratio / input.num_rounds, num_runs, max_node_runs, 1 + double(owner_changes) / num_scans
+        , balancer_ns / 1000.0 / input.num_rounds);
+    fflush(out);
+}
+
+void run_locality() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "balancer,locality_aware,num_compute,num_shards,transfers,mean_max_mean_ratio,num_runs,max_node_runs,nodes_per_scan,round_us\n");
+    for (bool locality_aware : {false, true}) {
+        run_locality_balancer<TimberSaw::Fixed_Load_Balancer>("fixed", locality_aware, out);
+        run_locality_balancer<TimberSaw::Dynamic_Load_Balancer>("dynamic", locality_aware, out);
+    }
+    fclose(out);
+}
+
+// lays out a profile on num_compute nodes and checks that every node owns a non empty consecutive range of shards
+// of at least min_shard_size keys covering [key_lb, key_ub), which restore requires
+void run_warm_start_layout(const char* name, const TimberSaw::Key_Load_Histogram& histogram, size_t key_lb, size_t key_ub
+    , size_t num_compute, size_t num_shards, size_t min_shard_size, FILE* out) {
+    vector<TimberSaw::Checkpoint_Shard> records;
+    auto start = chrono::steady_clock::now();
+    histogram.layout(key_lb, key_ub, num_compute, num_shards, min_shard_size, records);
+    double layout_us = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() / 1000.0;
+
+    vector<size_t> node_shards(num_compute, 0);
+    vector<long double> node_loads(num_compute, 0);
+    size_t bucket = 0;
+    for (size_t shard = 0; shard < num_shards; ++shard) {
+        const TimberSaw::Checkpoint_Shard& record = records[shard];
+        if (record.lb != (shard == 0 ? key_lb : records[shard - 1].ub) || record.ub - record.lb < min_shard_size
+            || record.owner >= num_compute || (shard > 0 && record.owner != records[shard - 1].owner
+                && record.owner != records[shard - 1].owner + 1)) {
+            throw logic_error(string("invalid warm start layout of the ") + name + " profile at shard " + to_string(shard));
+        }
+        ++node_shards[record.owner];
+        // load of the buckets overlapping the shard, taken as uniform inside a bucket
+        const vector<TimberSaw::Key_Load_Bucket>& buckets = histogram.buckets();
+        while (bucket < buckets.size() && buckets[bucket].ub <= record.lb) {
+            ++bucket;
+        }
+        for (size_t b = bucket; b < buckets.size() && buckets[b].lb < record.ub; ++b) {
+            size_t lb = max(buckets[b].lb, record.lb), ub = min(buckets[b].ub, record.ub);
+            node_loads[record.owner] += static_cast<long double>(buckets[b].load) * (ub - lb) / (buckets[b].ub - buckets[b].lb);
+        }
+    }
+    if (records.back().ub != key_ub || *min_element(node_shards.begin(), node_shards.end()) == 0) {
+        throw logic_error(string("a node owns no shard in the warm start layout of the ") + name + " profile");
+    }
+
+    long double sum = 0;
+    for (long double load : node_loads) {
+        sum += load;
+    }
+    double ratio = sum > 0 ? double(*max_element(node_loads.begin(), node_loads.end()) * num_compute / sum) : 0;
+    LOGF(out, "%s,%lu,%lu,%lu,%.1f,%lu,%lu,%.4f\n", name, num_compute, num_shards, min_shard_size, layout_us
+        , *min_element(node_shards.begin(), node_shards.end()), *max_element(node_shards.begin(), node_shards.end()), ratio);
+    fflush(out);
+}
+
+void run_warm_start() {
+    FILE* out = redirect_stdout();
+    LOGF(out, "profile,num_compute,num_shards,min_shard_size,layout_us,min_node_shards,max_node_shards,max_mean_ratio\n");
+    size_t num_shards = input.num_compute * input.num_shard_per_compute, key_ub = num_shards * 1024;
+
+    TimberSaw::Random64 gen(input.random_seed);
+    vector<TimberSaw::Key_Load_Bucket> skewed;
+    for (size_t key = 0; key < key_ub; key += 1024) {
+        skewed.push_back({key, key + 1024, size_t(1024) + (gen.Next() % 16 == 0 ? 16 * 1024 : 0)});
+    }
+    TimberSaw::Key_Load_Histogram uniform({{0, key_ub, key_ub}});
+    TimberSaw::Key_Load_Histogram hot_key({{0, key_ub / 2, key_ub / 2}, {key_ub / 2, key_ub / 2 + 1, key_ub}
+        , {key_ub / 2 + 1, key_ub, key_ub / 2 - 1}});
+    // all the load in the first min size range, so every shard after the first has none
+    TimberSaw::Key_Load_Histogram flash_crowd({{0, 10, 1000}});
+    TimberSaw::Key_Load_Histogram first_half({{0, key_ub / 2, key_ub}});
+
+    run_warm_start_layout("uniform", uniform, 0, key_ub, input.num_compute, num_shards, 1, out);
+    run_warm_start_layout("skewed", TimberSaw::Key_Load_Histogram(skewed), 0, key_ub, input.num_compute, num_shards, 1, out);
+    run_warm_start_layout("hot_key", hot_key, 0, key_ub, input.num_compute, num_shards, 1, out);
+    run_warm_start_layout("first_half", first_half, 0, key_ub, input.num_compute, num_shards, 1, out);
+    run_warm_start_layout("flash_crowd", flash_crowd, 0, key_ub, input.num_compute, num_shards, 10, out);
+    run_warm_start_layout("flash_crowd", flash_crowd, 0, 1000000, 4, 4, 10, out);
+    fclose(out);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || !strcmp(argv[1], "--help") || !strcmp(argv[1], "-h")) {
+        help();
+        return argc < 2;
+    }
+
+    for (const Benchmark& bench : benchmarks) {
+        if (!strcmp(argv[1], bench.name)) {
+            parse_input(argc, argv);
+            // the balancer benchmarks report the cycles of the round phases
+            TimberSaw::set_observed_features(TimberSaw::OBSERVE_PHASES);
+            bench.run();
+            return 0;
+        }
+    }
+
+    LOGFC(COLOR_RED, stderr, "Unknown benchmark: %s\n", argv[1]);
+    help();
+    return 1;
+}
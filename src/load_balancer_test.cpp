@@ -1,6 +1,12 @@
 #include "load_balancer.h"
 #include "random.h"
 #include "testlog.h"
+#include "trace.h"
+#include "workload.h"
+#include "latency_model.h"
+#include "migration_model.h"
+#include "routing_table.h"
+#include "warm_start.h"
 
 #include "config.h"
 
@@ -12,6 +18,8 @@
 #include <cstring>
 #include <assert.h>
 #include <concepts>
+#include <chrono>
+#include <string>
 
 using namespace std;
 
@@ -27,6 +35,8 @@ struct Input {
     size_t random_seed = 65406; // --random_seed -rs 
     size_t rw_p = 25; // --read_write_percent -rwp [0, 100]
     size_t remote_read_per_read = 100; // --remote_read_per_read -rrpr 0 means no remote reads
+    size_t num_memory = 1; // --num_memory -nm [1, inf)
+    size_t memory_capacity = 0; // --memory_capacity -mc remote reads a memory node serves per round. 0 means unlimited
     size_t flush_per_write = 1000; // --flush_per_write -fpw 0 means no flushes
     size_t print_delay_seconds = 1; // --print_delay_seconds -pds [1, inf) 
     size_t print_per_round = 5; // --print_per_round -ppr [1, inf)
@@ -35,8 +45,15 @@ struct Input {
     size_t local_write_time = 1; // --local_write_time -lwt
     size_t flush_time = 100; // --flush_time -ft
     size_t min_shard_size = 1; // --min_shard_size -mss [1, inf), determins minimum number of keys in a shard -> was 1024 before
+    size_t renumber_shards = 1; // --renumber_shards -rns [0, 1] 1: shard ids follow the key order again after every round dividing shards
 
     size_t rebalance_period_seconds = 15; // --rebalance_period_seconds -rps
+    size_t min_rebalance_period_ms = 0; // --min_rebalance_period_ms -mnrp 0 means the period is fixed to rebalance_period_seconds
+    size_t max_rebalance_period_ms = 0; // --max_rebalance_period_ms -mxrp 0 means rebalance_period_seconds
+    size_t max_busy_percent = 1; // --max_busy_percent -mbp [1, 100] of the adaptive period
+    size_t cooldown_rounds = 0; // --cooldown_rounds -cdr 0 means shards are not held back after a move
+    size_t hysteresis_percent = 50; // --hysteresis_percent -hyp
+    size_t locality_aware = 0; // --locality_aware -la [0, 1] 1: shards move next to their key neighbours when the load allows
     size_t load_imbalance_ratio = 100; // --load_imbalance_ratio -lir
     size_t low_load_thresh = 0; // --low_load_thresh -llt
 
@@ -44,10 +61,61 @@ struct Input {
     size_t num_shards_to_print = 0; // --num_shards_to_print -nstp 0 means all shards should be printed
     size_t num_shards_to_print_per_compute_node = 0; // --num_shards_to_print_per_compute_node -nstpcn 0 means all shards should be printed
 
-    char lb_type = 'f'; // --lb_type -lt [f, d, r] f: fixed, d: dynamic, r: dynamic restricted
+    char lb_type = 'f'; // --lb_type -lt [f, d, r, h, c, p] f: fixed, d: dynamic, r: dynamic restricted, h: hierarchical, c: consistent hashing, p: pairwise
+    size_t group_size = 16; // --group_size -gs [1, inf) compute nodes per group of the hierarchical load balancer
+    size_t planner_threads = 0; // --planner_threads -pt 0 means one per core(hierarchical and pairwise)
+    size_t virtual_nodes = 64; // --virtual_nodes -vn [1, inf) points per compute node on the ring of the consistent hashing load balancer
+    size_t load_bound_percent = 25; // --load_bound_percent -lbp node loads are bounded by mean_load * (100 + lbp) / 100
+    size_t num_pairs = 0; // --num_pairs -np pairs of the pairwise load balancer per round. 0 means num_compute / 2
+    char pair_choice = 'w'; // --pair_choice -pc [w, r] w: power of two choices, r: uniformly random pairs
+
+    std::string trace_record_path; // --trace_record -tr empty means no recording
+    std::string trace_replay_path; // --trace_replay -trp empty means the load is generated
+    size_t trace_num_ops = 0; // --trace_num_ops -tno 0 means no limit on the number of generated ops
+    size_t replay_pacing = 0; // --replay_pacing -rpc [0, 1] 0: as fast as possible, 1: recorded pacing
+
+    std::string checkpoint_path; // --checkpoint -ckp empty means no checkpoints
+    size_t checkpoint_period = 10; // --checkpoint_period -ckpp [1, inf) rounds between two checkpoints
+    std::string restore_path; // --restore -rst empty means the shards start uniform
+    std::string warm_start_path; // --warm_start -ws empty means the shards start uniform
+
+    char workload = 'x'; // --workload -wl [x, a, b, c, d, e, f] x: rw_p reads and the rest updates, a-f: ycsb core workloads
+    char key_dist = 0; // --key_dist -kd [z, u, l, h] z: zipf, u: uniform, l: latest, h: hotspot. 0 means the default of the workload
+    size_t max_scan_length = 100; // --max_scan_length -msl [1, inf)
+    size_t hotspot_key_percent = 10; // --hotspot_key_percent -hkp [1, 100]
+    size_t hotspot_op_percent = 90; // --hotspot_op_percent -hop [0, 100]
+    size_t drift_period = 0; // --drift_period -dp 0 means no drift
+    size_t flash_start = 0; // --flash_start -fs
+    size_t flash_duration = 0; // --flash_duration -fd 0 means no flash crowd
+    size_t flash_percent = 50; // --flash_percent -fp [0, 100]
+    size_t flash_keys = 16; // --flash_keys -fk [1, inf)
+    size_t diurnal_period = 0; // --diurnal_period -dip 0 means constant rate
+    size_t diurnal_amplitude = 50; // --diurnal_amplitude -dia [0, 100)
+    size_t diurnal_rate = 100000; // --diurnal_rate -dir [1, inf) mean ops per second of the diurnal curve
+
+    size_t queue_capacity = 0; // --queue_capacity -qc number of servers per compute node. 0 means latency is not simulated
+    size_t op_interval = 1; // --op_interval -oi [1, inf) simulated time between two ops in the same unit as the op times
+
+    size_t migration_bandwidth = 0; // --migration_bandwidth -mb bytes per unit of time per compute node. 0 means ownership transfers are instant
+    size_t memory_bandwidth = 0; // --memory_bandwidth -meb bytes per unit of time of the memory node. 0 means unlimited
+    size_t bytes_per_key = 1024; // --bytes_per_key -bpk [1, inf)
+    char migration_policy = 's'; // --migration_policy -mp [s, r] s: ops to moving shards stall, r: ops are redirected to the old owner
+    size_t redirect_time = 10; // --redirect_time -rdt extra time of a redirected op
+
+    size_t num_rounds = 0; // --num_rounds -nr the simulation exits after <num_rounds> printer rounds. 0 means it never exits
+    std::string table_output_path; // --table_output -to empty means no table is written
+
+    std::string metrics_output_path; // --metrics_output -mo empty means round metrics are not written
+    char metrics_format = 'c'; // --metrics_format -mf [c, j] c: csv, j: json lines
+    std::string observe = "all"; // --observe -obs comma separated features observed at runtime
 };
 
 Input input;
+std::unique_ptr<TimberSaw::Latency_Model> latency_model;
+TimberSaw::Routing_Table routing_table;
+std::unique_ptr<TimberSaw::Migration_Model> migration_model;
+std::unique_ptr<TimberSaw::Checkpoint_Writer> checkpoint_writer;
+std::unique_ptr<TimberSaw::Period_Controller> period_controller;
 #ifdef PRINTER_LOCK
 std::shared_mutex print_mtx;
 #endif
@@ -55,6 +123,12 @@ std::shared_mutex print_mtx;
 void print_input() {
     LOGF(stdout, "Input:\n\
         load_balancing_type: %s\n\
+        group_size: %lu\n\
+        planner_threads: %lu\n\
+        virtual_nodes: %lu\n\
+        load_bound_percent: %lu\n\
+        num_pairs: %lu\n\
+        pair_choice: %s\n\
         num_compute: %lu\n\
         num_shard_per_compute: %lu\n\
         key_lb: %lu\n\
@@ -66,6 +140,8 @@ void print_input() {
         random_seed: %lu\n\
         rw_p: %lu\n\
         remote_read_per_read: %lu\n\
+        num_memory: %lu\n\
+        memory_capacity: %lu\n\
         flush_per_write: %lu\n\
         print_delay_seconds: %lu\n\
         print_per_round: %lu\n\
@@ -74,25 +150,81 @@ void print_input() {
         local_write_time: %lu\n\
         flush_time: %lu\n\
         min_shard_size: %lu\n\
+        renumber_shards: %lu\n\
         rebalance_period_seconds: %lu\n\
+        min_rebalance_period_ms: %lu\n\
+        max_rebalance_period_ms: %lu\n\
+        max_busy_percent: %lu\n\
+        cooldown_rounds: %lu\n\
+        hysteresis_percent: %lu\n\
+        locality_aware: %lu\n\
         load_imbalance_ratio: %lu\n\
         low_load_thresh: %lu\n\
         num_nodes_to_print: %lu\n\
         num_shards_to_print: %lu\n\
-        num_shards_to_print_per_compute_node: %lu\n", 
-        input.lb_type == 'f' ? "fixed" : input.lb_type == 'd' ? "dynamic" : "dynamic restricted",
+        num_shards_to_print_per_compute_node: %lu\n\
+        trace_record: %s\n\
+        trace_replay: %s\n\
+        trace_num_ops: %lu\n\
+        replay_pacing: %lu\n\
+        checkpoint: %s\n\
+        checkpoint_period: %lu\n\
+        restore: %s\n\
+        warm_start: %s\n\
+        workload: %s\n\
+        key_dist: %s\n\
+        max_scan_length: %lu\n\
+        hotspot_key_percent: %lu\n\
+        hotspot_op_percent: %lu\n\
+        drift_period: %lu\n\
+        flash_start: %lu\n\
+        flash_duration: %lu\n\
+        flash_percent: %lu\n\
+        flash_keys: %lu\n\
+        diurnal_period: %lu\n\
+        diurnal_amplitude: %lu\n\
+        diurnal_rate: %lu\n\
+        queue_capacity: %lu\n\
+        op_interval: %lu\n\
+        migration_bandwidth: %lu\n\
+        memory_bandwidth: %lu\n\
+        bytes_per_key: %lu\n\
+        migration_policy: %s\n\
+        redirect_time: %lu\n\
+        num_rounds: %lu\n\
+        table_output: %s\n\
+        metrics_output: %s\n\
+        metrics_format: %s\n\
+        observe: %s\n", 
+        input.lb_type == 'f' ? "fixed" : input.lb_type == 'd' ? "dynamic" : input.lb_type == 'r' ? "dynamic restricted" 
+            : input.lb_type == 'h' ? "hierarchical" : input.lb_type == 'c' ? "consistent hashing" : "pairwise",
+        input.group_size, input.planner_threads, input.virtual_nodes, input.load_bound_percent, input.num_pairs,
+        input.pair_choice == 'w' ? "power of two choices" : "random",
         input.num_compute, input.num_shard_per_compute, input.key_lb, input.key_log_ub, input.key_ub, input.send_info_delay_time, input.per_round_delay, 
-        input.per_round_delay_time, input.random_seed, input.rw_p, input.remote_read_per_read, input.flush_per_write, input.print_delay_seconds, 
-        input.print_per_round, input.local_read_time, input.remote_read_time, input.local_write_time, input.flush_time, input.min_shard_size, input.rebalance_period_seconds, 
+        input.per_round_delay_time, input.random_seed, input.rw_p, input.remote_read_per_read, input.num_memory, input.memory_capacity, input.flush_per_write, input.print_delay_seconds, 
+        input.print_per_round, input.local_read_time, input.remote_read_time, input.local_write_time, input.flush_time, input.min_shard_size, input.renumber_shards, input.rebalance_period_seconds, 
+        input.min_rebalance_period_ms, input.max_rebalance_period_ms, input.max_busy_percent, input.cooldown_rounds, input.hysteresis_percent, input.locality_aware,
         input.load_imbalance_ratio, input.low_load_thresh, input.num_nodes_to_print, input.num_shards_to_print, 
-        input.num_shards_to_print_per_compute_node);
+        input.num_shards_to_print_per_compute_node, input.trace_record_path.c_str(), input.trace_replay_path.c_str(),
+        input.trace_num_ops, input.replay_pacing, input.checkpoint_path.c_str(), input.checkpoint_period, input.restore_path.c_str(), input.warm_start_path.c_str(), TimberSaw::Workload::name(input.workload), TimberSaw::Workload::key_dist_name(input.key_dist),
+        input.max_scan_length, input.hotspot_key_percent, input.hotspot_op_percent, input.drift_period, input.flash_start, input.flash_duration,
+        input.flash_percent, input.flash_keys, input.diurnal_period, input.diurnal_amplitude, input.diurnal_rate,
+        input.queue_capacity, input.op_interval, input.migration_bandwidth, input.memory_bandwidth, input.bytes_per_key,
+        input.migration_policy == 's' ? "stall" : "redirect", input.redirect_time, input.num_rounds, input.table_output_path.c_str(),
+        input.metrics_output_path.c_str(), input.metrics_format == 'c' ? "csv" : "json lines", input.observe.c_str());
 }
 
 void help() {
     LOGF(stderr, "USAGE: ./load_balancer_test [OPTIONS]\n\
         \tOPTIONS:\n\
             \t\t--help, -h -> for printing this message\n\
-            \t\t--lb_type=<type>, -lt=<type> -> sets the load balancing type. type should be one of [f, d, r]. default value is f.\n\
+            \t\t--lb_type=<type>, -lt=<type> -> sets the load balancing type. type should be one of [f, d, r, h, c, p]. default value is f.\n\
+            \t\t--group_size=<number>, -gs=<number> -> sets the number of compute nodes per group of the hierarchical load balancer. cannot be 0. default value is 16.\n\
+            \t\t--planner_threads=<number>, -pt=<number> -> sets the number of threads planning the groups of the hierarchical load balancer or the pairs of the pairwise load balancer. 0 means one per core. default value is 0.\n\
+            \t\t--virtual_nodes=<number>, -vn=<number> -> sets the number of points per compute node on the ring of the consistent hashing load balancer. cannot be 0. default value is 64.\n\
+            \t\t--load_bound_percent=<number>, -lbp=<number> -> bounds the node loads of the consistent hashing load balancer by mean_load * (100 + <number>) / 100. default value is 25.\n\
+            \t\t--num_pairs=<number>, -np=<number> -> sets the number of node pairs the pairwise load balancer evens out per round. 0 means num_compute / 2. default value is 0.\n\
+            \t\t--pair_choice=<type>, -pc=<type> -> sets how the pairwise load balancer pairs the nodes. type should be one of [w, r]. w pairs the heavier of two random nodes with the lighter of two others and r uses uniformly random pairs. default value is w.\n\
             \t\t--num_compute=<number>, -nc=<number> -> sets the number of compute nodes to <number>. should be at least 2. default value is 2.\n\
             \t\t--num_shard_per_compute=<number>, -nspc=<number> -> sets the number of shards per compute node to <number>. cannot be 0. default value is 8.\n\
             \t\t--key_lb=<number>, -klb=<number> -> sets the lower bound of the key range. default value is 0.\n\
@@ -103,6 +235,8 @@ void help() {
             \t\t--random_seed=<number>, -rs=<number> -> sets the random seed. default value is 65406.\n\
             \t\t--read_write_percent=<number>, -rwp=<number> -> sets the read-write percent(0 means that all queries are writes). should be in range [0, 100]. default value is 25.\n\
             \t\t--remote_read_per_read=<number>, -rrpr=<number> -> does one remote reads after <number> local reads. default value is 100.\n\
+            \t\t--num_memory=<number>, -nm=<number> -> sets the number of memory nodes storing the shards. cannot be 0. default value is 1.\n\
+            \t\t--memory_capacity=<number>, -mc=<number> -> sets the remote reads(decayed per round like the loads) a memory node should serve. shards of the memory nodes above it are moved to the least loaded ones. 0 means unlimited. default value is 0.\n\
             \t\t--flush_per_write=<number>, -fpw=<number> -> sets the flush per write. default value is 1000.\n\
             \t\t--print_delay_seconds=<number>, -pds=<number> -> sets the print delay in seconds. cannot be 0. default value is 1.\n\
             \t\t--print_per_round=<number>, -ppr=<number> -> sets the print per round. cannot be 0. default value is 5.\n\
@@ -111,12 +245,52 @@ void help() {
             \t\t--local_write_time=<number>, -lwt=<number> -> sets the local write time. default value is 1.\n\
             \t\t--flush_time=<number>, -ft=<number> -> sets the flush time. default value is 100.\n\
             \t\t--min_shard_size=<number>, -mss=<number> -> sets the minimum shard size. default value is 1 cannot be 0.\n\
+            \t\t--renumber_shards=<number>, -rns=<number> -> 1 renumbers the shards in key order after every round dividing shards and 0 keeps the ids. default value is 1.\n\
             \t\t--rebalance_period_seconds=<number>, -rps=<number> -> sets the rebalance period in seconds. default value is 15.\n\
+            \t\t--min_rebalance_period_ms=<number>, -mnrp=<number> -> adapts the rebalance period to the load shifts, plan sizes and planning time between <number> and max_rebalance_period_ms. 0 means the period is fixed. default is 0.\n\
+            \t\t--max_rebalance_period_ms=<number>, -mxrp=<number> -> upper bound of the adaptive rebalance period. 0 means rebalance_period_seconds. default is 0.\n\
+            \t\t--max_busy_percent=<number>, -mbp=<number> -> the adaptive rebalance period stays long enough for planning to take at most <number> percent of the time. default is 1.\n\
+            \t\t--cooldown_rounds=<number>, -cdr=<number> -> a shard moved in the last <number> rounds is only moved again if the gain clearly exceeds the move. 0 turns it off. only used by the fixed and dynamic balancers. default is 0.\n\
+            \t\t--hysteresis_percent=<number>, -hyp=<number> -> a cooling down shard moves again only if the move cuts the load gap of the two nodes by its load plus <number> percent of it. 100 or more pins it for the cooldown. default is 50.\n\
+            \t\t--locality_aware=<number>, -la=<number> -> 1 moves a shard to the owner of a key neighbour instead of the least loaded node when that owner stays within the threshold, so nodes keep fewer key ranges. only used by the fixed and dynamic balancers. default value is 0.\n\
             \t\t--load_imbalance_ratio=<number>, -lir=<number> -> sets the load imbalance ratio. load imbalance threshold is mean_load / ratio. default value is 100.\n\
             \t\t--low_load_thresh=<number>, -llt=<number> -> sets the low load threshold to determine insignificant loads. default value is 0.\n\
             \t\t--num_nodes_to_print=<number>, -nnp=<number> -> sets the number of nodes to print. 0 means all nodes should be printed. default is 0.\n\
             \t\t--num_shards_to_print=<number>, -nstp=<number> -> sets the number of shards to print. 0 means all shards should be printed. default is 0.\n\
             \t\t--num_shards_to_print_per_compute_node=<number>, -nstpcn=<number> -> sets the number of shards to print per compute node. 0 means all shards should be printed. default is 0.\n\
+            \t\t--trace_record=<path>, -tr=<path> -> records the generated load into a binary trace file at <path>.\n\
+            \t\t--trace_replay=<path>, -trp=<path> -> replays the load from the trace file at <path> instead of generating it.\n\
+            \t\t--trace_num_ops=<number>, -tno=<number> -> stops the load generator after <number> ops. 0 means no limit. default is 0.\n\
+            \t\t--replay_pacing=<number>, -rpc=<number> -> 0 replays the trace as fast as possible and 1 keeps the recorded pacing. default is 0.\n\
+            \t\t--checkpoint=<path>, -ckp=<path> -> periodically writes the shard key ranges, owners and decayed loads into a checkpoint file at <path>.\n\
+            \t\t--checkpoint_period=<number>, -ckpp=<number> -> rounds between two checkpoints. cannot be 0. default is 10.\n\
+            \t\t--restore=<path>, -rst=<path> -> starts from the checkpoint file at <path> instead of uniform shards. the checkpoint should have the same num_compute and keys.\n\
+            \t\t--warm_start=<path>, -ws=<path> -> starts from shards and node ranges of about the same load in the trace or checkpoint file at <path>, whatever its num_compute and num_shards.\n\
+            \t\t--workload=<type>, -wl=<type> -> sets the op mix. type should be one of [x, a, b, c, d, e, f]. x uses read_write_percent and a-f are the ycsb core workloads. default is x.\n\
+            \t\t--key_dist=<type>, -kd=<type> -> sets the key distribution. type should be one of [z, u, l, h](zipf, uniform, latest, hotspot). default is latest for workload d and zipf otherwise.\n\
+            \t\t--max_scan_length=<number>, -msl=<number> -> sets the maximum number of keys read by a scan. cannot be 0. default is 100.\n\
+            \t\t--hotspot_key_percent=<number>, -hkp=<number> -> sets the size of the hot set of the hotspot distribution as a percentage of keys. should be in range [1, 100]. default is 10.\n\
+            \t\t--hotspot_op_percent=<number>, -hop=<number> -> sets the percentage of ops going to the hot set of the hotspot distribution. should be in range [0, 100]. default is 90.\n\
+            \t\t--drift_period=<number>, -dp=<number> -> the hot region travels the whole key range every <number> ops. 0 means no drift. default is 0.\n\
+            \t\t--flash_start=<number>, -fs=<number> -> a flash crowd starts after <number> ops. default is 0.\n\
+            \t\t--flash_duration=<number>, -fd=<number> -> the flash crowd lasts for <number> ops. 0 means no flash crowd. default is 0.\n\
+            \t\t--flash_percent=<number>, -fp=<number> -> sets the percentage of ops going to the flash crowd keys. should be in range [0, 100]. default is 50.\n\
+            \t\t--flash_keys=<number>, -fk=<number> -> sets the number of keys targeted by the flash crowd. cannot be 0. default is 16.\n\
+            \t\t--diurnal_period=<number>, -dip=<number> -> the request rate goes through one cycle every <number> ops. 0 means a constant rate. default is 0.\n\
+            \t\t--diurnal_amplitude=<number>, -dia=<number> -> sets the swing of the request rate around its mean as a percentage. should be in range [0, 100). default is 50.\n\
+            \t\t--diurnal_rate=<number>, -dir=<number> -> sets the mean number of ops per second the load generator is paced at when diurnal_period is not 0. default is 100000.\n\
+            \t\t--queue_capacity=<number>, -qc=<number> -> models each compute node as a queue with <number> servers and reports op latency. 0 disables the model. default is 0.\n\
+            \t\t--op_interval=<number>, -oi=<number> -> sets the simulated time between two ops for the latency model. cannot be 0. default is 1.\n\
+            \t\t--migration_bandwidth=<number>, -mb=<number> -> simulates ownership transfers as data moves with <number> bytes per unit of time per compute node. needs the latency model. 0 means instant transfers. default is 0.\n\
+            \t\t--memory_bandwidth=<number>, -meb=<number> -> sets the bandwidth of the memory node for the moves in bytes per unit of time. 0 means unlimited. default is 0.\n\
+            \t\t--bytes_per_key=<number>, -bpk=<number> -> sets the number of bytes moved per key of a shard. cannot be 0. default is 1024.\n\
+            \t\t--migration_policy=<type>, -mp=<type> -> sets what happens to ops on a moving shard. type should be one of [s, r](stall, redirect to the old owner). default is s.\n\
+            \t\t--redirect_time=<number>, -rdt=<number> -> sets the extra time of a redirected op. default is 10.\n\
+            \t\t--num_rounds=<number>, -nr=<number> -> stops the simulation after <number> printer rounds. 0 means it runs until killed. default is 0.\n\
+            \t\t--table_output=<path>, -to=<path> -> writes the load of each node on every printed round into a csv table at <path>.\n\
+            \t\t--metrics_output=<path>, -mo=<path> -> writes the imbalance metrics and plan size of every load balancing round into <path>.\n\
+            \t\t--metrics_format=<type>, -mf=<type> -> sets the format of the round metrics. type should be one of [c, j](csv, json lines). default is c.\n\
+            \t\t--observe=<list>, -obs=<list> -> comma separated features observed at runtime, all or none. features are round_load(per shard load since the last print), node_info, shard_info, shards_per_node, updates(prints every plan), checks(invariant checks after every change), input and phases(times the phases of every round). default is all.\n\
         \t<number>: is a non-negative integer\n");
         
 }
@@ -167,6 +341,23 @@ bool get_arg(const char* arg, const char* arg_name, char& res) {
     return false;
 }
 
+bool get_arg(const char* arg, const char* arg_name, std::string& res) {
+    size_t len = strlen(arg_name);
+    assert(len > 0 && arg_name[len - 1] == '=');
+
+    if (strlen(arg) < len)
+        return false;
+
+    if (!strncmp(arg, arg_name, len)) {
+        if (strlen(arg + len) == 0) {
+            throw std::invalid_argument("no value after argument " + std::string(arg_name, len - 1));
+        }
+        res = arg + len;
+        return true;
+    }
+    return false;
+}
+
 void parse_input(int argc, char** argv) {
     try {
         assert(write_buffer_size != 0);
@@ -174,10 +365,41 @@ void parse_input(int argc, char** argv) {
         for (; argc > 0; --argc) {
             if (get_arg(argv[argc], "--lb_type=", input.lb_type) 
                 || get_arg(argv[argc], "-lt=", input.lb_type)) {
-                if (input.lb_type != 'f' && input.lb_type != 'd' && input.lb_type != 'r') {
-                    throw std::invalid_argument("load balancing type should be one of [f, d, r]");
+                if (input.lb_type != 'f' && input.lb_type != 'd' && input.lb_type != 'r' && input.lb_type != 'h' && input.lb_type != 'c'
+                    && input.lb_type != 'p') {
+                    throw std::invalid_argument("load balancing type should be one of [f, d, r, h, c, p]");
                 }
             }
+            else if (get_arg(argv[argc], "--num_pairs=", input.num_pairs) 
+                || get_arg(argv[argc], "-np=", input.num_pairs)) {
+                
+            }
+            else if (get_arg(argv[argc], "--pair_choice=", input.pair_choice) 
+                || get_arg(argv[argc], "-pc=", input.pair_choice)) {
+                if (input.pair_choice != 'w' && input.pair_choice != 'r') {
+                    throw std::invalid_argument("pair choice should be one of [w, r]");
+                }
+            }
+            else if (get_arg(argv[argc], "--virtual_nodes=", input.virtual_nodes) 
+                || get_arg(argv[argc], "-vn=", input.virtual_nodes)) {
+                if (input.virtual_nodes == 0) {
+                    throw std::invalid_argument("virtual_nodes cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--load_bound_percent=", input.load_bound_percent) 
+                || get_arg(argv[argc], "-lbp=", input.load_bound_percent)) {
+                
+            }
+            else if (get_arg(argv[argc], "--group_size=", input.group_size) 
+                || get_arg(argv[argc], "-gs=", input.group_size)) {
+                if (input.group_size == 0) {
+                    throw std::invalid_argument("group_size cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--planner_threads=", input.planner_threads) 
+                || get_arg(argv[argc], "-pt=", input.planner_threads)) {
+                
+            }
             else if (get_arg(argv[argc], "--num_compute=", input.num_compute) 
                 || get_arg(argv[argc], "-nc=", input.num_compute)) {
                 if (input.num_compute < 2) {
@@ -223,6 +445,16 @@ void parse_input(int argc, char** argv) {
             else if (get_arg(argv[argc], "--remote_read_per_read=", input.remote_read_per_read) 
                 || get_arg(argv[argc], "-rrpr=", input.remote_read_per_read)) {
                 
+            }
+            else if (get_arg(argv[argc], "--num_memory=", input.num_memory) 
+                || get_arg(argv[argc], "-nm=", input.num_memory)) {
+                if (input.num_memory == 0) {
+                    throw std::invalid_argument("num_memory cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--memory_capacity=", input.memory_capacity) 
+                || get_arg(argv[argc], "-mc=", input.memory_capacity)) {
+                
             }
             else if (get_arg(argv[argc], "--flush_per_write=", input.flush_per_write) 
                 || get_arg(argv[argc], "-fpw=", input.flush_per_write)) {
@@ -234,6 +466,12 @@ void parse_input(int argc, char** argv) {
                     throw std::invalid_argument("min_shard_size cannot be 0");
                 }
             }
+            else if (get_arg(argv[argc], "--renumber_shards=", input.renumber_shards) 
+                || get_arg(argv[argc], "-rns=", input.renumber_shards)) {
+                if (input.renumber_shards > 1) {
+                    throw std::invalid_argument("renumber_shards should be 0 or 1");
+                }
+            }
             else if (get_arg(argv[argc], "--print_delay_seconds=", input.print_delay_seconds) 
                 || get_arg(argv[argc], "-pds=", input.print_delay_seconds)) {
                 if (input.print_delay_seconds == 0) {
@@ -266,6 +504,32 @@ void parse_input(int argc, char** argv) {
                 || get_arg(argv[argc], "-rps=", input.rebalance_period_seconds)) {
                 
             }
+            else if (get_arg(argv[argc], "--min_rebalance_period_ms=", input.min_rebalance_period_ms) 
+                || get_arg(argv[argc], "-mnrp=", input.min_rebalance_period_ms)) {
+                
+            }
+            else if (get_arg(argv[argc], "--max_rebalance_period_ms=", input.max_rebalance_period_ms) 
+                || get_arg(argv[argc], "-mxrp=", input.max_rebalance_period_ms)) {
+                
+            }
+            else if (get_arg(argv[argc], "--max_busy_percent=", input.max_busy_percent) 
+                || get_arg(argv[argc], "-mbp=", input.max_busy_percent)) {
+                if (input.max_busy_percent == 0 || input.max_busy_percent > 100) {
+                    throw std::invalid_argument("max_busy_percent should be in [1, 100]");
+                }
+            }
+            else if (get_arg(argv[argc], "--cooldown_rounds=", input.cooldown_rounds) 
+                || get_arg(argv[argc], "-cdr=", input.cooldown_rounds)) {
+            }
+            else if (get_arg(argv[argc], "--hysteresis_percent=", input.hysteresis_percent) 
+                || get_arg(argv[argc], "-hyp=", input.hysteresis_percent)) {
+            }
+            else if (get_arg(argv[argc], "--locality_aware=", input.locality_aware) 
+                || get_arg(argv[argc], "-la=", input.locality_aware)) {
+                if (input.locality_aware > 1) {
+                    throw std::invalid_argument("locality_aware should be 0 or 1");
+                }
+            }
             else if (get_arg(argv[argc], "--load_imbalance_ratio=", input.load_imbalance_ratio) 
                 || get_arg(argv[argc], "-lir=", input.load_imbalance_ratio)) {
             }
@@ -284,23 +548,207 @@ void parse_input(int argc, char** argv) {
             else if (get_arg(argv[argc], "--num_shards_to_print_per_compute_node=", input.num_shards_to_print_per_compute_node) 
                 || get_arg(argv[argc], "-nstpcn=", input.num_shards_to_print_per_compute_node)) {
                 
+            }
+            else if (get_arg(argv[argc], "--trace_record=", input.trace_record_path) 
+                || get_arg(argv[argc], "-tr=", input.trace_record_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--trace_replay=", input.trace_replay_path) 
+                || get_arg(argv[argc], "-trp=", input.trace_replay_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--checkpoint=", input.checkpoint_path) 
+                || get_arg(argv[argc], "-ckp=", input.checkpoint_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--checkpoint_period=", input.checkpoint_period) 
+                || get_arg(argv[argc], "-ckpp=", input.checkpoint_period)) {
+                if (input.checkpoint_period == 0) {
+                    throw std::invalid_argument("checkpoint_period cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--restore=", input.restore_path) 
+                || get_arg(argv[argc], "-rst=", input.restore_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--warm_start=", input.warm_start_path) 
+                || get_arg(argv[argc], "-ws=", input.warm_start_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--trace_num_ops=", input.trace_num_ops) 
+                || get_arg(argv[argc], "-tno=", input.trace_num_ops)) {
+                
+            }
+            else if (get_arg(argv[argc], "--replay_pacing=", input.replay_pacing) 
+                || get_arg(argv[argc], "-rpc=", input.replay_pacing)) {
+                if (input.replay_pacing > 1) {
+                    throw std::invalid_argument("replay_pacing should be 0 or 1");
+                }
+            }
+            else if (get_arg(argv[argc], "--workload=", input.workload) 
+                || get_arg(argv[argc], "-wl=", input.workload)) {
+                if (input.workload != 'x' && (input.workload < 'a' || input.workload > 'f')) {
+                    throw std::invalid_argument("workload should be one of [x, a, b, c, d, e, f]");
+                }
+            }
+            else if (get_arg(argv[argc], "--key_dist=", input.key_dist) 
+                || get_arg(argv[argc], "-kd=", input.key_dist)) {
+                if (input.key_dist != 'z' && input.key_dist != 'u' && input.key_dist != 'l' && input.key_dist != 'h') {
+                    throw std::invalid_argument("key distribution should be one of [z, u, l, h]");
+                }
+            }
+            else if (get_arg(argv[argc], "--max_scan_length=", input.max_scan_length) 
+                || get_arg(argv[argc], "-msl=", input.max_scan_length)) {
+                if (input.max_scan_length == 0) {
+                    throw std::invalid_argument("max_scan_length cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--hotspot_key_percent=", input.hotspot_key_percent) 
+                || get_arg(argv[argc], "-hkp=", input.hotspot_key_percent)) {
+                if (input.hotspot_key_percent == 0 || input.hotspot_key_percent > 100) {
+                    throw std::invalid_argument("hotspot_key_percent should be in range [1, 100]");
+                }
+            }
+            else if (get_arg(argv[argc], "--hotspot_op_percent=", input.hotspot_op_percent) 
+                || get_arg(argv[argc], "-hop=", input.hotspot_op_percent)) {
+                if (input.hotspot_op_percent > 100) {
+                    throw std::invalid_argument("hotspot_op_percent should be in range [0, 100]");
+                }
+            }
+            else if (get_arg(argv[argc], "--drift_period=", input.drift_period) 
+                || get_arg(argv[argc], "-dp=", input.drift_period)) {
+                
+            }
+            else if (get_arg(argv[argc], "--flash_start=", input.flash_start) 
+                || get_arg(argv[argc], "-fs=", input.flash_start)) {
+                
+            }
+            else if (get_arg(argv[argc], "--flash_duration=", input.flash_duration) 
+                || get_arg(argv[argc], "-fd=", input.flash_duration)) {
+                
+            }
+            else if (get_arg(argv[argc], "--flash_percent=", input.flash_percent) 
+                || get_arg(argv[argc], "-fp=", input.flash_percent)) {
+                if (input.flash_percent > 100) {
+                    throw std::invalid_argument("flash_percent should be in range [0, 100]");
+                }
+            }
+            else if (get_arg(argv[argc], "--flash_keys=", input.flash_keys) 
+                || get_arg(argv[argc], "-fk=", input.flash_keys)) {
+                if (input.flash_keys == 0) {
+                    throw std::invalid_argument("flash_keys cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--diurnal_period=", input.diurnal_period) 
+                || get_arg(argv[argc], "-dip=", input.diurnal_period)) {
+                
+            }
+            else if (get_arg(argv[argc], "--diurnal_amplitude=", input.diurnal_amplitude) 
+                || get_arg(argv[argc], "-dia=", input.diurnal_amplitude)) {
+                if (input.diurnal_amplitude >= 100) {
+                    throw std::invalid_argument("diurnal_amplitude should be in range [0, 100)");
+                }
+            }
+            else if (get_arg(argv[argc], "--diurnal_rate=", input.diurnal_rate) 
+                || get_arg(argv[argc], "-dir=", input.diurnal_rate)) {
+                if (input.diurnal_rate == 0) {
+                    throw std::invalid_argument("diurnal_rate should be in range [1, inf)");
+                }
+            }
+            else if (get_arg(argv[argc], "--queue_capacity=", input.queue_capacity) 
+                || get_arg(argv[argc], "-qc=", input.queue_capacity)) {
+                
+            }
+            else if (get_arg(argv[argc], "--op_interval=", input.op_interval) 
+                || get_arg(argv[argc], "-oi=", input.op_interval)) {
+                if (input.op_interval == 0) {
+                    throw std::invalid_argument("op_interval cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--migration_bandwidth=", input.migration_bandwidth) 
+                || get_arg(argv[argc], "-mb=", input.migration_bandwidth)) {
+                
+            }
+            else if (get_arg(argv[argc], "--memory_bandwidth=", input.memory_bandwidth) 
+                || get_arg(argv[argc], "-meb=", input.memory_bandwidth)) {
+                
+            }
+            else if (get_arg(argv[argc], "--bytes_per_key=", input.bytes_per_key) 
+                || get_arg(argv[argc], "-bpk=", input.bytes_per_key)) {
+                if (input.bytes_per_key == 0) {
+                    throw std::invalid_argument("bytes_per_key cannot be 0");
+                }
+            }
+            else if (get_arg(argv[argc], "--migration_policy=", input.migration_policy) 
+                || get_arg(argv[argc], "-mp=", input.migration_policy)) {
+                if (input.migration_policy != 's' && input.migration_policy != 'r') {
+                    throw std::invalid_argument("migration policy should be one of [s, r]");
+                }
+            }
+            else if (get_arg(argv[argc], "--redirect_time=", input.redirect_time) 
+                || get_arg(argv[argc], "-rdt=", input.redirect_time)) {
+                
+            }
+            else if (get_arg(argv[argc], "--num_rounds=", input.num_rounds) 
+                || get_arg(argv[argc], "-nr=", input.num_rounds)) {
+                
+            }
+            else if (get_arg(argv[argc], "--table_output=", input.table_output_path) 
+                || get_arg(argv[argc], "-to=", input.table_output_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--metrics_output=", input.metrics_output_path) 
+                || get_arg(argv[argc], "-mo=", input.metrics_output_path)) {
+                
+            }
+            else if (get_arg(argv[argc], "--metrics_format=", input.metrics_format) 
+                || get_arg(argv[argc], "-mf=", input.metrics_format)) {
+                if (input.metrics_format != 'c' && input.metrics_format != 'j') {
+                    throw std::invalid_argument("metrics format should be one of [c, j]");
+                }
+            }
+            else if (get_arg(argv[argc], "--observe=", input.observe) 
+                || get_arg(argv[argc], "-obs=", input.observe)) {
+                
             }
             else {
                 throw std::invalid_argument("Unknown argument: " + std::string(argv[argc]));
             }
         }
+
+        // the increment variant of a container is chosen when it is created, so this is set before any load balancer
+        TimberSaw::set_observed_features(TimberSaw::parse_observed_features(input.observe.c_str()));
+
+        if (!input.trace_record_path.empty() && !input.trace_replay_path.empty()) {
+            throw std::invalid_argument("cannot record and replay a trace at the same time");
+        }
+
+        if (!input.restore_path.empty() && !input.warm_start_path.empty()) {
+            throw std::invalid_argument("cannot restore a checkpoint and warm start at the same time");
+        }
+
+        if (input.max_rebalance_period_ms == 0) {
+            input.max_rebalance_period_ms = input.rebalance_period_seconds * 1000;
+        }
+        if (input.min_rebalance_period_ms > input.max_rebalance_period_ms) {
+            throw std::invalid_argument("min_rebalance_period_ms cannot be more than max_rebalance_period_ms");
+        }
+
+        if (input.migration_bandwidth != 0 && input.queue_capacity == 0) {
+            throw std::invalid_argument("simulating migrations needs the latency model(queue_capacity)");
+        }
     } catch(std::exception& a) {
         LOGFC(COLOR_RED, stderr, "%s\n", a.what());
         help();
-        #ifdef PRINT_INPUT
-        print_input();
-        #endif
+        if (TimberSaw::observing(TimberSaw::OBSERVE_INPUT)) {
+            print_input();
+        }
         exit(1);
     }
 
-    #ifdef PRINT_INPUT
-    print_input();
-    #endif
+    if (TimberSaw::observing(TimberSaw::OBSERVE_INPUT)) {
+        print_input();
+    }
 }
 
 size_t key_to_shard(size_t key, size_t num_shards) {
@@ -315,6 +763,7 @@ size_t key_to_shard(size_t key, size_t num_shards) {
 }
 
 void send_info(load_vector& loads, TimberSaw::Load_Balancer& lb) {
+    TimberSaw::Site_Shared_Mutex::set_thread_name("send_info");
     while(true) {
         usleep(input.send_info_delay_time);
         #ifdef PRINTER_LOCK
@@ -329,66 +778,208 @@ void send_info(load_vector& loads, TimberSaw::Load_Balancer& lb) {
     }
 }
 
+void issue_op(load_vector& loads, TimberSaw::Routing_Table::Reader& router, size_t key, size_t lr, size_t rr, size_t lw, size_t fl) {
+    #ifdef PRINTER_LOCK
+    print_mtx.lock_shared();
+    #endif
+    loads.increment_load(key, lr, rr, lw, fl);
+    #ifdef PRINTER_LOCK
+    print_mtx.unlock_shared();
+    #endif
+
+    if (latency_model) {
+        size_t owner, shard;
+        router.lookup(key, owner, shard);
+        uint64_t service_time = loads.service_time(lr, rr, lw, fl);
+        uint64_t delay = 0;
+        if (migration_model) {
+            migration_model->route(shard, latency_model->now(), owner, service_time, delay);
+        }
+        latency_model->on_op(owner, service_time, delay);
+    }
+}
+
+TimberSaw::Workload_Options workload_options() {
+    TimberSaw::Workload_Options opt;
+    opt.workload = input.workload;
+    opt.key_dist = input.key_dist;
+    opt.key_lb = input.key_lb;
+    opt.key_ub = input.key_ub;
+    opt.seed = input.random_seed;
+    opt.read_percent = input.rw_p;
+    opt.max_scan_length = input.max_scan_length;
+    opt.hotspot_key_percent = input.hotspot_key_percent;
+    opt.hotspot_op_percent = input.hotspot_op_percent;
+    opt.drift_period = input.drift_period;
+    opt.flash_start = input.flash_start;
+    opt.flash_duration = input.flash_duration;
+    opt.flash_percent = input.flash_percent;
+    opt.flash_keys = input.flash_keys;
+    opt.diurnal_period = input.diurnal_period;
+    opt.diurnal_amplitude = input.diurnal_amplitude;
+    return opt;
+}
+
 void load_generator(TimberSaw::Load_Balancer& lb, load_vector& loads) {
-    
-    TimberSaw::Random32 type_gen(input.random_seed);
-    // TimberSaw::Random64 key_gen(input.random_seed);
+    TimberSaw::Site_Shared_Mutex::set_thread_name("load_generator");
+    TimberSaw::Routing_Table::Reader router(routing_table);
     TimberSaw::Random32 remote_gen(input.random_seed);
-    TimberSaw::zipf_distribution<size_t> key_gen(input.random_seed, input.key_ub, 1.0);
+    TimberSaw::Workload workload(workload_options());
+    TimberSaw::Workload_Op op;
+
+    std::unique_ptr<TimberSaw::Trace_Writer> trace;
+    if (!input.trace_record_path.empty()) {
+        trace.reset(new TimberSaw::Trace_Writer(input.trace_record_path, input.key_lb, input.key_ub));
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    // with a diurnal curve the generator is paced on its own: each op takes 1 / (diurnal_rate * rate_factor) seconds
+    // of a schedule and the generator sleeps whenever it gets ahead of that schedule
+    double schedule_us = 0;
+    const size_t pacing_batch = 64; // checks the clock once per batch, as a sleep shorter than a few microseconds is not kept
 
-    for (int round = 0;; ++round) {
+    for (size_t round = 0; input.trace_num_ops == 0 || round < input.trace_num_ops; ++round) {
         if (input.per_round_delay != 0 && round % input.per_round_delay == 0)
             usleep(input.per_round_delay_time);
 
+        if (input.diurnal_period != 0) {
+            schedule_us += 1e6 / (input.diurnal_rate * workload.rate_factor());
+            if (round % pacing_batch == 0) {
+                double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+                if (schedule_us > elapsed_us)
+                    usleep(static_cast<useconds_t>(schedule_us - elapsed_us));
+            }
+        }
+
+        workload.next(op);
+        assert(op.key < input.key_ub && op.key >= input.key_lb);
 
-        // size_t key = key_gen.Skewed(input.key_log_ub);
-        size_t key = key_gen() - 1;
-        assert(key < input.key_ub && key >= input.key_lb);
+        bool read = (op.type == TimberSaw::OP_READ || op.type == TimberSaw::OP_SCAN || op.type == TimberSaw::OP_READ_MODIFY_WRITE);
+        bool write = (op.type == TimberSaw::OP_UPDATE || op.type == TimberSaw::OP_INSERT || op.type == TimberSaw::OP_READ_MODIFY_WRITE);
 
-        size_t shard = key_to_shard(key, lb.num_shards());
+        for (size_t key = op.key; key < op.key + op.scan_length; ++key) {
+            size_t lr = 0, rr = 0, lw = 0, fl = 0;
+            if (read) {
+                lr = 1;
+                if (input.remote_read_per_read != 0)
+                    rr = ((remote_gen.Next() % input.remote_read_per_read) == 1);
+            }
+            if (write) {
+                lw = 1;
+                if (input.flush_per_write != 0)
+                    fl = ((remote_gen.Next() % input.flush_per_write) == 1);
+            }
+
+            if (trace) {
+                uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+                trace->record(key, (lr ? TimberSaw::TRACE_LOCAL_READ : 0) | (rr ? TimberSaw::TRACE_REMOTE_READ : 0)
+                    | (lw ? TimberSaw::TRACE_LOCAL_WRITE : 0) | (fl ? TimberSaw::TRACE_FLUSH : 0), timestamp);
+            }
 
-        size_t lr = 0, rr = 0, lw = 0, fl = 0;
-        if (type_gen.Uniform(100) < input.rw_p) {
-            lr = 1;
-            if (input.remote_read_per_read != 0)
-                rr = ((remote_gen.Next() % input.remote_read_per_read) == 1);
+
+            issue_op(loads, router, key, lr, rr, lw, fl);
         }
-        else {
-            lw = 1;
-            if (input.flush_per_write != 0)
-               fl = ((remote_gen.Next() % input.flush_per_write) == 1);
+    }
+
+    if (trace) {
+        trace->close();
+        LOGF(stdout, "recorded %lu ops into %s\n", trace->num_records(), input.trace_record_path.c_str());
+    }
+}
+
+void trace_replayer(TimberSaw::Load_Balancer& /* lb */, load_vector& loads, TimberSaw::Trace_Reader& trace) {
+    TimberSaw::Site_Shared_Mutex::set_thread_name("trace_replayer");
+    TimberSaw::Routing_Table::Reader router(routing_table);
+    TimberSaw::Trace_Record rec;
+    size_t num_ops = 0;
+    auto start_time = std::chrono::steady_clock::now();
+
+    while (trace.next(rec)) {
+        if (input.replay_pacing) {
+            auto due = start_time + std::chrono::nanoseconds(rec.timestamp);
+            auto now = std::chrono::steady_clock::now();
+            if (due > now + std::chrono::microseconds(50)) {
+                usleep(std::chrono::duration_cast<std::chrono::microseconds>(due - now).count());
+            }
         }
-        
-        #ifdef PRINTER_LOCK
-        print_mtx.lock_shared();
-        #endif
-        loads.increment_load(key, lr, rr, lw, fl);
-        #ifdef PRINTER_LOCK
-        print_mtx.unlock_shared();
-        #endif
+
+        issue_op(loads, router, rec.key, rec.lr(), rec.rr(), rec.lw(), rec.fl());
+        ++num_ops;
     }
+
+    LOGF(stdout, "replayed %lu ops from %s\n", num_ops, input.trace_replay_path.c_str());
 }
 
-void printer(TimberSaw::Load_Balancer& lb
+void printer(TimberSaw::Load_Balancer& lb, load_vector& loads
     , size_t num_nodes_to_print = 0, size_t num_shards_to_print = 0, size_t num_shards_to_print_per_compute_node = 0) {
 
     TimberSaw::Random64 num_gen(input.random_seed);
     char* buffer = new char[write_buffer_size];
 
-    for (int round = 0;; ++round) {
+    // same layout as the tables in results/table
+    FILE* table = nullptr;
+    std::vector<size_t> node_loads;
+    if (!input.table_output_path.empty()) {
+        table = fopen(input.table_output_path.c_str(), "w");
+        if (table == nullptr) {
+            LOGFC(COLOR_RED, stderr, "could not open %s\n", input.table_output_path.c_str());
+            exit(1);
+        }
+        LOGF(table, "round/node");
+        for (size_t node = 0; node < lb.num_compute(); ++node) {
+            LOGF(table, ",%lu", node);
+        }
+        LOGF(table, ",num_shards,changes,divides\n");
+    }
+
+    for (size_t round = 0; input.num_rounds == 0 || round < input.num_rounds; ++round) {
         sleep(input.print_delay_seconds);
         #ifdef PRINTER_LOCK
         print_mtx.lock();
         lb.pause();
         #endif
         #ifdef PRINT_COLORED
-        sprintf(buffer + strlen(buffer), COLOR_BLUE "round: %d" COLOR_RESET "\n", round);
+        sprintf(buffer + strlen(buffer), COLOR_BLUE "round: %lu" COLOR_RESET "\n", round);
         #else
-        sprintf(buffer + strlen(buffer), "round: %d\n", round);
+        sprintf(buffer + strlen(buffer), "round: %lu\n", round);
         #endif
         if (round % input.print_per_round == 0) {
+            if (table != nullptr) {
+                size_t changes, divides;
+                lb.round_loads(node_loads);
+                lb.take_plan_stats(changes, divides);
+                LOGF(table, "%lu", round);
+                for (size_t load : node_loads) {
+                    LOGF(table, ",%lu", load);
+                }
+                LOGF(table, ",%lu,", lb.num_shards());
+                if (changes != 0) {
+                    LOGF(table, "%lu", changes);
+                }
+                LOGF(table, ",");
+                if (divides != 0) {
+                    LOGF(table, "%lu", divides);
+                }
+                LOGF(table, "\n");
+                fflush(table);
+            }
             lb.print(buffer, num_nodes_to_print, num_shards_to_print, num_shards_to_print_per_compute_node);
         }
+        if (latency_model) {
+            latency_model->report(buffer, num_nodes_to_print);
+        }
+        if (migration_model) {
+            migration_model->report(buffer, latency_model->now());
+        }
+        routing_table.report(buffer);
+        if (period_controller) {
+            period_controller->report(buffer);
+        }
+        if (checkpoint_writer) {
+            checkpoint_writer->report(buffer);
+        }
+        #ifdef PROFILE_LOCKS
+        loads.report_locks(buffer);
+        #endif
 
         LOGF(stdout, "%s", buffer);
         #ifdef PRINTER_LOCK
@@ -398,7 +989,38 @@ void printer(TimberSaw::Load_Balancer& lb
         memset(buffer, 0, write_buffer_size);
     }
 
+    if (table != nullptr) {
+        fclose(table);
+    }
     delete[] buffer;
+    // the other threads never return
+    fflush(stdout);
+    _exit(0);
+}
+
+// drains the round metrics of the load balancer without blocking it
+void metrics_reporter(TimberSaw::Load_Balancer& lb, FILE* out) {
+    TimberSaw::Round_Metrics metrics;
+    if (input.metrics_format == 'c') {
+        TimberSaw::Round_Metrics::write_csv_header(out);
+    }
+
+    while (true) {
+        usleep(100000);
+        bool written = false;
+        while (lb.pop_round_metrics(metrics)) {
+            if (input.metrics_format == 'c') {
+                metrics.write_csv(out);
+            }
+            else {
+                metrics.write_json(out);
+            }
+            written = true;
+        }
+        if (written) {
+            fflush(out);
+        }
+    }
 }
 
 int main(int argc, char **argv) {
@@ -417,25 +1039,111 @@ int main(int argc, char **argv) {
         lb = new TimberSaw::Dynamic_Load_Balancer(input.num_compute, input.num_shard_per_compute
             , input.rebalance_period_seconds, input.load_imbalance_ratio, input.low_load_thresh);
     }
-    else {
-        // throw std::invalid_argument("not implemented");
+    else if (input.lb_type == 'r') {
         lb = new TimberSaw::Dynamic_Restricted_Load_Balancer(input.num_compute, input.num_shard_per_compute
             , input.rebalance_period_seconds, input.load_imbalance_ratio, input.low_load_thresh);
     }
+    else if (input.lb_type == 'h') {
+        lb = new TimberSaw::Hierarchical_Load_Balancer(input.num_compute, input.num_shard_per_compute
+            , input.rebalance_period_seconds, input.load_imbalance_ratio, input.low_load_thresh
+            , input.group_size, input.planner_threads);
+    }
+    else if (input.lb_type == 'c') {
+        lb = new TimberSaw::Consistent_Hashing_Load_Balancer(input.num_compute, input.num_shard_per_compute
+            , input.rebalance_period_seconds, input.load_imbalance_ratio, input.low_load_thresh
+            , input.virtual_nodes, input.load_bound_percent);
+    }
+    else {
+        lb = new TimberSaw::Pairwise_Load_Balancer(input.num_compute, input.num_shard_per_compute
+            , input.rebalance_period_seconds, input.load_imbalance_ratio, input.low_load_thresh
+            , input.num_pairs, input.pair_choice == 'w', input.planner_threads, input.random_seed);
+    }
     
     load_vector loads(input.key_lb, input.key_ub, *lb
         , input.local_read_time, input.remote_read_time, input.local_write_time, input.flush_time, input.min_shard_size);
     lb->set_vector(loads);
+    lb->set_renumbering(input.renumber_shards);
+    lb->set_memory_nodes(input.num_memory, input.memory_capacity);
+    try {
+        if (!input.restore_path.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            TimberSaw::Checkpoint_Reader checkpoint(input.restore_path);
+            lb->restore(checkpoint);
+            LOGF(stdout, "restored %lu shards from %s in %.3f ms\n", lb->num_shards(), input.restore_path.c_str()
+                , std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0);
+        }
+        if (!input.warm_start_path.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            // a bucket per key up to 2^20 keys(24MB of buckets), as the load inside a bucket is taken as uniform and
+            // the hot keys of a skewed trace would be spread over their bucket
+            TimberSaw::Key_Load_Histogram histogram = TimberSaw::Key_Load_Histogram::read(input.warm_start_path
+                , input.key_lb, input.key_ub, std::min(input.key_ub - input.key_lb, std::max(64 * lb->num_shards(), 1ul << 20))
+                , input.local_read_time, input.remote_read_time, input.local_write_time, input.flush_time);
+            lb->warm_start(histogram);
+            LOGF(stdout, "warm started %lu shards from %lu buckets of %s in %.3f ms\n", lb->num_shards(), histogram.buckets().size()
+                , input.warm_start_path.c_str()
+                , std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0);
+        }
+        if (!input.checkpoint_path.empty()) {
+            checkpoint_writer.reset(new TimberSaw::Checkpoint_Writer(input.checkpoint_path));
+            lb->set_checkpoint(checkpoint_writer.get(), input.checkpoint_period);
+        }
+    } catch(std::exception& e) {
+        LOGFC(COLOR_RED, stderr, "%s\n", e.what());
+        exit(1);
+    }
+    lb->set_routing_table(&routing_table);
+    if (input.min_rebalance_period_ms != 0) {
+        period_controller.reset(new TimberSaw::Period_Controller(input.min_rebalance_period_ms, input.max_rebalance_period_ms
+            , input.max_busy_percent));
+        lb->set_period_controller(period_controller.get());
+    }
+    lb->set_migration_damping(input.cooldown_rounds, input.hysteresis_percent);
+    lb->set_locality_aware(input.locality_aware);
+    if (input.queue_capacity != 0) {
+        latency_model.reset(new TimberSaw::Latency_Model(input.num_compute, input.queue_capacity, input.op_interval));
+    }
+    if (input.migration_bandwidth != 0) {
+        migration_model.reset(new TimberSaw::Migration_Model(input.num_compute, input.migration_bandwidth, input.memory_bandwidth
+            , input.bytes_per_key, input.migration_policy, input.redirect_time
+            , []() { return latency_model->now(); }, [&loads](size_t shard) { return loads.shard_num_keys(shard); }));
+        lb->add_plan_sink(migration_model.get());
+    }
 
-    std::thread t1(printer, std::ref(*lb)
+    std::thread t1(printer, std::ref(*lb), std::ref(loads)
         , input.num_nodes_to_print, input.num_shards_to_print, input.num_shards_to_print_per_compute_node);
     std::thread t2(send_info, std::ref(loads), std::ref(*lb));
+    std::thread t4;
+    if (!input.metrics_output_path.empty()) {
+        FILE* metrics_out = fopen(input.metrics_output_path.c_str(), "w");
+        if (metrics_out == nullptr) {
+            LOGFC(COLOR_RED, stderr, "could not open %s\n", input.metrics_output_path.c_str());
+            exit(1);
+        }
+        t4 = std::thread(metrics_reporter, std::ref(*lb), metrics_out);
+    }
     // for (size_t i = 0; i < input.num_compute * input.num_shard_per_compute; ++i) {
     //     // std::cout << i << " hi\n";
     //     loads[i].shard_id = i;
     // }
-    std::thread t3(load_generator, std::ref(*lb), std::ref(loads));
+    std::unique_ptr<TimberSaw::Trace_Reader> trace;
+    if (!input.trace_replay_path.empty()) {
+        try {
+            trace.reset(new TimberSaw::Trace_Reader(input.trace_replay_path));
+        } catch(std::exception& e) {
+            LOGFC(COLOR_RED, stderr, "%s\n", e.what());
+            exit(1);
+        }
+        if (trace->header().key_lb < input.key_lb || trace->header().key_ub > input.key_ub) {
+            LOGFC(COLOR_RED, stderr, "trace key range [%lu, %lu) does not fit in [%lu, %lu)\n"
+                , trace->header().key_lb, trace->header().key_ub, input.key_lb, input.key_ub);
+            exit(1);
+        }
+    }
+    std::thread t3 = (trace ? std::thread(trace_replayer, std::ref(*lb), std::ref(loads), std::ref(*trace))
+                            : std::thread(load_generator, std::ref(*lb), std::ref(loads)));
     
+    TimberSaw::Site_Shared_Mutex::set_thread_name("load_balancer");
     lb->start();
 
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <algorithm>
 #include <cstring>
+#include <stdexcept>
+#include <string>
 
 namespace TimberSaw {
 
@@ -49,26 +51,22 @@ namespace TimberSaw {
     }
 
 
-    void Load_Info_Container_Base::increment_load_info(size_t shard, size_t added_load) { 
+    void Load_Info_Container_Base::increment_load_info(size_t shard, size_t added_load, size_t remote_reads) { 
         // TODO add memory order
-        Shard_Info& _shard = shard_id(shard);
-        _shard._load.current_load->fetch_add(added_load);
-        #ifdef ANALYZE
-        _shard._load.round_load->fetch_add(added_load);
-        #endif
+        increment_counters(*shard_id(shard)._load.counters, added_load, remote_reads);
     }
 
     void Load_Info_Container_Base::compute_load_and_pass(size_t& min_load, size_t& max_load, size_t& mean_load, size_t& sum_load) {
         updates.clear();
         ordered_nodes.clear();
         max_load_change = 0;
-        cnodes[0].compute_load_and_pass();
+        cnodes[0].compute_load_and_pass(load_scale);
         sum_load = cnodes[0]._overal_load;
         min_load = cnodes[0]._overal_load;
         max_load = cnodes[0]._overal_load;
         ordered_nodes.insert({cnodes[0]._overal_load, 0});
         for (size_t i = 1; i < cnodes.size(); ++i) {
-            cnodes[i].compute_load_and_pass();
+            cnodes[i].compute_load_and_pass(load_scale);
             sum_load += cnodes[i]._overal_load;
             if (min_load > cnodes[i]._overal_load) {
                 min_load = cnodes[i]._overal_load;
@@ -82,6 +80,164 @@ namespace TimberSaw {
         mean_load = sum_load / cnodes.size();
     }
 
+    void Load_Info_Container_Base::set_memory_nodes(size_t num_memory) {
+        assert(num_memory > 0);
+        size_t counter = 0;
+        for (size_t shard = 0; shard < shards.size(); shard = shards[shard].next_id(), ++counter) {
+            shards[shard]._memory = counter * num_memory / shards.size();
+        }
+        assert(counter == shards.size());
+    }
+
+    bool Load_Info_Container_Base::key_order(std::vector<uint32_t>& old_to_new) {
+        old_to_new.resize(shards.size());
+        bool changed = false;
+        size_t position = 0;
+        for (size_t shard = 0; shard != shards.size(); shard = shards[shard].next_id(), ++position) {
+            assert(position < shards.size());
+            old_to_new[shard] = position;
+            changed |= (shard != position);
+        }
+        assert(position == shards.size());
+        return changed;
+    }
+
+    void Load_Info_Container_Base::renumber(const std::vector<uint32_t>& old_to_new) {
+        size_t num = shards.size();
+        assert(old_to_new.size() == num);
+        renumber_buffer.resize(num);
+        for (size_t shard = 0; shard < num; ++shard) {
+            renumber_buffer[old_to_new[shard]] = shards[shard];
+        }
+        for (size_t shard = 0; shard < num; ++shard) {
+            shards[shard] = renumber_buffer[shard];
+            shards[shard]._id = shard;
+            shards[shard]._next_shard_id = shard + 1;
+            shards[shard]._prev_shard_id = shard - 1;
+        }
+        shards[0]._prev_shard_id = num;
+        last_shard_id = num - 1;
+
+        for (Compute_Node_Info& cnode : cnodes) {
+            for (uint32_t& shard : cnode._shards) {
+                shard = old_to_new[shard];
+            }
+            cnode.first_id = old_to_new[cnode.first_id];
+            cnode.last_id = old_to_new[cnode.last_id];
+        }
+        for (Owner_Ship_Transfer& update : updates) {
+            update.shard = old_to_new[update.shard];
+        }
+    }
+
+    void Load_Info_Container_Base::checkpoint(std::vector<Checkpoint_Shard>& records) {
+        records.resize(shards.size());
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            const Shard_Info& info = shards[shard];
+            records[shard].last_load = info._load.last_load;
+            records[shard].last_remote_reads = info._load.last_remote_reads;
+            records[shard].next = info._next_shard_id;
+            records[shard].prev = info._prev_shard_id;
+            records[shard].owner = info._owner;
+            records[shard].memory = info._memory;
+        }
+    }
+
+    void Load_Info_Container_Base::check_restore(const Checkpoint_Shard* records, size_t num, size_t num_memory) const {
+        if (num < shards.size() || num >= Shard_Info::max_shards) {
+            throw std::runtime_error("the checkpoint has " + std::to_string(num) + " shards, the load balancer starts with "
+                + std::to_string(shards.size()));
+        }
+        for (size_t shard = 0; shard < num; ++shard) {
+            if (records[shard].owner >= cnodes.size() || records[shard].next > num || records[shard].prev > num
+                || records[shard].memory >= num_memory) {
+                throw std::runtime_error("invalid shard " + std::to_string(shard) + " in the checkpoint");
+            }
+        }
+
+        // walks the key order, so the restricted nodes can check that they own consecutive shards
+        std::vector<size_t> node_shards(cnodes.size(), 0), node_last(cnodes.size(), num);
+        size_t position = 0, shard = 0, prev = num;
+        for (; shard != num && position < num; prev = shard, shard = records[shard].next, ++position) {
+            if (records[shard].prev != prev) {
+                throw std::runtime_error("the shards of the checkpoint are not linked in key order");
+            }
+            size_t owner = records[shard].owner;
+            if (cnodes[owner].by_range && ((node_shards[owner] > 0 && node_last[owner] != prev)
+                || (prev != num && records[prev].owner > owner))) {
+                throw std::runtime_error("the nodes of the checkpoint do not own consecutive key ranges in node order");
+            }
+            node_last[owner] = shard;
+            ++node_shards[owner];
+        }
+        if (shard != num || position != num) {
+            throw std::runtime_error("the shards of the checkpoint are not linked in key order");
+        }
+
+        for (size_t node = 0; node < cnodes.size(); ++node) {
+            if (node_shards[node] == 0) {
+                throw std::runtime_error("node " + std::to_string(node) + " owns no shard in the checkpoint");
+            }
+        }
+    }
+
+    void Load_Info_Container_Base::restore(const Checkpoint_Shard* records, size_t num, size_t num_memory) {
+        check_restore(records, num, num_memory);
+
+        size_t last_size = shards.size();
+        shards.resize(num);
+        for (size_t shard = 0; shard < num; ++shard) {
+            Shard_Info& info = shards[shard];
+            if (shard >= last_size) {
+                info._load.counters = counter_arena.allocate();
+            }
+            info._id = shard;
+            info._owner = records[shard].owner;
+            info._memory = records[shard].memory;
+            info._next_shard_id = records[shard].next;
+            info._prev_shard_id = records[shard].prev;
+            info._load.last_load = records[shard].last_load;
+            info._load.last_remote_reads = records[shard].last_remote_reads;
+            info._num_moves = 0;
+            info._load.counters->current_load.store(0);
+            info._load.counters->current_remote_reads.store(0);
+            info._load.counters->round_load.store(0);
+        }
+
+        for (Compute_Node_Info& cnode : cnodes) {
+            cnode._shards.clear();
+            cnode._num_shards = 0;
+            cnode.first_id = num;
+            cnode.is_sorted = false;
+        }
+        size_t prev = num;
+        for (size_t shard = 0; shard != num; prev = shard, shard = shards[shard].next_id()) {
+            Compute_Node_Info& cnode = cnodes[shards[shard].owner()];
+            if (cnode._num_shards == 0) {
+                cnode.first_id = shard;
+            }
+            cnode.last_id = shard;
+            ++cnode._num_shards;
+            if (!cnode.by_range) {
+                cnode._shards.push_back(shard);
+            }
+        }
+        last_shard_id = prev;
+
+        for (Compute_Node_Info& cnode : cnodes) {
+            cnode.itr.reset();
+        }
+        updates.clear();
+    }
+
+    void Load_Info_Container_Base::memory_traffic(std::vector<size_t>& traffic) {
+        std::fill(traffic.begin(), traffic.end(), 0);
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            assert(shards[shard]._memory < traffic.size());
+            traffic[shards[shard]._memory] += shards[shard].remote_reads();
+        }
+    }
+
     void Load_Info_Container_Base::update_max_load() {
         if (max_load_change == 0)
             return;
@@ -107,12 +263,41 @@ namespace TimberSaw {
         max_load_change += shard.load();
     }
 
+    void Load_Info_Container_Base::change_owner_from_max(size_t shard_idx, size_t to_id) {
+        Compute_Node_Info& from = max_node();
+        Compute_Node_Info& to = cnodes[to_id];
+        Shard_Info& shard = from[shard_idx];
+        assert(shard._owner == from._id && to._id != from._id);
+        auto position = ordered_position(to_id);
+        assert(position != ordered_nodes.end());
+        shard._owner = to._id;
+        to._overal_load += shard.load();
+        updates.push_back({from._id, to._id, shard_idx});
+        ordered_nodes.erase(position);
+        ordered_nodes.insert({to._overal_load, to._id});
+        max_load_change += shard.load();
+    }
+
+    size_t Load_Info_Container_Base::count_runs(std::vector<size_t>& runs) const {
+        runs.assign(cnodes.size(), 0);
+        size_t total = 0, prev_owner = cnodes.size();
+        for (size_t shard = 0; shard != shards.size(); shard = shards[shard].next_id()) {
+            size_t owner = shards[shard].owner();
+            if (owner != prev_owner) {
+                ++runs[owner];
+                ++total;
+            }
+            prev_owner = owner;
+        }
+        return total;
+    }
+
     Load_Info_Container::Load_Info_Container(size_t num_compute, size_t num_shards_per_compute, size_t low_load_threshold) 
         : Load_Info_Container_Base(num_compute, num_shards_per_compute, low_load_threshold) {}
 
     Load_Info_Container::~Load_Info_Container() {}
 
-    std::vector<Owner_Ship_Transfer> Load_Info_Container::apply() {
+    void Load_Info_Container::apply(Plan_Sink& sink) {
         for (auto update : updates) {
             size_t to = update.to;
             size_t shard_id = cnodes[update.from][update.shard].id();
@@ -123,6 +308,10 @@ namespace TimberSaw {
             cnodes[to]._num_shards = cnodes[to]._shards.size();
         }
 
+        // removing in descending index order per node keeps the indices of the pending removals valid
+        std::sort(updates.begin(), updates.end(), [](const Owner_Ship_Transfer& a, const Owner_Ship_Transfer& b) {
+            return a.from < b.from || (a.from == b.from && a.shard > b.shard);
+        });
         for (auto& update : updates) {
             size_t from = update.from;
             size_t shard_index = update.shard;
@@ -136,7 +325,24 @@ namespace TimberSaw {
             update.shard = id;
         }
 
-        return updates;
+        emit_updates(sink);
+    }
+
+    void Load_Info_Container::set_owners(const std::vector<size_t>& owners) {
+        assert(owners.size() == shards.size());
+        for (Compute_Node_Info& cnode : cnodes) {
+            cnode._shards.clear();
+        }
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            assert(owners[shard] < cnodes.size());
+            shards[shard]._owner = owners[shard];
+            cnodes[owners[shard]]._shards.push_back(shard);
+        }
+        for (Compute_Node_Info& cnode : cnodes) {
+            cnode._num_shards = cnode._shards.size();
+            cnode.is_sorted = false;
+            cnode.itr.reset();
+        }
     }
 
     void Load_Info_Container::divide_shard(size_t owner, size_t index, size_t num) { 
@@ -144,25 +350,32 @@ namespace TimberSaw {
 
         Shard_Info* target = &cnodes[owner][index];
         size_t load = target->load() / num;
+        size_t remote_reads = target->remote_reads() / num;
+        size_t memory = target->_memory;
 
         size_t last_size = shards.size();
         target->_load.last_load = load;
+        target->_load.last_remote_reads = remote_reads;
         size_t pre_next = target->_next_shard_id;
         target->_next_shard_id = last_size;
         size_t target_id = target->_id;
         cnodes[owner]._shards.erase(cnodes[owner]._shards.begin() + index);
         auto insertion_idx = std::upper_bound(cnodes[owner]._shards.begin(), cnodes[owner]._shards.end(), target_id, Compute_Node_Info::Shard_Info_Pointer_Cmp{&shards});
-        std::vector<size_t> new_shards;
+        std::vector<uint32_t> new_shards;
         // new_shards.reserve(num);
         new_shards.push_back(target_id);
         // cnodes[owner]._shards.insert(insertion_idx, target);
 
-        shards.resize(last_size + num - 1);
+        assert(last_size + num - 1 < Shard_Info::max_shards);
+        shards.reserve(last_size + num - 1);
         shards[last_size]._prev_shard_id = target_id;
         for (size_t i = 0; i < num - 1; ++i) {
             shards[i + last_size]._id = i + last_size;
             shards[i + last_size]._owner = owner;
             shards[i + last_size]._load.last_load = load;
+            shards[i + last_size]._load.last_remote_reads = remote_reads;
+            shards[i + last_size]._memory = memory;
+            shards[i + last_size]._load.counters = counter_arena.allocate();
             shards[i + last_size]._next_shard_id = i + last_size + 1;
             if (i != 0) {
                 shards[i + last_size]._prev_shard_id = i + last_size - 1;
@@ -170,6 +383,7 @@ namespace TimberSaw {
             new_shards.push_back(i + last_size);
             // cnodes[owner]._shards.insert(insertion_idx, &shards[i + last_size]);
         }
+        shards.resize(last_size + num - 1); // publishes the new shards after they are filled
 
         if (target_id != last_shard_id) {
             shards.back()._next_shard_id = pre_next;
@@ -184,16 +398,22 @@ namespace TimberSaw {
         cnodes[owner]._num_shards = cnodes[owner]._shards.size();
         shards[0]._prev_shard_id = shards.size();
 
-        #ifdef DEBUG
-        for (size_t i = 0; i < cnodes[owner]._shards.size() - 1; ++i) {
-            assert(cnodes[owner][i].load() <= cnodes[owner][i + 1].load());
+        if (observing(OBSERVE_CHECKS)) {
+            for (size_t i = 0; i < cnodes[owner]._shards.size() - 1; ++i) {
+                assert(cnodes[owner][i].load() <= cnodes[owner][i + 1].load());
+            }
         }
-        #endif
     }
 
     Load_Info_Container_Restricted::Load_Info_Container_Restricted(size_t num_compute, size_t num_shards_per_compute, size_t low_load_threshold) 
         : Load_Info_Container_Base(num_compute, num_shards_per_compute, low_load_threshold)
-        , new_first_last(num_compute, {0, 0}) {}
+        , new_first_last(num_compute, {0, 0}) {
+        // the nodes are only their boundaries on the key ordered shard list
+        for (Compute_Node_Info& cnode : cnodes) {
+            cnode.by_range = true;
+            std::vector<uint32_t>().swap(cnode._shards);
+        }
+    }
 
     Load_Info_Container_Restricted::~Load_Info_Container_Restricted() {}
 
@@ -323,54 +543,43 @@ namespace TimberSaw {
         }
     }
 
-    std::vector<Owner_Ship_Transfer> Load_Info_Container_Restricted::apply() {
+    void Load_Info_Container_Restricted::apply(Plan_Sink& sink) {
         assert(updates.empty());
-        std::map<size_t, Owner_Ship_Transfer> shard_changes;
-        for (auto update : tmp_updates) {
-            size_t from = update.from;
-            size_t to = update.to;
-
-            assert(from < cnodes.size() && to < cnodes.size());
-
-            size_t shard_id = update.shard;
-            assert(shard_id < shards.size());
-
-            auto shard_it = shard_changes.find(shard_id);
-            if (shard_it != shard_changes.end()) {
-                assert(shard_it->second.to == from);
-                shard_it->second.from = from;
-                shard_it->second.to = to;
-                shard_it->second.shard = shard_id;
+        // coalesces the moves of each shard into one transfer from its first owner to its last owner
+        dedup_table.clear(tmp_updates.size());
+        for (const Owner_Ship_Transfer& update : tmp_updates) {
+            assert(update.from < cnodes.size() && update.to < cnodes.size());
+            assert(update.shard < shards.size());
+
+            size_t index = dedup_table.find_or_insert(update.shard, updates.size());
+            if (index == Transfer_Dedup_Table::not_found) {
+                updates.push_back(update);
             }
             else {
-                shard_changes[shard_id] = {from, to, shard_id};
+                assert(updates[index].to == update.from);
+                updates[index].to = update.to;
             }
         }
         tmp_updates.clear();
 
-        for (auto update : shard_changes) {
-            assert(update.second.shard == update.first);
-            assert(shards[update.first].owner() == update.second.to);
-            updates.push_back(update.second);
-        }   
-
-        for (Compute_Node_Info& cnode : cnodes) {
-            cnode._shards.clear();
-            size_t first = cnode.first_id;
-            size_t last = cnode.last_id;
-            size_t i = 0;
-            assert(cnode._num_shards > 0);
-            for (; i < cnode._num_shards && first != shards[last].next_id(); ++i, first = shards[first].next_id()) {
-                assert(shards[first].owner() == cnode._id);
-                assert(shards[first].next_id() == shards.size() || shards[shards[first].next_id()].prev_id() == first);
-                assert(shards[first].prev_id() == shards.size() || shards[shards[first].prev_id()].next_id() == first);
-                cnode._shards.push_back(first);
+        // drops the shards that came back to their first owner
+        size_t num_updates = 0;
+        for (const Owner_Ship_Transfer& update : updates) {
+            assert(shards[update.shard].owner() == update.to);
+            if (update.from != update.to) {
+                updates[num_updates++] = update;
             }
-            assert(i == cnode._num_shards && first == shards[last].next_id());
-            assert(cnode._shards.size() == cnode._num_shards);
         }
+        updates.resize(num_updates);
 
-        return updates;
+        // the moves already updated the node boundaries, so only they are checked
+        for (size_t i = 0; i < cnodes.size(); ++i) {
+            assert(cnodes[i]._num_shards > 0);
+            assert(shards[cnodes[i].first_id].owner() == i && shards[cnodes[i].last_id].owner() == i);
+            assert(i == cnodes.size() - 1 || shards[cnodes[i].last_id].next_id() == cnodes[i + 1].first_id);
+        }
+
+        emit_updates(sink);
     }
 
     void Load_Info_Container_Restricted::divide_shard(size_t owner, size_t shard_id, size_t num) { 
@@ -380,32 +589,38 @@ namespace TimberSaw {
         assert(target->owner() == owner);
         // assert(target->id() == cnodes[owner].first_id || target->id() == cnodes[owner].last_id);
         size_t load = target->load() / num;
+        size_t remote_reads = target->remote_reads() / num;
+        size_t memory = target->_memory;
 
         size_t last_size = shards.size();
         target->_load.last_load = load;
+        target->_load.last_remote_reads = remote_reads;
         size_t pre_next = target->_next_shard_id;
         target->_next_shard_id = last_size;
         size_t target_id = target->_id;
-        #ifdef ANALYZE
-        target->_load.round_load->store(0);
-        #endif
+        target->_load.counters->round_load.store(0);
         // cnodes[owner]._shards.erase(cnodes[owner]._shards.begin() + index);
         // auto insertion_idx = std::upper_bound(cnodes[owner]._shards.begin(), cnodes[owner]._shards.end(), target_id, Compute_Node_Info::Shard_Info_Pointer_Cmp{&shards});
         // new_shards.push_back(target_id);
         // cnodes[owner]._shards.insert(insertion_idx, target);
 
-        shards.resize(last_size + num - 1);
+        assert(last_size + num - 1 < Shard_Info::max_shards);
+        shards.reserve(last_size + num - 1);
         shards[last_size]._prev_shard_id = target_id;
         for (size_t i = 0; i < num - 1; ++i) {
             shards[i + last_size]._id = i + last_size;
             shards[i + last_size]._owner = owner;
             shards[i + last_size]._load.last_load = load;
+            shards[i + last_size]._load.last_remote_reads = remote_reads;
+            shards[i + last_size]._memory = memory;
+            shards[i + last_size]._load.counters = counter_arena.allocate();
             shards[i + last_size]._next_shard_id = i + last_size + 1;
             if (i != 0) {
                 shards[i + last_size]._prev_shard_id = i + last_size - 1;
             }
             // cnodes[owner]._shards.insert(insertion_idx, &shards[i + last_size]);
         }
+        shards.resize(last_size + num - 1); // publishes the new shards after they are filled
 
         if (target_id != last_shard_id) {
             shards.back()._next_shard_id = pre_next;
@@ -423,19 +638,19 @@ namespace TimberSaw {
         cnodes[owner]._num_shards += num - 1;
         shards[0]._prev_shard_id = shards.size();
 
-        #ifdef DEBUG
-        for (Compute_Node_Info& cnode : cnodes) {
-            size_t first = cnode.first_id;
-            size_t last = cnode.last_id;
-            size_t i = 0;
-            assert(cnode._num_shards > 0);
-            for (; i < cnode._num_shards && first != shards[last].next_id(); ++i, first = shards[first].next_id()) {
-                assert(shards[first].owner() == cnode._id);
-                assert(shards[first].next_id() == shards.size() || shards[shards[first].next_id()].prev_id() == first);
-                assert(shards[first].prev_id() == shards.size() || shards[shards[first].prev_id()].next_id() == first);
-            }
-            assert(i == cnode._num_shards && first == shards[last].next_id());
-        }
-        #endif
+        if (observing(OBSERVE_CHECKS)) {
+            for (Compute_Node_Info& cnode : cnodes) {
+                size_t first = cnode.first_id;
+                size_t last = cnode.last_id;
+                size_t i = 0;
+                assert(cnode._num_shards > 0);
+                for (; i < cnode._num_shards && first != shards[last].next_id(); ++i, first = shards[first].next_id()) {
+                    assert(shards[first].owner() == cnode._id);
+                    assert(shards[first].next_id() == shards.size() || shards[shards[first].next_id()].prev_id() == first);
+                    assert(shards[first].prev_id() == shards.size() || shards[shards[first].prev_id()].next_id() == first);
+                }
+                assert(i == cnode._num_shards && first == shards[last].next_id());
+            }
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "lock_profiler.h"
+#include "testlog.h"
+
+#include <cstring>
+
+namespace TimberSaw {
+
+    void Profiled_Shared_Mutex::report(char* buffer) {
+        uint64_t elapsed = read_tsc() - start;
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_GREEN "lock profile over %lu cycles(wait p50/p99/p999, hold p50/p99/p999 in cycles):" COLOR_RESET "\n", elapsed);
+        #else
+        sprintf(buffer + strlen(buffer), "lock profile over %lu cycles(wait p50/p99/p999, hold p50/p99/p999 in cycles):\n", elapsed);
+        #endif
+
+        std::lock_guard<std::mutex> lock(registry_mtx);
+        std::vector<uint64_t> wait_all[NUM_LOCK_SITES], hold_all[NUM_LOCK_SITES];
+        uint64_t contended_all[NUM_LOCK_SITES] = {}, wait_cycles_all[NUM_LOCK_SITES] = {}, hold_cycles_all[NUM_LOCK_SITES] = {};
+        uint64_t blocked_by_all[NUM_LOCK_SITES][NUM_LOCK_SITES + 1] = {};
+
+        for (auto& stats : registry) {
+            for (size_t site = 0; site < NUM_LOCK_SITES; ++site) {
+                stats->wait[site].drain(stats->wait_snapshot[site]);
+                stats->hold[site].drain(stats->hold_snapshot[site]);
+                uint64_t num = Latency_Histogram::total(stats->wait_snapshot[site]);
+                if (num == 0) {
+                    continue;
+                }
+
+                uint64_t waited = stats->wait_cycles[site].load(std::memory_order_relaxed);
+                uint64_t held = stats->hold_cycles[site].load(std::memory_order_relaxed);
+                sprintf(buffer + strlen(buffer), "%s %s: %lu acquisitions, %lu contended, waited %.2f%%, held %.2f%% of the time\n"
+                    , stats->name.c_str(), lock_site_name(site), num, stats->contended[site].load(std::memory_order_relaxed)
+                    , 100.0 * waited / elapsed, 100.0 * held / elapsed);
+
+                wait_all[site].resize(Latency_Histogram::num_buckets, 0);
+                hold_all[site].resize(Latency_Histogram::num_buckets, 0);
+                for (size_t i = 0; i < Latency_Histogram::num_buckets; ++i) {
+                    wait_all[site][i] += stats->wait_snapshot[site][i];
+                    hold_all[site][i] += stats->hold_snapshot[site][i];
+                }
+                contended_all[site] += stats->contended[site].load(std::memory_order_relaxed);
+                wait_cycles_all[site] += waited;
+                hold_cycles_all[site] += held;
+                for (size_t holder = 0; holder <= NUM_LOCK_SITES; ++holder) {
+                    blocked_by_all[site][holder] += stats->blocked_by[site][holder].load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        for (size_t site = 0; site < NUM_LOCK_SITES; ++site) {
+            if (wait_all[site].empty()) {
+                continue;
+            }
+            sprintf(buffer + strlen(buffer), "%s: %lu acquisitions, %lu contended, %lu/%lu/%lu, %lu/%lu/%lu, %lu cycles waited, %lu cycles held\n"
+                , lock_site_name(site), Latency_Histogram::total(wait_all[site]), contended_all[site]
+                , Latency_Histogram::percentile(wait_all[site], 0.5), Latency_Histogram::percentile(wait_all[site], 0.99)
+                , Latency_Histogram::percentile(wait_all[site], 0.999)
+                , Latency_Histogram::percentile(hold_all[site], 0.5), Latency_Histogram::percentile(hold_all[site], 0.99)
+                , Latency_Histogram::percentile(hold_all[site], 0.999), wait_cycles_all[site], hold_cycles_all[site]);
+
+            if (contended_all[site] == 0) {
+                continue;
+            }
+            sprintf(buffer + strlen(buffer), "    blocked by");
+            for (size_t holder = 0; holder <= NUM_LOCK_SITES; ++holder) {
+                if (blocked_by_all[site][holder] != 0) {
+                    sprintf(buffer + strlen(buffer), " %s: %lu cycles", lock_site_name(holder), blocked_by_all[site][holder]);
+                }
+            }
+            sprintf(buffer + strlen(buffer), "\n");
+        }
+        sprintf(buffer + strlen(buffer), "\n");
+    }
+}
@@ -0,0 +1,121 @@
+#include "migration_model.h"
+#include "testlog.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+
+namespace TimberSaw {
+
+    Migration_Model::Migration_Model(size_t num_compute, size_t node_bandwidth, size_t memory_bandwidth, size_t bytes_per_key
+        , char policy, size_t redirect_time, std::function<uint64_t()> clock, std::function<size_t(size_t)> shard_num_keys)
+        : clock(std::move(clock)), shard_num_keys(std::move(shard_num_keys)), num_in_flight(0), send_free_at(num_compute, 0), receive_free_at(num_compute, 0)
+        , node_bandwidth(node_bandwidth), memory_bandwidth(memory_bandwidth), bytes_per_key(bytes_per_key)
+        , policy(policy), redirect_time(redirect_time) {
+        assert(node_bandwidth > 0);
+        assert(policy == MIGRATION_STALL || policy == MIGRATION_REDIRECT);
+    }
+
+    void Migration_Model::begin_plan(size_t /* num_transfers */) {
+        mtx.lock();
+        plan_time = clock();
+        remove_finished(plan_time);
+        plan_bandwidth = (memory_bandwidth == 0 ? node_bandwidth : std::min(node_bandwidth, memory_bandwidth));
+    }
+
+    void Migration_Model::transfer(const Owner_Ship_Transfer& transfer) {
+        assert(transfer.from < send_free_at.size() && transfer.to < receive_free_at.size());
+        size_t bytes = shard_num_keys(transfer.shard) * bytes_per_key;
+        uint64_t start = std::max(plan_time, std::max(send_free_at[transfer.from], receive_free_at[transfer.to]));
+        if (memory_bandwidth != 0) {
+            start = std::max(start, memory_free_at);
+        }
+        uint64_t end = start + (bytes + plan_bandwidth - 1) / plan_bandwidth;
+
+        send_free_at[transfer.from] = end;
+        receive_free_at[transfer.to] = end;
+        if (memory_bandwidth != 0) {
+            memory_free_at = end;
+        }
+
+        auto it = in_flight.find(transfer.shard);
+        if (it != in_flight.end()) {
+            // moved again before the previous move was finished. ops keep going to the original owner
+            it->second.to = transfer.to;
+            it->second.end = std::max(it->second.end, end);
+        }
+        else {
+            in_flight[transfer.shard] = {transfer.from, transfer.to, end};
+        }
+
+        ++num_started;
+        bytes_started += bytes;
+        last_end = std::max(last_end, end);
+    }
+
+    void Migration_Model::end_plan() {
+        num_in_flight.store(in_flight.size(), std::memory_order_release);
+        mtx.unlock();
+    }
+
+    void Migration_Model::renumber(const std::vector<uint32_t>& old_to_new) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::unordered_map<size_t, In_Flight> renumbered;
+        renumbered.reserve(in_flight.size());
+        for (const auto& [shard, move] : in_flight) {
+            assert(shard < old_to_new.size());
+            renumbered[old_to_new[shard]] = move;
+        }
+        in_flight.swap(renumbered);
+    }
+
+    void Migration_Model::route_slow(size_t shard, uint64_t now, size_t& node, uint64_t& service_time, uint64_t& delay) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = in_flight.find(shard);
+        if (it == in_flight.end()) {
+            return;
+        }
+
+        if (it->second.end <= now) {
+            in_flight.erase(it);
+            num_in_flight.store(in_flight.size(), std::memory_order_release);
+            return;
+        }
+
+        if (policy == MIGRATION_STALL) {
+            node = it->second.to;
+            delay += it->second.end - now;
+            stall_time += it->second.end - now;
+            ++num_stalled;
+        }
+        else {
+            node = it->second.from;
+            service_time += redirect_time;
+            ++num_redirected;
+        }
+    }
+
+    void Migration_Model::remove_finished(uint64_t now) {
+        for (auto it = in_flight.begin(); it != in_flight.end();) {
+            it = (it->second.end <= now ? in_flight.erase(it) : std::next(it));
+        }
+        num_in_flight.store(in_flight.size(), std::memory_order_release);
+    }
+
+    void Migration_Model::report(char* buffer, uint64_t now) {
+        std::lock_guard<std::mutex> lock(mtx);
+        remove_finished(now);
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_GREEN "migrations:" COLOR_RESET " ");
+        #else
+        sprintf(buffer + strlen(buffer), "migrations: ");
+        #endif
+        sprintf(buffer + strlen(buffer), "%lu started(%lu bytes), %lu in flight, last one ends at %lu, %lu ops stalled for %lu, %lu ops redirected\n\n"
+            , num_started, bytes_started, in_flight.size(), last_end, num_stalled, stall_time, num_redirected);
+        num_started = 0;
+        bytes_started = 0;
+        num_stalled = 0;
+        stall_time = 0;
+        num_redirected = 0;
+    }
+}
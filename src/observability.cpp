@@ -0,0 +1,51 @@
+#include "observability.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace TimberSaw {
+
+    uint32_t observed_features = 0;
+
+    uint32_t parse_observed_features(const char* list) {
+        uint32_t features = 0;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item == "all") {
+                features |= observe_all;
+                continue;
+            }
+            if (item == "none") {
+                continue;
+            }
+            size_t feature = 0;
+            while (feature < NUM_OBSERVED_FEATURES && item != observed_feature_name(feature)) {
+                ++feature;
+            }
+            if (feature == NUM_OBSERVED_FEATURES) {
+                throw std::invalid_argument("unknown observed feature " + item);
+            }
+            features |= 1u << feature;
+        }
+        return features;
+    }
+
+    void print_observed_features(char* buffer, uint32_t features) {
+        if (features == 0) {
+            sprintf(buffer + strlen(buffer), "none");
+            return;
+        }
+        const char* separator = "";
+        for (size_t feature = 0; feature < NUM_OBSERVED_FEATURES; ++feature) {
+            if (features & (1u << feature)) {
+                sprintf(buffer + strlen(buffer), "%s%s", separator, observed_feature_name(feature));
+                separator = ",";
+            }
+        }
+    }
+
+}
@@ -0,0 +1,48 @@
+#include "period_controller.h"
+#include "testlog.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace TimberSaw {
+
+    Period_Controller::Period_Controller(size_t min_period_ms, size_t max_period_ms, size_t _max_busy_percent)
+        : min_ms(min_period_ms), max_ms(max_period_ms), current_ms(min_period_ms), max_busy_percent(_max_busy_percent) {
+        assert(min_ms > 0 && min_ms <= max_ms && max_busy_percent > 0 && max_busy_percent <= 100);
+    }
+
+    void Period_Controller::update(const Round_Metrics& metrics, uint64_t round_us) {
+        size_t sum_load = metrics.mean_load * metrics.num_compute;
+        double moved = (sum_load > 0 ? double(metrics.moved_load) / sum_load : 0);
+        bool shifted = (num_rounds > 0 && std::fabs(metrics.max_mean_ratio - last_ratio) >= significant_shift);
+        last_ratio = metrics.max_mean_ratio;
+
+        // a skipped round(no plan) with the same imbalance is stable whatever the imbalance is, as the balancer
+        // found nothing worth moving
+        if (moved >= significant_move || metrics.num_splits + metrics.num_merges > 0 || shifted) {
+            current_ms = min_ms;
+            ++num_shorter;
+        }
+        else if (current_ms < max_ms) {
+            current_ms = std::min(max_ms, current_ms * 2);
+            ++num_longer;
+        }
+
+        size_t cost_ms = (round_us * 100 / max_busy_percent + 999) / 1000;
+        current_ms = std::min(max_ms, std::max(current_ms, cost_ms));
+        sum_period_ms += current_ms;
+        ++num_rounds;
+    }
+
+    void Period_Controller::report(char* buffer) {
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_GREEN "rebalance period:" COLOR_RESET " ");
+        #else
+        sprintf(buffer + strlen(buffer), "rebalance period: ");
+        #endif
+        sprintf(buffer + strlen(buffer), "%lu ms [%lu, %lu], mean %lu ms over %lu rounds, %lu shortened, %lu lengthened\n\n"
+            , current_ms, min_ms, max_ms, num_rounds == 0 ? 0 : sum_period_ms / num_rounds, num_rounds, num_shorter, num_longer);
+    }
+}
@@ -0,0 +1,72 @@
+#include "round_metrics.h"
+#include "testlog.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace TimberSaw {
+
+    void Round_Metrics::compute_imbalance(std::vector<size_t>& node_loads, std::vector<size_t>& shard_loads) {
+        num_compute = node_loads.size();
+        num_shards = shard_loads.size();
+        assert(num_compute > 0);
+
+        std::sort(node_loads.begin(), node_loads.end());
+        double sum = 0, weighted_sum = 0;
+        for (size_t i = 0; i < node_loads.size(); ++i) {
+            sum += node_loads[i];
+            weighted_sum += static_cast<double>(i + 1) * node_loads[i];
+        }
+        double mean = sum / num_compute;
+        double var = 0;
+        for (size_t load : node_loads) {
+            var += (load - mean) * (load - mean);
+        }
+        var /= num_compute;
+
+        max_load = node_loads.back();
+        mean_load = static_cast<size_t>(mean);
+        max_mean_ratio = (mean > 0 ? max_load / mean : 0);
+        cov = (mean > 0 ? std::sqrt(var) / mean : 0);
+        gini = (sum > 0 ? (2.0 * weighted_sum) / (num_compute * sum) - (num_compute + 1.0) / num_compute : 0);
+
+        if (!shard_loads.empty()) {
+            auto p99 = shard_loads.begin() + (shard_loads.size() - 1) * 99 / 100;
+            std::nth_element(shard_loads.begin(), p99, shard_loads.end());
+            p99_shard_load = *p99;
+        }
+    }
+
+    void Round_Metrics::write_csv_header(FILE* out) {
+        LOGF(out, "round,period_ms,num_compute,num_shards,max_load,mean_load,max_mean_ratio,cov,gini,p99_shard_load"
+            ",moved_load,num_transfers,num_splits,num_merges,num_ping_pongs,num_held_back,num_runs,max_node_runs,max_memory_traffic,num_memory_moves");
+        for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+            LOGF(out, ",%s_cycles", phase_name(phase));
+        }
+        LOGF(out, "\n");
+    }
+
+    void Round_Metrics::write_csv(FILE* out) const {
+        LOGF(out, "%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f,%.4f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu", round, period_ms, num_compute, num_shards, max_load, mean_load
+            , max_mean_ratio, cov, gini, p99_shard_load, moved_load, num_transfers, num_splits, num_merges
+            , num_ping_pongs, num_held_back, num_runs, max_node_runs, max_memory_traffic, num_memory_moves);
+        for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+            LOGF(out, ",%lu", phase_cycles[phase]);
+        }
+        LOGF(out, "\n");
+    }
+
+    void Round_Metrics::write_json(FILE* out) const {
+        LOGF(out, "{\"round\": %lu, \"period_ms\": %lu, \"num_compute\": %lu, \"num_shards\": %lu, \"max_load\": %lu, \"mean_load\": %lu"
+            ", \"max_mean_ratio\": %.4f, \"cov\": %.4f, \"gini\": %.4f, \"p99_shard_load\": %lu, \"moved_load\": %lu"
+            ", \"num_transfers\": %lu, \"num_splits\": %lu, \"num_merges\": %lu, \"num_ping_pongs\": %lu, \"num_held_back\": %lu, \"num_runs\": %lu, \"max_node_runs\": %lu, \"max_memory_traffic\": %lu, \"num_memory_moves\": %lu"
+            , round, period_ms, num_compute, num_shards, max_load, mean_load, max_mean_ratio, cov, gini, p99_shard_load, moved_load
+            , num_transfers, num_splits, num_merges, num_ping_pongs, num_held_back, num_runs, max_node_runs, max_memory_traffic, num_memory_moves);
+        for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+            LOGF(out, ", \"%s_cycles\": %lu", phase_name(phase), phase_cycles[phase]);
+        }
+        LOGF(out, "}\n");
+    }
+}
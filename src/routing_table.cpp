@@ -0,0 +1,98 @@
+#include "routing_table.h"
+#include "testlog.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace TimberSaw {
+
+    Routing_Table::~Routing_Table() {
+        delete current.load();
+        for (auto& snapshot : retired) {
+            delete snapshot.second;
+        }
+        for (Routing_Snapshot* snapshot : spare) {
+            delete snapshot;
+        }
+    }
+
+    Routing_Table::Reader::Reader(Routing_Table& table) : table(table), slot(nullptr) {
+        for (size_t i = 0; i < max_readers; ++i) {
+            bool used = false;
+            if (table.slots[i].used.compare_exchange_strong(used, true)) {
+                slot = &table.slots[i];
+                return;
+            }
+        }
+        throw std::runtime_error("routing table has no free reader slot");
+    }
+
+    Routing_Table::Reader::~Reader() {
+        assert(slot->epoch.load() == idle);
+        slot->used.store(false, std::memory_order_release);
+    }
+
+    Routing_Snapshot* Routing_Table::begin_update() {
+        reclaim();
+        Routing_Snapshot* snapshot;
+        if (spare.empty()) {
+            snapshot = new Routing_Snapshot();
+        }
+        else {
+            snapshot = spare.back();
+            spare.pop_back();
+        }
+        snapshot->clear();
+        return snapshot;
+    }
+
+    void Routing_Table::publish(Routing_Snapshot* snapshot) {
+        assert(!snapshot->upper_bounds.empty());
+        snapshot->version = next_version++;
+        Routing_Snapshot* old = current.exchange(snapshot, std::memory_order_seq_cst);
+        uint64_t old_epoch = epoch.fetch_add(1, std::memory_order_seq_cst);
+        published_version.store(snapshot->version, std::memory_order_release);
+        if (old != nullptr) {
+            retired.push_back({old_epoch, old});
+            num_retired.store(retired.size(), std::memory_order_relaxed);
+        }
+        reclaim();
+    }
+
+    void Routing_Table::reclaim() {
+        if (retired.empty()) {
+            return;
+        }
+
+        uint64_t min_epoch = UINT64_MAX;
+        for (size_t i = 0; i < max_readers; ++i) {
+            uint64_t e = slots[i].epoch.load(std::memory_order_seq_cst);
+            if (e != idle && e < min_epoch) {
+                min_epoch = e;
+            }
+        }
+
+        size_t num_kept = 0;
+        for (auto& snapshot : retired) {
+            if (snapshot.first < min_epoch) {
+                spare.push_back(snapshot.second);
+                num_reclaimed.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                retired[num_kept++] = snapshot;
+            }
+        }
+        retired.resize(num_kept);
+        num_retired.store(num_kept, std::memory_order_relaxed);
+    }
+
+    void Routing_Table::report(char* buffer) {
+        #ifdef PRINT_COLORED
+        sprintf(buffer + strlen(buffer), COLOR_GREEN "routing table:" COLOR_RESET " ");
+        #else
+        sprintf(buffer + strlen(buffer), "routing table: ");
+        #endif
+        sprintf(buffer + strlen(buffer), "version %lu, %lu snapshots waiting for readers, %lu reclaimed\n\n"
+            , version(), num_retired.load(std::memory_order_relaxed), num_reclaimed.load(std::memory_order_relaxed));
+    }
+}
@@ -0,0 +1,310 @@
+#include "testlog.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include <filesystem>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Runs the simulator over a grid of inputs. Every configuration runs as a separate
+ * load_balancer_test process(up to --jobs at a time) which writes its own table.
+ * A summary of the last printed round of every configuration is written to summary.csv.
+ */
+struct Sweep_Input {
+    vector<string> lb_type = {"f", "d", "r"}; // --lb_type -lt
+    vector<string> num_compute = {"8"}; // --num_compute -nc
+    vector<string> num_shard_per_compute = {"1"}; // --num_shard_per_compute -nspc
+    vector<string> load_imbalance_ratio = {"100"}; // --load_imbalance_ratio -lir
+    vector<string> workload = {"x"}; // --workload -wl
+    vector<string> random_seed = {"65406"}; // --random_seed -rs
+    string num_rounds = "30"; // --num_rounds -nr
+    string out_dir = "results/sweep"; // --out_dir -od
+    string simulator; // --simulator -sim defaults to load_balancer_test next to the sweep binary
+    string extra; // --extra -ex arguments passed to every run
+    size_t jobs = 0; // --jobs -j 0 means one job per core
+};
+
+struct Config {
+    string lb_type, num_compute, num_shard_per_compute, load_imbalance_ratio, workload, random_seed;
+
+    string name() const {
+        return lb_type + "_nc" + num_compute + "_nspc" + num_shard_per_compute + "_lir" + load_imbalance_ratio
+            + "_wl" + workload + "_rs" + random_seed;
+    }
+};
+
+Sweep_Input input;
+
+void help() {
+    LOGF(stderr, "USAGE: ./sweep [OPTIONS]\n\
+        \tOPTIONS:\n\
+            \t\t--help, -h -> for printing this message\n\
+            \t\t--lb_type=<list>, -lt=<list> -> load balancing types to run out of [f, d, r, h, c, p]. default is f,d,r.\n\
+            \t\t--num_compute=<list>, -nc=<list> -> numbers of compute nodes. default is 8.\n\
+            \t\t--num_shard_per_compute=<list>, -nspc=<list> -> numbers of shards per compute node. default is 1.\n\
+            \t\t--load_imbalance_ratio=<list>, -lir=<list> -> load imbalance ratios. default is 100.\n\
+            \t\t--workload=<list>, -wl=<list> -> workloads. default is x.\n\
+            \t\t--random_seed=<list>, -rs=<list> -> random seeds. default is 65406.\n\
+            \t\t--num_rounds=<number>, -nr=<number> -> printer rounds of every run. default is 30.\n\
+            \t\t--out_dir=<path>, -od=<path> -> tables go to <path>/table, raw outputs to <path>/raw and the summary to <path>/summary.csv. default is results/sweep.\n\
+            \t\t--simulator=<path>, -sim=<path> -> path of load_balancer_test. default is the one next to this binary.\n\
+            \t\t--extra=<args>, -ex=<args> -> space separated arguments passed to every run, e.g. --extra=\"-rps=1 -nspc=100\".\n\
+            \t\t--jobs=<number>, -j=<number> -> number of runs at a time. 0 means one per core. default is 0.\n\
+        \t<list>: is a comma separated list of values\n");
+}
+
+vector<string> split(const string& str, char delim) {
+    vector<string> res;
+    stringstream ss(str);
+    string item;
+    while (getline(ss, item, delim)) {
+        if (!item.empty()) {
+            res.push_back(item);
+        }
+    }
+    return res;
+}
+
+bool get_arg(const char* arg, const char* arg_name, string& res) {
+    size_t len = strlen(arg_name);
+    assert(len > 0 && arg_name[len - 1] == '=');
+
+    if (strncmp(arg, arg_name, len)) {
+        return false;
+    }
+    if (strlen(arg + len) == 0) {
+        throw invalid_argument("no value after argument " + string(arg_name, len - 1));
+    }
+    res = arg + len;
+    return true;
+}
+
+bool get_arg(const char* arg, const char* arg_name, vector<string>& res) {
+    string list;
+    if (!get_arg(arg, arg_name, list)) {
+        return false;
+    }
+    res = split(list, ',');
+    if (res.empty()) {
+        throw invalid_argument("empty list after argument " + string(arg_name, strlen(arg_name) - 1));
+    }
+    return true;
+}
+
+void parse_input(int argc, char** argv) {
+    try {
+        string jobs;
+        for (int i = 1; i < argc; ++i) {
+            if (get_arg(argv[i], "--lb_type=", input.lb_type) || get_arg(argv[i], "-lt=", input.lb_type)) {}
+            else if (get_arg(argv[i], "--num_compute=", input.num_compute) || get_arg(argv[i], "-nc=", input.num_compute)) {}
+            else if (get_arg(argv[i], "--num_shard_per_compute=", input.num_shard_per_compute)
+                || get_arg(argv[i], "-nspc=", input.num_shard_per_compute)) {}
+            else if (get_arg(argv[i], "--load_imbalance_ratio=", input.load_imbalance_ratio)
+                || get_arg(argv[i], "-lir=", input.load_imbalance_ratio)) {}
+            else if (get_arg(argv[i], "--workload=", input.workload) || get_arg(argv[i], "-wl=", input.workload)) {}
+            else if (get_arg(argv[i], "--random_seed=", input.random_seed) || get_arg(argv[i], "-rs=", input.random_seed)) {}
+            else if (get_arg(argv[i], "--num_rounds=", input.num_rounds) || get_arg(argv[i], "-nr=", input.num_rounds)) {}
+            else if (get_arg(argv[i], "--out_dir=", input.out_dir) || get_arg(argv[i], "-od=", input.out_dir)) {}
+            else if (get_arg(argv[i], "--simulator=", input.simulator) || get_arg(argv[i], "-sim=", input.simulator)) {}
+            else if (get_arg(argv[i], "--extra=", input.extra) || get_arg(argv[i], "-ex=", input.extra)) {}
+            else if (get_arg(argv[i], "--jobs=", jobs) || get_arg(argv[i], "-j=", jobs)) {
+                if (strspn(jobs.c_str(), "0123456789") != jobs.size()) {
+                    throw invalid_argument("invalid number " + jobs + " after argument jobs");
+                }
+                input.jobs = stoul(jobs);
+            }
+            else {
+                throw invalid_argument("Unknown argument: " + string(argv[i]));
+            }
+        }
+    } catch(exception& a) {
+        LOGFC(COLOR_RED, stderr, "%s\n", a.what());
+        help();
+        exit(1);
+    }
+
+    if (input.simulator.empty()) {
+        input.simulator = (filesystem::path(argv[0]).parent_path() / "load_balancer_test").string();
+    }
+    if (input.jobs == 0) {
+        input.jobs = max(thread::hardware_concurrency(), 1u);
+    }
+}
+
+// forks a simulator run of config. returns its pid, or -1 if the fork failed
+pid_t launch(const Config& config) {
+    vector<string> args = {input.simulator, "-lt=" + config.lb_type, "-nc=" + config.num_compute
+        , "-nspc=" + config.num_shard_per_compute, "-lir=" + config.load_imbalance_ratio, "-wl=" + config.workload
+        , "-rs=" + config.random_seed, "-nr=" + input.num_rounds, "-to=" + input.out_dir + "/table/load_" + config.name() + ".csv"};
+    for (const string& arg : split(input.extra, ' ')) {
+        args.push_back(arg);
+    }
+
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    string raw = input.out_dir + "/raw/" + config.name();
+    int fd = open(raw.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+
+    vector<char*> argv;
+    for (string& arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    LOGFC(COLOR_RED, stderr, "could not run %s\n", argv[0]);
+    _exit(1);
+}
+
+// appends the summary of the last row of the table of config to summary
+void summarize(const Config& config, FILE* summary) {
+    string path = input.out_dir + "/table/load_" + config.name() + ".csv";
+    FILE* table = fopen(path.c_str(), "r");
+    if (table == nullptr) {
+        LOGFC(COLOR_RED, stderr, "missing table %s\n", path.c_str());
+        return;
+    }
+
+    char line[1 << 16];
+    size_t num_compute = stoul(config.num_compute);
+    size_t rows = 0, total_changes = 0, total_divides = 0;
+    vector<string> last;
+    fgets(line, sizeof(line), table); // header
+    while (fgets(line, sizeof(line), table) != nullptr) {
+        line[strcspn(line, "\n")] = 0;
+        // keep empty fields so the column indexes stay the same
+        vector<string> row;
+        string field;
+        for (char* c = line;; ++c) {
+            if (*c == ',' || *c == 0) {
+                row.push_back(field);
+                field.clear();
+                if (*c == 0) {
+                    break;
+                }
+            }
+            else {
+                field += *c;
+            }
+        }
+        if (row.size() != num_compute + 4) {
+            continue;
+        }
+        total_changes += row[num_compute + 2].empty() ? 0 : stoul(row[num_compute + 2]);
+        total_divides += row[num_compute + 3].empty() ? 0 : stoul(row[num_compute + 3]);
+        last = row;
+        ++rows;
+    }
+    fclose(table);
+
+    if (rows == 0) {
+        return;
+    }
+
+    size_t max_load = 0, min_load = SIZE_MAX, sum_load = 0;
+    for (size_t node = 0; node < num_compute; ++node) {
+        size_t load = stoul(last[node + 1]);
+        max_load = max(max_load, load);
+        min_load = min(min_load, load);
+        sum_load += load;
+    }
+    size_t mean_load = sum_load / num_compute;
+
+    LOGF(summary, "%s,%s,%s,%s,%s,%s,%s,%lu,%lu,%lu,%.4f,%s,%lu,%lu\n", config.lb_type.c_str(), config.num_compute.c_str()
+        , config.num_shard_per_compute.c_str(), config.load_imbalance_ratio.c_str(), config.workload.c_str(), config.random_seed.c_str()
+        , last[0].c_str(), max_load, min_load, mean_load, mean_load == 0 ? 0.0 : static_cast<double>(max_load) / mean_load
+        , last[num_compute + 1].c_str(), total_changes, total_divides);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && (!strcmp(argv[1], "--help") || !strcmp(argv[1], "-h"))) {
+        help();
+        return 0;
+    }
+    parse_input(argc, argv);
+
+    filesystem::create_directories(input.out_dir + "/table");
+    filesystem::create_directories(input.out_dir + "/raw");
+
+    vector<Config> configs;
+    for (const string& lt : input.lb_type)
+        for (const string& nc : input.num_compute)
+            for (const string& nspc : input.num_shard_per_compute)
+                for (const string& lir : input.load_imbalance_ratio)
+                    for (const string& wl : input.workload)
+                        for (const string& rs : input.random_seed)
+                            configs.push_back({lt, nc, nspc, lir, wl, rs});
+
+    LOGF(stdout, "running %lu configurations with %lu jobs\n", configs.size(), input.jobs);
+
+    map<pid_t, size_t> running;
+    size_t next = 0, failed = 0;
+    while (next < configs.size() || !running.empty()) {
+        while (next < configs.size() && running.size() < input.jobs) {
+            pid_t pid = launch(configs[next]);
+            if (pid < 0) {
+                LOGFC(COLOR_RED, stderr, "could not start %s: %s\n", configs[next].name().c_str(), strerror(errno));
+                ++failed;
+            }
+            else {
+                running[pid] = next;
+            }
+            ++next;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            break;
+        }
+        auto it = running.find(pid);
+        if (it == running.end()) {
+            continue;
+        }
+        const Config& config = configs[it->second];
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            LOGFC(COLOR_RED, stderr, "%s failed\n", config.name().c_str());
+            ++failed;
+        }
+        else {
+            LOGF(stdout, "%s done\n", config.name().c_str());
+        }
+        running.erase(it);
+    }
+
+    string path = input.out_dir + "/summary.csv";
+    FILE* summary = fopen(path.c_str(), "w");
+    if (summary == nullptr) {
+        LOGFC(COLOR_RED, stderr, "could not open %s\n", path.c_str());
+        return 1;
+    }
+    LOGF(summary, "lb_type,num_compute,num_shard_per_compute,load_imbalance_ratio,workload,random_seed"
+        ",round,max_load,min_load,mean_load,max_mean_ratio,num_shards,changes,divides\n");
+    for (const Config& config : configs) {
+        summarize(config, summary);
+    }
+    fclose(summary);
+
+    LOGF(stdout, "%lu runs failed, summary is in %s\n", failed, path.c_str());
+    return failed != 0;
+}
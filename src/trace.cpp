@@ -0,0 +1,126 @@
+#include "trace.h"
+#include "testlog.h"
+
+#include <assert.h>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace TimberSaw {
+
+    Trace_Writer::Trace_Writer(const std::string& path, size_t key_lb, size_t key_ub)
+        : file(fopen(path.c_str(), "wb")), buffer(new uint8_t[trace_buffer_size]) {
+        if (file == nullptr) {
+            delete[] buffer;
+            throw std::runtime_error("could not open trace file " + path + " for writing");
+        }
+
+        Trace_Header header;
+        memcpy(header.magic, trace_magic, sizeof(header.magic));
+        header.version = trace_version;
+        header.reserved = 0;
+        header.key_lb = key_lb;
+        header.key_ub = key_ub;
+        fwrite(&header, sizeof(header), 1, file);
+        prev_key = key_lb;
+    }
+
+    Trace_Writer::~Trace_Writer() {
+        close();
+        delete[] buffer;
+    }
+
+    void Trace_Writer::record(size_t key, uint8_t op, uint64_t timestamp) {
+        assert(timestamp >= prev_timestamp);
+        assert(op < 16);
+        if (pos + trace_max_record_size > trace_buffer_size) {
+            flush();
+        }
+
+        int64_t key_delta = static_cast<int64_t>(key - prev_key);
+        put_varint((static_cast<uint64_t>(key_delta) << 1) ^ static_cast<uint64_t>(key_delta >> 63));
+        put_varint(((timestamp - prev_timestamp) << 4) | op);
+        prev_key = key;
+        prev_timestamp = timestamp;
+        ++_num_records;
+    }
+
+    void Trace_Writer::flush() {
+        if (file == nullptr || pos == 0) {
+            return;
+        }
+        fwrite(buffer, 1, pos, file);
+        fflush(file);
+        pos = 0;
+    }
+
+    void Trace_Writer::close() {
+        if (file == nullptr) {
+            return;
+        }
+        flush();
+        fclose(file);
+        file = nullptr;
+    }
+
+    Trace_Reader::Trace_Reader(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("could not open trace file " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Trace_Header)) {
+            ::close(fd);
+            throw std::runtime_error("invalid trace file " + path);
+        }
+        size = st.st_size;
+
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("could not map trace file " + path);
+        }
+        data = static_cast<const uint8_t*>(addr);
+        madvise(addr, size, MADV_SEQUENTIAL);
+
+        if (memcmp(header().magic, trace_magic, sizeof(trace_magic)) != 0 || header().version != trace_version) {
+            munmap(addr, size);
+            throw std::runtime_error("invalid trace file " + path);
+        }
+
+        reset();
+    }
+
+    Trace_Reader::~Trace_Reader() {
+        if (data != nullptr) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+
+    bool Trace_Reader::next(Trace_Record& rec) {
+        uint64_t zkey, ts_op;
+        if (!get_varint(zkey) || !get_varint(ts_op)) {
+            pos = size;
+            return false;
+        }
+
+        int64_t key_delta = static_cast<int64_t>(zkey >> 1) ^ -static_cast<int64_t>(zkey & 1);
+        prev_key += key_delta;
+        prev_timestamp += ts_op >> 4;
+
+        rec.key = prev_key;
+        rec.op = static_cast<uint8_t>(ts_op & 0xf);
+        rec.timestamp = prev_timestamp;
+        return true;
+    }
+
+    void Trace_Reader::reset() {
+        pos = sizeof(Trace_Header);
+        prev_key = header().key_lb;
+        prev_timestamp = 0;
+    }
+}
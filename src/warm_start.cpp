@@ -0,0 +1,196 @@
+#include "warm_start.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace TimberSaw {
+
+    // walks the cumulative load of sorted buckets. keys and targets should only grow between two calls
+    struct Load_Cursor {
+        const std::vector<Key_Load_Bucket>& buckets;
+        size_t bucket = 0;
+        long double before = 0; // load of the buckets before bucket
+
+        // load of the keys less than key
+        long double load_before(size_t key) {
+            while (bucket < buckets.size() && buckets[bucket].ub <= key) {
+                before += buckets[bucket].load;
+                ++bucket;
+            }
+            if (bucket == buckets.size() || key <= buckets[bucket].lb) {
+                return before;
+            }
+            const Key_Load_Bucket& b = buckets[bucket];
+            return before + static_cast<long double>(b.load) * (key - b.lb) / (b.ub - b.lb);
+        }
+
+        // smallest key whose load_before reaches target, or key_ub if none does
+        size_t key_of(long double target, size_t key_ub) {
+            while (bucket < buckets.size() && before + buckets[bucket].load < target) {
+                before += buckets[bucket].load;
+                ++bucket;
+            }
+            if (bucket == buckets.size()) {
+                return key_ub;
+            }
+            const Key_Load_Bucket& b = buckets[bucket];
+            if (target <= before) {
+                return b.lb;
+            }
+            size_t offset = static_cast<size_t>(std::ceil((target - before) * (b.ub - b.lb) / b.load));
+            return b.lb + std::min(offset, b.ub - b.lb);
+        }
+    };
+
+    Key_Load_Histogram::Key_Load_Histogram(std::vector<Key_Load_Bucket> buckets) : _buckets(std::move(buckets)) {
+        for (size_t i = 0; i < _buckets.size(); ++i) {
+            assert(_buckets[i].lb < _buckets[i].ub && (i == 0 || _buckets[i - 1].ub <= _buckets[i].lb));
+            _total_load += _buckets[i].load;
+        }
+    }
+
+    Key_Load_Histogram Key_Load_Histogram::from_trace(Trace_Reader& trace, size_t key_lb, size_t key_ub, size_t num_buckets
+        , size_t lr_time, size_t rr_time, size_t lw_time, size_t fl_time) {
+        assert(key_lb < key_ub && num_buckets > 0);
+        size_t width = (key_ub - key_lb + num_buckets - 1) / num_buckets;
+        num_buckets = (key_ub - key_lb + width - 1) / width;
+
+        Key_Load_Histogram histogram;
+        histogram._buckets.resize(num_buckets);
+        for (size_t i = 0; i < num_buckets; ++i) {
+            histogram._buckets[i].lb = key_lb + i * width;
+            histogram._buckets[i].ub = std::min(key_lb + (i + 1) * width, key_ub);
+            histogram._buckets[i].load = 0;
+        }
+
+        Trace_Record rec;
+        trace.reset();
+        while (trace.next(rec)) {
+            if (rec.key < key_lb || rec.key >= key_ub) {
+                continue;
+            }
+            size_t load = rec.lr() * lr_time + rec.rr() * rr_time + rec.lw() * lw_time + rec.fl() * fl_time;
+            histogram._buckets[(rec.key - key_lb) / width].load += load;
+            histogram._total_load += load;
+        }
+        trace.reset();
+        return histogram;
+    }
+
+    Key_Load_Histogram Key_Load_Histogram::from_checkpoint(const Checkpoint_Reader& checkpoint) {
+        size_t num = checkpoint.header().num_shards;
+        const Checkpoint_Shard* shards = checkpoint.shards();
+        size_t first = 0;
+        while (first < num && shards[first].prev != num) {
+            ++first;
+        }
+
+        Key_Load_Histogram histogram;
+        histogram._buckets.reserve(num);
+        size_t count = 0;
+        for (size_t shard = first; shard < num && count < num; shard = shards[shard].next, ++count) {
+            if (shards[shard].ub <= shards[shard].lb || (count > 0 && shards[shard].lb < histogram._buckets.back().ub)) {
+                throw std::runtime_error("the key ranges of the checkpoint are not in key order");
+            }
+            histogram._buckets.push_back({shards[shard].lb, shards[shard].ub, shards[shard].last_load});
+            histogram._total_load += shards[shard].last_load;
+        }
+        if (num == 0 || count != num) {
+            throw std::runtime_error("the shards of the checkpoint are not linked in key order");
+        }
+        return histogram;
+    }
+
+    Key_Load_Histogram Key_Load_Histogram::read(const std::string& path, size_t key_lb, size_t key_ub, size_t num_buckets
+        , size_t lr_time, size_t rr_time, size_t lw_time, size_t fl_time) {
+        char magic[8];
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            throw std::runtime_error("could not open load profile " + path);
+        }
+        bool read = fread(magic, sizeof(magic), 1, file) == 1;
+        fclose(file);
+
+        if (read && memcmp(magic, trace_magic, sizeof(magic)) == 0) {
+            Trace_Reader trace(path);
+            return from_trace(trace, key_lb, key_ub, num_buckets, lr_time, rr_time, lw_time, fl_time);
+        }
+        if (read && memcmp(magic, checkpoint_magic, sizeof(magic)) == 0) {
+            Checkpoint_Reader checkpoint(path);
+            return from_checkpoint(checkpoint);
+        }
+        throw std::runtime_error("load profile " + path + " is neither a trace nor a checkpoint");
+    }
+
+    void Key_Load_Histogram::layout(size_t key_lb, size_t key_ub, size_t num_compute, size_t num_shards, size_t min_shard_size
+        , std::vector<Checkpoint_Shard>& records) const {
+        assert(num_compute > 0 && num_shards >= num_compute && min_shard_size > 0);
+        assert(key_ub - key_lb >= num_shards * min_shard_size);
+
+        // only the loads inside [key_lb, key_ub) count. without any, the layout is uniform as without a warm start
+        std::vector<Key_Load_Bucket> clipped;
+        clipped.reserve(_buckets.size());
+        long double total = 0;
+        for (const Key_Load_Bucket& b : _buckets) {
+            size_t lb = std::max(b.lb, key_lb), ub = std::min(b.ub, key_ub);
+            if (lb < ub && b.load > 0) {
+                size_t load = (lb == b.lb && ub == b.ub) ? b.load
+                    : static_cast<size_t>(static_cast<long double>(b.load) * (ub - lb) / (b.ub - b.lb));
+                clipped.push_back({lb, ub, load});
+                total += load;
+            }
+        }
+        if (total == 0) {
+            clipped.assign(1, {key_lb, key_ub, key_ub - key_lb});
+            total = key_ub - key_lb;
+        }
+
+        // every shard ends at the key where the load reaches its share, but keeps min_shard_size keys for itself and
+        // for each of the shards after it. a hot key ends up alone in a shard of min_shard_size keys
+        records.resize(num_shards);
+        Load_Cursor cuts{clipped}, loads{clipped};
+        std::vector<long double> shard_loads(num_shards);
+        size_t lb = key_lb;
+        long double load_lb = 0;
+        for (size_t shard = 0; shard < num_shards; ++shard) {
+            size_t ub = key_ub;
+            if (shard + 1 < num_shards) {
+                ub = cuts.key_of(total * (shard + 1) / num_shards, key_ub);
+                ub = std::min(std::max(ub, lb + min_shard_size), key_ub - (num_shards - shard - 1) * min_shard_size);
+            }
+            long double load_ub = loads.load_before(ub);
+            records[shard].lb = lb;
+            records[shard].ub = ub;
+            records[shard].last_load = 0;
+            records[shard].last_remote_reads = 0;
+            records[shard].next = shard + 1;
+            records[shard].prev = (shard == 0 ? num_shards : shard - 1);
+            records[shard].memory = 0;
+            shard_loads[shard] = load_ub - load_lb;
+            lb = ub;
+            load_lb = load_ub;
+        }
+
+        // a node takes the next shard while the middle of the shard is within the load left per node, which is
+        // recomputed for every node so a node past its share(a hot key) does not starve the next ones.
+        // the last nodes keep one shard each, so every node owns a non empty consecutive range even if those shards
+        // have no load
+        long double before = 0, node_load = 0, target = total / num_compute;
+        size_t node = 0;
+        for (size_t shard = 0; shard < num_shards; ++shard) {
+            bool must_move = (num_shards - shard) <= (num_compute - 1 - node);
+            if (node + 1 < num_compute && (must_move || (node_load > 0 && node_load + shard_loads[shard] / 2 > target))) {
+                ++node;
+                node_load = 0;
+                target = (total - before) / (num_compute - node);
+            }
+            records[shard].owner = node;
+            node_load += shard_loads[shard];
+            before += shard_loads[shard];
+        }
+        assert(records[num_shards - 1].owner == num_compute - 1);
+    }
+}
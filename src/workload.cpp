@@ -0,0 +1,130 @@
+#include "workload.h"
+
+#include <assert.h>
+#include <cmath>
+#include <stdexcept>
+
+namespace TimberSaw {
+
+    Workload::Workload(const Workload_Options& options)
+        : opt(options), num_keys(options.key_ub - options.key_lb), type_gen(options.seed), aux_gen(options.seed ^ 0x9e3779b97f4a7c15ull) {
+        assert(options.key_lb < options.key_ub);
+
+        size_t r = 0, u = 0, i = 0, s = 0, m = 0;
+        char default_dist = KEY_ZIPF;
+        switch (opt.workload) {
+        case 'x': r = opt.read_percent; u = 100 - r; break;
+        case 'a': r = 50; u = 50; break;
+        case 'b': r = 95; u = 5; break;
+        case 'c': r = 100; break;
+        case 'd': r = 95; i = 5; default_dist = KEY_LATEST; break;
+        case 'e': s = 95; i = 5; break;
+        case 'f': r = 50; m = 50; break;
+        default:
+            throw std::invalid_argument("unknown workload " + std::string(1, opt.workload));
+        }
+        read_p = r;
+        update_p = read_p + u;
+        insert_p = update_p + i;
+        scan_p = insert_p + s;
+        rmw_p = scan_p + m;
+        assert(rmw_p == 100);
+
+        if (opt.key_dist == 0) {
+            opt.key_dist = default_dist;
+        }
+
+        switch (opt.key_dist) {
+        case KEY_ZIPF: key_gen.reset(new Zipf_Key_Generator(opt.seed, num_keys)); break;
+        case KEY_UNIFORM: key_gen.reset(new Uniform_Key_Generator(opt.seed, num_keys)); break;
+        case KEY_LATEST: key_gen.reset(new Latest_Key_Generator(opt.seed, num_keys, insert_head)); break;
+        case KEY_HOTSPOT: key_gen.reset(new Hotspot_Key_Generator(opt.seed, num_keys, opt.hotspot_key_percent, opt.hotspot_op_percent)); break;
+        default:
+            throw std::invalid_argument("unknown key distribution " + std::string(1, opt.key_dist));
+        }
+
+        opt.flash_keys = std::max<size_t>(std::min(opt.flash_keys, num_keys), 1);
+        flash_base = aux_gen.Uniform(num_keys - opt.flash_keys + 1);
+    }
+
+    size_t Workload::next_key() {
+        if (opt.flash_duration != 0 && op_idx >= opt.flash_start && op_idx - opt.flash_start < opt.flash_duration
+            && aux_gen.Uniform(100) < opt.flash_percent) {
+            return opt.key_lb + flash_base + aux_gen.Uniform(opt.flash_keys);
+        }
+
+        size_t rank = key_gen->next();
+        assert(rank < num_keys);
+        if (opt.drift_period != 0) {
+            size_t offset = static_cast<size_t>((static_cast<double>(op_idx % opt.drift_period) / opt.drift_period) * num_keys);
+            rank = (rank + offset) % num_keys;
+        }
+        return opt.key_lb + rank;
+    }
+
+    void Workload::next(Workload_Op& op) {
+        size_t p = type_gen.Uniform(100);
+        op.scan_length = 1;
+        if (p < read_p) {
+            op.type = OP_READ;
+        }
+        else if (p < update_p) {
+            op.type = OP_UPDATE;
+        }
+        else if (p < insert_p) {
+            op.type = OP_INSERT;
+        }
+        else if (p < scan_p) {
+            op.type = OP_SCAN;
+            op.scan_length = 1 + aux_gen.Uniform(opt.max_scan_length);
+        }
+        else {
+            op.type = OP_READ_MODIFY_WRITE;
+        }
+
+        if (op.type == OP_INSERT) {
+            op.key = opt.key_lb + insert_head;
+            insert_head = (insert_head + 1) % num_keys;
+        }
+        else {
+            op.key = next_key();
+        }
+
+        if (op.type == OP_SCAN && op.key + op.scan_length > opt.key_ub) {
+            op.scan_length = opt.key_ub - op.key;
+        }
+        ++op_idx;
+    }
+
+    double Workload::rate_factor() const {
+        if (opt.diurnal_period == 0) {
+            return 1.0;
+        }
+        double phase = static_cast<double>(op_idx % opt.diurnal_period) / opt.diurnal_period;
+        return 1.0 + (opt.diurnal_amplitude / 100.0) * std::sin(2.0 * M_PI * phase);
+    }
+
+    const char* Workload::name(char workload) {
+        switch (workload) {
+        case 'x': return "read/update mix";
+        case 'a': return "ycsb A(50% read, 50% update)";
+        case 'b': return "ycsb B(95% read, 5% update)";
+        case 'c': return "ycsb C(100% read)";
+        case 'd': return "ycsb D(95% read, 5% insert)";
+        case 'e': return "ycsb E(95% scan, 5% insert)";
+        case 'f': return "ycsb F(50% read, 50% read-modify-write)";
+        default: return "unknown";
+        }
+    }
+
+    const char* Workload::key_dist_name(char key_dist) {
+        switch (key_dist) {
+        case 0: return "workload default";
+        case KEY_ZIPF: return "zipf";
+        case KEY_UNIFORM: return "uniform";
+        case KEY_LATEST: return "latest";
+        case KEY_HOTSPOT: return "hotspot";
+        default: return "unknown";
+        }
+    }
+}